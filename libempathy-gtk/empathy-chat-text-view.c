@@ -1365,10 +1365,16 @@ chat_text_view_replace_smiley (const gchar *text,
 {
 	EmpathySmileyHit *hit = match_data;
 	GtkTextBuffer *buffer = GTK_TEXT_BUFFER (user_data);
+	GdkPixbuf *pixbuf;
 	GtkTextIter iter;
 
 	gtk_text_buffer_get_end_iter (buffer, &iter);
-	gtk_text_buffer_insert_pixbuf (buffer, &iter, hit->pixbuf);
+	pixbuf = empathy_smiley_hit_get_pixbuf (hit);
+	if (pixbuf != NULL) {
+		gtk_text_buffer_insert_pixbuf (buffer, &iter, pixbuf);
+	} else {
+		gtk_text_buffer_insert (buffer, &iter, text, len);
+	}
 }
 
 static void
@@ -66,6 +66,12 @@
 
 #define IS_ENTER(v) (v == GDK_KEY_Return || v == GDK_KEY_ISO_Enter || v == GDK_KEY_KP_Enter)
 #define COMPOSING_STOP_TIMEOUT 5
+/* Number of messages fetched from the logs when the user scrolls back past
+ * the oldest message kept by the view */
+#define HISTORY_FETCH_SIZE 50
+/* Group changes affecting at least this many members (e.g. a netsplit) are
+ * summarized in a single event */
+#define MEMBERS_CHANGED_SUMMARY_MIN 10
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChat)
 struct _EmpathyChatPriv {
@@ -85,9 +91,15 @@ struct _EmpathyChatPriv {
 	GList             *input_history;
 	GList             *input_history_current;
 	GList             *compositors;
-	GCompletion       *completion;
+	/* Nick completion index: CompletionEntry sorted by key, and
+	 * EmpathyContact -> CompletionEntry */
+	GPtrArray         *completion_entries;
+	GHashTable        *completion_by_contact;
 	guint              composing_stop_timeout_id;
 	guint              block_events_timeout_id;
+	/* Number of members-changed still to come for the batch which was
+	 * just summarized, and so shouldn't each print a line */
+	guint              members_batch_left;
 	TpHandleType       handle_type;
 	gint               contacts_width;
 	gboolean           has_input_vscroll;
@@ -150,6 +162,10 @@ struct _EmpathyChatPriv {
 	 * notified again about the already notified pending messages when the
 	 * messages in tab will be properly shown */
 	gboolean           retrieving_backlogs;
+	/* Pending messages when the backlog was requested, as a set of
+	 * EmpathyMessage keyed by empathy_message_hash(). Used to filter them
+	 * out of the backlog. */
+	GHashTable        *backlog_pending;
 	gboolean           sms_channel;
 
 	/* we need to know whether populate-popup happened in response to
@@ -165,6 +181,13 @@ typedef struct {
 	                       * When no modifications were made, it is NULL */
 } InputHistoryEntry;
 
+typedef struct {
+	gchar          *key; /* Normalized and casefolded alias */
+	EmpathyContact *contact;
+	gint64          last_spoke;
+	gulong          alias_changed_id;
+} CompletionEntry;
+
 enum {
 	COMPOSING,
 	NEW_MESSAGE,
@@ -1384,6 +1407,235 @@ chat_state_changed_cb (EmpathyTpChat      *tp_chat,
 	}
 }
 
+static gchar *
+chat_completion_key (const gchar *str)
+{
+	gchar *tmp, *key;
+
+	tmp = g_utf8_normalize (str, -1, G_NORMALIZE_DEFAULT);
+	if (tmp == NULL) {
+		return g_strdup ("");
+	}
+
+	key = g_utf8_casefold (tmp, -1);
+	g_free (tmp);
+
+	return key;
+}
+
+static void
+chat_completion_entry_free (CompletionEntry *entry)
+{
+	g_signal_handler_disconnect (entry->contact, entry->alias_changed_id);
+	g_free (entry->key);
+	g_object_unref (entry->contact);
+	g_slice_free (CompletionEntry, entry);
+}
+
+/* Index of the first entry whose key is not lower than @key */
+static guint
+chat_completion_lower_bound (EmpathyChat *chat,
+			     const gchar *key)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint low = 0, high = priv->completion_entries->len;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		CompletionEntry *entry;
+
+		entry = g_ptr_array_index (priv->completion_entries, mid);
+		if (strcmp (entry->key, key) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+static void
+chat_completion_remove (EmpathyChat    *chat,
+			EmpathyContact *contact)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	CompletionEntry *entry;
+	guint i;
+
+	entry = g_hash_table_lookup (priv->completion_by_contact, contact);
+	if (entry == NULL) {
+		return;
+	}
+
+	/* Entries sharing a key are contiguous, find ours among them */
+	for (i = chat_completion_lower_bound (chat, entry->key);
+	     i < priv->completion_entries->len; i++) {
+		if (g_ptr_array_index (priv->completion_entries, i) == entry) {
+			g_ptr_array_remove_index (priv->completion_entries, i);
+			break;
+		}
+	}
+
+	g_hash_table_remove (priv->completion_by_contact, contact);
+	chat_completion_entry_free (entry);
+}
+
+static void chat_completion_alias_changed_cb (EmpathyContact *contact,
+					      GParamSpec     *pspec,
+					      EmpathyChat    *chat);
+
+static void
+chat_completion_add (EmpathyChat    *chat,
+		     EmpathyContact *contact)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	CompletionEntry *entry;
+	gint64 last_spoke = 0;
+	guint pos;
+
+	entry = g_hash_table_lookup (priv->completion_by_contact, contact);
+	if (entry != NULL) {
+		/* The alias may have changed, re-insert it at the right place */
+		last_spoke = entry->last_spoke;
+		chat_completion_remove (chat, contact);
+	}
+
+	entry = g_slice_new (CompletionEntry);
+	entry->key = chat_completion_key (empathy_contact_get_alias (contact));
+	entry->contact = g_object_ref (contact);
+	entry->last_spoke = last_spoke;
+	/* The alias of a member often arrives after it joined */
+	entry->alias_changed_id = g_signal_connect (contact, "notify::alias",
+		G_CALLBACK (chat_completion_alias_changed_cb), chat);
+
+	pos = chat_completion_lower_bound (chat, entry->key);
+
+	/* No g_ptr_array_insert () with our GLib requirement */
+	g_ptr_array_add (priv->completion_entries, NULL);
+	memmove (priv->completion_entries->pdata + pos + 1,
+		 priv->completion_entries->pdata + pos,
+		 (priv->completion_entries->len - pos - 1) * sizeof (gpointer));
+	priv->completion_entries->pdata[pos] = entry;
+
+	g_hash_table_insert (priv->completion_by_contact, contact, entry);
+}
+
+static void
+chat_completion_alias_changed_cb (EmpathyContact *contact,
+				  GParamSpec     *pspec,
+				  EmpathyChat    *chat)
+{
+	chat_completion_add (chat, contact);
+}
+
+static void
+chat_completion_clear (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	g_hash_table_remove_all (priv->completion_by_contact);
+	g_ptr_array_foreach (priv->completion_entries,
+			     (GFunc) chat_completion_entry_free, NULL);
+	g_ptr_array_set_size (priv->completion_entries, 0);
+}
+
+static void
+chat_completion_populate (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GList *members, *l;
+
+	chat_completion_clear (chat);
+
+	members = empathy_contact_list_get_members (
+		EMPATHY_CONTACT_LIST (priv->tp_chat));
+	for (l = members; l != NULL; l = l->next) {
+		chat_completion_add (chat, l->data);
+		g_object_unref (l->data);
+	}
+	g_list_free (members);
+}
+
+static gint
+chat_completion_recent_first (gconstpointer a,
+			      gconstpointer b)
+{
+	const CompletionEntry *entry_a = a;
+	const CompletionEntry *entry_b = b;
+
+	if (entry_a->last_spoke != entry_b->last_spoke) {
+		return entry_a->last_spoke > entry_b->last_spoke ? -1 : 1;
+	}
+
+	return strcmp (entry_a->key, entry_b->key);
+}
+
+/* Returns the entries whose key starts with the key of @prefix, the
+ * members who spoke most recently first. */
+static GList *
+chat_completion_complete (EmpathyChat *chat,
+			  const gchar *prefix)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GList *hits = NULL;
+	gchar *key;
+	guint i;
+
+	key = chat_completion_key (prefix);
+
+	for (i = chat_completion_lower_bound (chat, key);
+	     i < priv->completion_entries->len; i++) {
+		CompletionEntry *entry;
+
+		entry = g_ptr_array_index (priv->completion_entries, i);
+		if (!g_str_has_prefix (entry->key, key)) {
+			break;
+		}
+
+		hits = g_list_prepend (hits, entry);
+	}
+
+	g_free (key);
+
+	return g_list_sort (hits, chat_completion_recent_first);
+}
+
+/* Returns the length in bytes of the shortest prefix of @alias matching
+ * the whole of @prefix, which may not be the length of @prefix itself
+ * once both are folded (e.g. "stras" for "Straße"). */
+static gsize
+chat_completion_match_len (const gchar *alias,
+			   const gchar *prefix)
+{
+	const gchar *p;
+	gchar       *key;
+	gsize        len = 0;
+
+	key = chat_completion_key (prefix);
+
+	for (p = alias; *p != '\0' && *key != '\0'; ) {
+		gchar    *head, *head_key;
+		gboolean  matched;
+
+		p = g_utf8_next_char (p);
+		head = g_strndup (alias, p - alias);
+		head_key = chat_completion_key (head);
+		matched = g_str_has_prefix (head_key, key);
+		g_free (head_key);
+		g_free (head);
+
+		if (matched) {
+			len = p - alias;
+			break;
+		}
+	}
+
+	g_free (key);
+
+	return len;
+}
+
 static void
 chat_message_received (EmpathyChat *chat,
 	EmpathyMessage *message,
@@ -1394,6 +1646,17 @@ chat_message_received (EmpathyChat *chat,
 
 	sender = empathy_message_get_sender (message);
 
+	if (sender != NULL) {
+		CompletionEntry *entry;
+
+		entry = g_hash_table_lookup (priv->completion_by_contact,
+					     sender);
+		if (entry != NULL) {
+			entry->last_spoke = MAX (entry->last_spoke,
+				empathy_message_get_timestamp (message));
+		}
+	}
+
 	if (empathy_message_is_edit (message)) {
 		DEBUG ("Editing message '%s' to '%s'",
 			empathy_message_get_supersedes (message),
@@ -1880,8 +2143,8 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 	    event->keyval == GDK_KEY_Tab) {
 		GtkTextBuffer *buffer;
 		GtkTextIter    start, current;
-		gchar         *nick, *completed;
-		GList         *list, *completed_list;
+		gchar         *nick, *completed = NULL;
+		GList         *completed_list;
 		gboolean       is_start_of_buffer;
 
 		buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (EMPATHY_CHAT (chat)->input_text_view));
@@ -1894,13 +2157,47 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 		}
 		is_start_of_buffer = gtk_text_iter_is_start (&start);
 
-		list = empathy_contact_list_get_members (EMPATHY_CONTACT_LIST (priv->tp_chat));
-		g_completion_add_items (priv->completion, list);
-
 		nick = gtk_text_buffer_get_text (buffer, &start, &current, FALSE);
-		completed_list = g_completion_complete (priv->completion,
-							nick,
-							&completed);
+		completed_list = chat_completion_complete (chat, nick);
+
+		if (completed_list != NULL) {
+			const gchar *first;
+			gsize        mlen, clen;
+			GList       *l;
+
+			/* Like GCompletion, replace the typed text with the
+			 * aliases' own common prefix, as long as it still
+			 * covers what was typed. Aliases are compared a
+			 * character at a time so a multibyte one is never
+			 * cut in half. */
+			first = empathy_contact_get_alias (
+				((CompletionEntry *) completed_list->data)->contact);
+			mlen = chat_completion_match_len (first, nick);
+			clen = strlen (first);
+
+			for (l = completed_list->next; l != NULL && clen > 0; l = l->next) {
+				const gchar *alias, *p, *q;
+
+				alias = empathy_contact_get_alias (
+					((CompletionEntry *) l->data)->contact);
+
+				p = first;
+				q = alias;
+				while ((gsize) (p - first) < clen && *q != '\0' &&
+				       g_utf8_get_char (p) == g_utf8_get_char (q)) {
+					p = g_utf8_next_char (p);
+					q = g_utf8_next_char (q);
+				}
+
+				clen = p - first;
+			}
+
+			if (clen >= mlen && clen > 0) {
+				completed = g_strndup (first, clen);
+			} else {
+				completed = g_strdup (nick);
+			}
+		}
 
 		g_free (nick);
 
@@ -1921,7 +2218,8 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 				 * which might be cased all wrong.
 				 * Fixes #120876
 				 * */
-				text = empathy_contact_get_alias (completed_list->data);
+				text = empathy_contact_get_alias (
+					((CompletionEntry *) completed_list->data)->contact);
 			} else {
 				text = completed;
 
@@ -1931,7 +2229,9 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 				 * */
 				 message = g_string_new ("");
 				 for (l = completed_list; l != NULL; l = l->next) {
-					g_string_append (message, empathy_contact_get_alias (l->data));
+					CompletionEntry *entry = l->data;
+
+					g_string_append (message, empathy_contact_get_alias (entry->contact));
 					g_string_append (message, " - ");
 				 }
 				 empathy_chat_view_append_event (chat->view, message->str);
@@ -1959,10 +2259,7 @@ chat_input_key_press_event_cb (GtkWidget   *widget,
 			g_free (completed);
 		}
 
-		g_completion_clear_items (priv->completion);
-
-		g_list_foreach (list, (GFunc) g_object_unref, NULL);
-		g_list_free (list);
+		g_list_free (completed_list);
 
 		return TRUE;
 	}
@@ -2402,26 +2699,18 @@ static gboolean
 chat_log_filter (TplEvent *event,
 		 gpointer user_data)
 {
-	EmpathyChat *chat = user_data;
+	GHashTable *backlog_pending = user_data;
 	EmpathyMessage *message;
-	EmpathyChatPriv *priv = GET_PRIV (chat);
-	const GList *pending;
+	gboolean pending;
 
 	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
-	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
 	message = empathy_message_from_tpl_log_event (event);
-
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data)) {
-			g_object_unref (message);
-			return FALSE;
-		}
-	}
-
+	pending = g_hash_table_lookup_extended (backlog_pending, message,
+						NULL, NULL);
 	g_object_unref (message);
-	return TRUE;
+
+	return !pending;
 }
 
 
@@ -2440,10 +2729,12 @@ show_pending_messages (EmpathyChat *chat) {
 
 	messages = empathy_tp_chat_get_pending_messages (priv->tp_chat);
 
+	empathy_chat_view_begin_batch (chat->view);
 	for (l = messages; l != NULL ; l = g_list_next (l)) {
 		EmpathyMessage *message = EMPATHY_MESSAGE (l->data);
 		chat_message_received (chat, message, TRUE);
 	}
+	empathy_chat_view_end_batch (chat->view);
 }
 
 
@@ -2458,6 +2749,11 @@ got_filtered_messages_cb (GObject *manager,
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GError *error = NULL;
 
+	tp_clear_pointer (&priv->backlog_pending, g_hash_table_unref);
+
+	/* Display the backlog and the pending messages in one go */
+	empathy_chat_view_begin_batch (chat->view);
+
 	if (!tpl_log_manager_get_filtered_events_finish (TPL_LOG_MANAGER (manager),
 		result, &messages, &error)) {
 		DEBUG ("%s. Aborting.", error->message);
@@ -2510,6 +2806,8 @@ out:
 	priv->can_show_pending = TRUE;
 	show_pending_messages (chat);
 
+	empathy_chat_view_end_batch (chat->view);
+
 	/* FIXME: See Bug#610994, we are forcing the ACK of the queue. See comments
 	 * about it in EmpathyChatPriv definition */
 	priv->retrieving_backlogs = FALSE;
@@ -2519,11 +2817,23 @@ out:
 	empathy_chat_view_scroll (chat->view, TRUE);
 }
 
+static TplEntity *
+chat_new_log_target (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
+	  return tpl_entity_new_from_room_id (priv->id);
+	else
+	  return tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
+}
+
 static void
 chat_add_logs (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	TplEntity       *target;
+	const GList     *l;
 
 	if (!priv->id) {
 		return;
@@ -2533,54 +2843,142 @@ chat_add_logs (EmpathyChat *chat)
 	empathy_chat_view_scroll (chat->view, FALSE);
 
 	/* Add messages from last conversation */
-	if (priv->handle_type == TP_HANDLE_TYPE_ROOM)
-	  target = tpl_entity_new_from_room_id (priv->id);
-	else
-	  target = tpl_entity_new (priv->id, TPL_ENTITY_CONTACT, NULL, NULL);
+	target = chat_new_log_target (chat);
+
+	/* Pending messages will be shown after the backlog, don't show them
+	 * twice. Index them once rather than scanning them for each event. */
+	priv->backlog_pending = g_hash_table_new_full (
+		(GHashFunc) empathy_message_hash,
+		(GEqualFunc) empathy_message_equal,
+		g_object_unref, NULL);
+
+	if (priv->tp_chat != NULL) {
+		for (l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+		     l != NULL; l = g_list_next (l)) {
+			g_hash_table_insert (priv->backlog_pending,
+					     g_object_ref (l->data), l->data);
+		}
+	}
 
 	priv->retrieving_backlogs = TRUE;
 	tpl_log_manager_get_filtered_events_async (priv->log_manager,
 						   priv->account,
 						   target,
 						   TPL_EVENT_MASK_TEXT,
-						   5,
+						   g_settings_get_uint (priv->gsettings_chat,
+							EMPATHY_PREFS_CHAT_BACKLOG_SIZE),
 						   chat_log_filter,
-						   chat,
+						   priv->backlog_pending,
 						   got_filtered_messages_cb,
 						   (gpointer) chat);
 
 	g_object_unref (target);
 }
 
-static gint
-chat_contacts_completion_func (const gchar *s1,
-			       const gchar *s2,
-			       gsize        n)
+typedef struct {
+	EmpathyChat *chat;
+	gint64       before;
+} HistoryRequest;
+
+static gboolean
+chat_history_filter (TplEvent *event,
+		     gpointer user_data)
 {
-	gchar *tmp, *nick1, *nick2;
-	gint   ret;
+	HistoryRequest *request = user_data;
 
-	if (s1 == s2) {
-		return 0;
+	/* Other messages may have been sent during the second of the oldest
+	 * one displayed; the view skips those it already shows */
+	return tpl_event_get_timestamp (event) <= request->before;
+}
+
+static void
+got_history_cb (GObject *manager,
+		GAsyncResult *result,
+		gpointer user_data)
+{
+	HistoryRequest *request = user_data;
+	EmpathyChat *chat = request->chat;
+	GList *events, *l;
+	GList *messages = NULL, *edits = NULL;
+	GError *error = NULL;
+
+	if (!tpl_log_manager_get_filtered_events_finish (TPL_LOG_MANAGER (manager),
+		result, &events, &error)) {
+		DEBUG ("Failed to retrieve older logs: %s", error->message);
+		g_error_free (error);
+
+		if (EMPATHY_IS_THEME_ADIUM (chat->view)) {
+			empathy_theme_adium_history_failed (
+				EMPATHY_THEME_ADIUM (chat->view));
+		}
+		goto out;
 	}
-	if (!s1 || !s2) {
-		return s1 ? -1 : +1;
+
+	if (!EMPATHY_IS_THEME_ADIUM (chat->view)) {
+		g_list_free_full (events, g_object_unref);
+		goto out;
 	}
 
-	tmp = g_utf8_normalize (s1, -1, G_NORMALIZE_DEFAULT);
-	nick1 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
+	for (l = events; l; l = g_list_next (l)) {
+		EmpathyMessage *message;
 
-	tmp = g_utf8_normalize (s2, -1, G_NORMALIZE_DEFAULT);
-	nick2 = g_utf8_casefold (tmp, -1);
-	g_free (tmp);
+		message = empathy_message_from_tpl_log_event (l->data);
+		g_object_unref (l->data);
+
+		if (empathy_message_is_edit (message))
+			edits = g_list_prepend (edits, message);
+		else
+			messages = g_list_prepend (messages, message);
+	}
+	g_list_free (events);
+
+	messages = g_list_reverse (messages);
+	empathy_theme_adium_prepend_messages (EMPATHY_THEME_ADIUM (chat->view),
+					      messages);
+
+	/* Edits can only be applied once the messages are displayed */
+	edits = g_list_reverse (edits);
+	for (l = edits; l; l = g_list_next (l)) {
+		empathy_chat_view_edit_message (chat->view, l->data);
+	}
+
+	g_list_free_full (messages, g_object_unref);
+	g_list_free_full (edits, g_object_unref);
+
+out:
+	g_object_unref (chat);
+	g_slice_free (HistoryRequest, request);
+}
+
+static void
+chat_history_requested_cb (EmpathyThemeAdium *view,
+			   gint64 before,
+			   EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	HistoryRequest  *request;
+	TplEntity       *target;
 
-	ret = strncmp (nick1, nick2, n);
+	if (!priv->id) {
+		empathy_theme_adium_history_failed (view);
+		return;
+	}
 
-	g_free (nick1);
-	g_free (nick2);
+	request = g_slice_new (HistoryRequest);
+	request->chat = g_object_ref (chat);
+	request->before = before;
 
-	return ret;
+	target = chat_new_log_target (chat);
+	tpl_log_manager_get_filtered_events_async (priv->log_manager,
+						   priv->account,
+						   target,
+						   TPL_EVENT_MASK_TEXT,
+						   HISTORY_FETCH_SIZE,
+						   chat_history_filter,
+						   request,
+						   got_history_cb,
+						   request);
+	g_object_unref (target);
 }
 
 static gchar *
@@ -2654,6 +3052,17 @@ chat_members_changed_cb (EmpathyTpChat  *tp_chat,
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED != reason);
 
+	if (is_member) {
+		chat_completion_add (chat, contact);
+	} else {
+		chat_completion_remove (chat, contact);
+	}
+
+	if (priv->members_batch_left > 0) {
+		priv->members_batch_left--;
+		return;
+	}
+
 	if (priv->block_events_timeout_id != 0)
 		return;
 
@@ -2668,6 +3077,115 @@ chat_members_changed_cb (EmpathyTpChat  *tp_chat,
 	g_free (str);
 }
 
+static gchar *
+build_part_summary (guint           reason,
+		    guint           n_members,
+		    EmpathyContact *actor,
+		    const gchar    *message)
+{
+	GString *s = g_string_new ("");
+	const gchar *actor_name = NULL;
+
+	if (actor != NULL) {
+		actor_name = empathy_contact_get_alias (actor);
+	}
+
+	switch (reason) {
+	case TP_CHANNEL_GROUP_CHANGE_REASON_OFFLINE:
+		g_string_append_printf (s,
+			ngettext ("%u person has disconnected",
+				  "%u people have disconnected",
+				  n_members),
+			n_members);
+		break;
+	case TP_CHANNEL_GROUP_CHANGE_REASON_KICKED:
+		if (actor_name != NULL) {
+			/* translators: reverse the order of these arguments
+			 * if the kicked should come before the kicker in your locale.
+			 */
+			g_string_append_printf (s,
+				ngettext ("%1$u person was kicked by %2$s",
+					  "%1$u people were kicked by %2$s",
+					  n_members),
+				n_members, actor_name);
+		} else {
+			g_string_append_printf (s,
+				ngettext ("%u person was kicked",
+					  "%u people were kicked",
+					  n_members),
+				n_members);
+		}
+		break;
+	case TP_CHANNEL_GROUP_CHANGE_REASON_BANNED:
+		if (actor_name != NULL) {
+			/* translators: reverse the order of these arguments
+			 * if the banned should come before the banner in your locale.
+			 */
+			g_string_append_printf (s,
+				ngettext ("%1$u person was banned by %2$s",
+					  "%1$u people were banned by %2$s",
+					  n_members),
+				n_members, actor_name);
+		} else {
+			g_string_append_printf (s,
+				ngettext ("%u person was banned",
+					  "%u people were banned",
+					  n_members),
+				n_members);
+		}
+		break;
+	default:
+		g_string_append_printf (s,
+			ngettext ("%u person has left the room",
+				  "%u people have left the room",
+				  n_members),
+			n_members);
+	}
+
+	if (!EMP_STR_EMPTY (message)) {
+		g_string_append_printf (s, _(" (%s)"), message);
+	}
+
+	return g_string_free (s, FALSE);
+}
+
+/* Emitted right before members-changed for each of @contacts: summarize
+ * big changes, a netsplit for example, in a single line */
+static void
+chat_members_changed_batch_cb (EmpathyTpChat  *tp_chat,
+			       GPtrArray      *contacts,
+			       EmpathyContact *actor,
+			       guint           reason,
+			       gchar          *message,
+			       gboolean        is_member,
+			       EmpathyChat    *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	gchar *str;
+
+	if (contacts->len < MEMBERS_CHANGED_SUMMARY_MIN)
+		return;
+
+	if (priv->block_events_timeout_id != 0)
+		return;
+
+	priv->members_batch_left = contacts->len;
+
+	if (is_member) {
+		str = g_strdup_printf (
+			ngettext ("%u person has joined the room",
+				  "%u people have joined the room",
+				  contacts->len),
+			contacts->len);
+	} else {
+		str = build_part_summary (reason, contacts->len, actor,
+					  message);
+	}
+
+	empathy_chat_view_append_event (chat->view, str);
+	g_free (str);
+}
+
 static void
 chat_member_renamed_cb (EmpathyTpChat  *tp_chat,
 			 EmpathyContact *old_contact,
@@ -2680,6 +3198,9 @@ chat_member_renamed_cb (EmpathyTpChat  *tp_chat,
 
 	g_return_if_fail (TP_CHANNEL_GROUP_CHANGE_REASON_RENAMED == reason);
 
+	chat_completion_remove (chat, old_contact);
+	chat_completion_add (chat, new_contact);
+
 	if (priv->block_events_timeout_id == 0) {
 		gchar *str;
 
@@ -2840,6 +3361,7 @@ chat_invalidated_cb (EmpathyTpChat *tp_chat,
 	}
 
 	chat_composing_remove_timeout (chat);
+	chat_completion_clear (chat);
 	g_object_unref (priv->tp_chat);
 	priv->tp_chat = NULL;
 	g_object_notify (G_OBJECT (chat), "tp-chat");
@@ -3034,6 +3556,11 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+	if (EMPATHY_IS_THEME_ADIUM (chat->view)) {
+		g_signal_connect (chat->view, "history-requested",
+				  G_CALLBACK (chat_history_requested_cb),
+				  chat);
+	}
 	gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
 			   GTK_WIDGET (chat->view));
 	gtk_widget_show (GTK_WIDGET (chat->view));
@@ -3126,6 +3653,8 @@ chat_finalize (GObject *object)
 	g_object_unref (priv->gsettings_chat);
 	g_object_unref (priv->gsettings_ui);
 
+	tp_clear_pointer (&priv->backlog_pending, g_hash_table_unref);
+
 	g_list_foreach (priv->input_history, (GFunc) chat_input_history_entry_free, NULL);
 	g_list_free (priv->input_history);
 
@@ -3150,6 +3679,10 @@ chat_finalize (GObject *object)
 			chat_state_changed_cb, chat);
 		g_signal_handlers_disconnect_by_func (priv->tp_chat,
 			chat_members_changed_cb, chat);
+		g_signal_handlers_disconnect_by_func (priv->tp_chat,
+			chat_members_changed_batch_cb, chat);
+		g_signal_handlers_disconnect_by_func (priv->tp_chat,
+			chat_member_renamed_cb, chat);
 		g_signal_handlers_disconnect_by_func (priv->tp_chat,
 			chat_remote_contact_changed_cb, chat);
 		g_signal_handlers_disconnect_by_func (priv->tp_chat,
@@ -3173,7 +3706,9 @@ chat_finalize (GObject *object)
 	g_free (priv->id);
 	g_free (priv->name);
 	g_free (priv->subject);
-	g_completion_free (priv->completion);
+	chat_completion_clear (chat);
+	g_ptr_array_unref (priv->completion_entries);
+	g_hash_table_unref (priv->completion_by_contact);
 
 	G_OBJECT_CLASS (empathy_chat_parent_class)->finalize (object);
 }
@@ -3387,8 +3922,8 @@ empathy_chat_init (EmpathyChat *chat)
 		g_timeout_add_seconds (1, chat_block_events_timeout_cb, chat);
 
 	/* Add nick name completion */
-	priv->completion = g_completion_new ((GCompletionFunc) empathy_contact_get_alias);
-	g_completion_set_compare (priv->completion, chat_contacts_completion_func);
+	priv->completion_entries = g_ptr_array_new ();
+	priv->completion_by_contact = g_hash_table_new (NULL, NULL);
 
 	chat_create_ui (chat);
 }
@@ -3868,6 +4403,9 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	g_signal_connect (tp_chat, "members-changed",
 			  G_CALLBACK (chat_members_changed_cb),
 			  chat);
+	g_signal_connect (tp_chat, "members-changed-batch",
+			  G_CALLBACK (chat_members_changed_batch_cb),
+			  chat);
 	g_signal_connect (tp_chat, "member-renamed",
 			  G_CALLBACK (chat_member_renamed_cb),
 			  chat);
@@ -3890,6 +4428,8 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 				  G_CALLBACK (chat_subject_changed_cb),
 				  chat);
 
+	chat_completion_populate (chat);
+
 	/* Get initial value of properties */
 	chat_sms_channel_changed_cb (chat);
 	chat_remote_contact_changed_cb (chat);
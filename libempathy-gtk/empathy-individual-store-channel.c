@@ -71,8 +71,13 @@ add_members (EmpathyIndividualStoreChannel *self,
     GPtrArray *members)
 {
   EmpathyIndividualStore *store = (EmpathyIndividualStore *) self;
+  gboolean batch;
   guint i;
 
+  batch = members->len >= EMPATHY_INDIVIDUAL_STORE_MIN_BATCH;
+  if (batch)
+    empathy_individual_store_begin_batch (store);
+
   for (i = 0; i < members->len; i++)
     {
       TpContact *contact = g_ptr_array_index (members, i);
@@ -92,6 +97,9 @@ add_members (EmpathyIndividualStoreChannel *self,
       g_hash_table_insert (self->priv->individuals, g_object_ref (contact),
           individual);
     }
+
+  if (batch)
+    empathy_individual_store_end_batch (store);
 }
 
 static void
@@ -73,6 +73,11 @@ individual_store_manager_members_changed_cb (EmpathyIndividualManager *manager,
 {
   GList *l;
   EmpathyIndividualStore *store = EMPATHY_INDIVIDUAL_STORE (self);
+  gboolean batch;
+
+  batch = g_list_length (added) >= EMPATHY_INDIVIDUAL_STORE_MIN_BATCH;
+  if (batch)
+    empathy_individual_store_begin_batch (store);
 
   for (l = removed; l; l = l->next)
     {
@@ -88,6 +93,9 @@ individual_store_manager_members_changed_cb (EmpathyIndividualManager *manager,
 
       individual_store_add_individual_and_connect (store, l->data);
     }
+
+  if (batch)
+    empathy_individual_store_end_batch (store);
 }
 
 static void
@@ -102,10 +110,8 @@ individual_store_manager_groups_changed_cb (EmpathyIndividualManager *manager,
   DEBUG ("Updating groups for individual %s",
       folks_individual_get_id (individual));
 
-  /* We do this to make sure the groups are correct, if not, we
-   * would have to check the groups already set up for each
-   * contact and then see what has been updated.
-   */
+  /* Compares the groups already set up for the individual with its
+   * current ones and only updates what changed */
   empathy_individual_store_refresh_individual (store, individual);
 }
 
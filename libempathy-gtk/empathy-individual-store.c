@@ -66,21 +66,75 @@ struct _EmpathyIndividualStorePriv
   guint inhibit_active;
   gboolean dispose_has_run;
   GHashTable *status_icons;
-  /* List of owned GCancellables for each pending avatar load operation */
-  GList *avatar_cancellables;
-  /* Hash: FolksIndividual* -> GQueue (GtkTreeIter *) */
+  /* Hash: FolksIndividual* -> IndividualAvatar* */
+  GHashTable                  *avatars;
+  /* Hash: FolksIndividual* ->
+   *   Hash: IndividualStoreGroup* (NULL for the top level) -> GtkTreeIter*
+   * GtkTreeStore iters stay valid as long as their row exists */
   GHashTable                  *folks_individual_cache;
-  /* Hash: char *groupname -> GtkTreeIter * */
+  /* Hash: char *groupname -> IndividualStoreGroup* */
   GHashTable                  *empathy_group_cache;
+  /* Hash: FolksIndividual* -> IndividualSortKey*, shared by all the rows of
+   * the individual through EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY */
+  GHashTable                  *sort_keys;
   gboolean show_active;
+  /* Nesting depth of empathy_individual_store_begin_batch(); rows are not
+   * sorted while it is not 0 */
+  guint batch_depth;
+  /* Owned ShowActiveData, ordered by expiry, sharing one timeout */
+  GQueue active_queue;
+  /* Hash: FolksIndividual* -> GList link in active_queue */
+  GHashTable *active_individuals;
+  guint active_timeout;
+  /* Set of owned FolksIndividual* whose rows have to be updated, applied
+   * together once per main loop iteration */
+  GHashTable *dirty_individuals;
+  guint flush_updates_id;
 };
 
+typedef struct
+{
+  gchar *name;
+  GtkTreeIter iter;
+  /* Number of individuals shown in the group, it's removed when it drops
+   * to 0 */
+  guint n_individuals;
+} IndividualStoreGroup;
+
+/* Everything the sort functions need to order two individuals, computed when
+ * the individual is added or updated so comparing is allocation free */
+typedef struct
+{
+  gchar *alias;
+  /* g_utf8_collate_key () of alias and of the individual's id */
+  gchar *alias_key;
+  gchar *id_key;
+  /* From the individual's EmpathyContact, if any */
+  gboolean has_contact;
+  gchar *protocol;
+  gchar *account_path;
+  TpConnectionPresenceType presence;
+} IndividualSortKey;
+
+/* The avatar shown in the rows of an individual, so it is only loaded again
+ * when it actually changes rather than on every presence update */
+typedef struct
+{
+  /* Identity of the avatar, NULL if the individual has none */
+  GLoadableIcon *icon;
+  /* NULL while loading */
+  GdkPixbuf *pixbuf;
+  /* Owned, pending load of icon; NULL if there is none */
+  GCancellable *cancellable;
+} IndividualAvatar;
+
 typedef struct
 {
   EmpathyIndividualStore *self;
-  FolksIndividual *individual;
+  FolksIndividual *individual; /* weak */
   gboolean remove;
-  guint timeout;
+  /* g_get_monotonic_time () at which the highlight ends */
+  gint64 expires;
 } ShowActiveData;
 
 enum
@@ -90,7 +144,8 @@ enum
   PROP_SHOW_PROTOCOLS,
   PROP_SHOW_GROUPS,
   PROP_IS_COMPACT,
-  PROP_SORT_CRITERIUM
+  PROP_SORT_CRITERIUM,
+  PROP_IN_BATCH
 };
 
 /* prototypes to break cycles */
@@ -142,6 +197,71 @@ while_finish:
   return types;
 }
 
+static void
+individual_sort_key_free (IndividualSortKey *key)
+{
+  g_free (key->alias);
+  g_free (key->alias_key);
+  g_free (key->id_key);
+  g_free (key->protocol);
+  g_free (key->account_path);
+  g_slice_free (IndividualSortKey, key);
+}
+
+static IndividualSortKey *
+individual_store_update_sort_key (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  IndividualSortKey *key;
+  const gchar *alias;
+  EmpathyContact *contact;
+
+  key = g_hash_table_lookup (self->priv->sort_keys, individual);
+  if (key == NULL)
+    {
+      key = g_slice_new0 (IndividualSortKey);
+      key->id_key = g_utf8_collate_key (folks_individual_get_id (individual),
+          -1);
+      g_hash_table_insert (self->priv->sort_keys, individual, key);
+    }
+
+  alias = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
+  if (alias == NULL)
+    alias = "";
+
+  if (key->alias == NULL || tp_strdiff (key->alias, alias))
+    {
+      g_free (key->alias);
+      g_free (key->alias_key);
+      key->alias = g_strdup (alias);
+      key->alias_key = g_utf8_collate_key (alias, -1);
+    }
+
+  g_free (key->protocol);
+  g_free (key->account_path);
+  key->protocol = NULL;
+  key->account_path = NULL;
+
+  contact = empathy_contact_dup_from_folks_individual (individual);
+  key->has_contact = (contact != NULL);
+  if (contact != NULL)
+    {
+      TpAccount *account = empathy_contact_get_account (contact);
+
+      g_assert (account != NULL);
+
+      key->protocol = g_strdup (tp_account_get_protocol (account));
+      key->account_path = g_strdup (tp_proxy_get_object_path (account));
+      g_object_unref (contact);
+    }
+
+  key->presence = empathy_folks_presence_type_to_tp (
+      folks_presence_details_get_presence_type (
+          FOLKS_PRESENCE_DETAILS (individual)));
+
+  return key;
+}
+
 static void
 add_individual_to_store (GtkTreeStore *store,
     GtkTreeIter *iter,
@@ -151,7 +271,6 @@ add_individual_to_store (GtkTreeStore *store,
   EmpathyIndividualStore *self = EMPATHY_INDIVIDUAL_STORE (store);
   gboolean can_audio_call, can_video_call;
   const gchar * const *types;
-  GQueue *queue;
 
   empathy_individual_can_audio_video_call (individual, &can_audio_call,
       &can_video_call, NULL);
@@ -162,202 +281,108 @@ add_individual_to_store (GtkTreeStore *store,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME,
       folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
       EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, individual,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY,
+      individual_store_update_sort_key (self, individual),
       EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, FALSE,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, FALSE,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_AUDIO_CALL, can_audio_call,
       EMPATHY_INDIVIDUAL_STORE_COL_CAN_VIDEO_CALL, can_video_call,
       EMPATHY_INDIVIDUAL_STORE_COL_CLIENT_TYPES, types,
       -1);
-
-  queue = g_hash_table_lookup (self->priv->folks_individual_cache, individual);
-  if (queue)
-    {
-      g_queue_push_tail (queue, gtk_tree_iter_copy (iter));
-    }
-  else
-    {
-      queue = g_queue_new ();
-      g_queue_push_tail (queue, gtk_tree_iter_copy (iter));
-      g_hash_table_insert (self->priv->folks_individual_cache, individual,
-          queue);
-    }
 }
 
 static void
+individual_store_group_free (IndividualStoreGroup *group)
+{
+  g_free (group->name);
+  g_slice_free (IndividualStoreGroup, group);
+}
+
+static IndividualStoreGroup *
 individual_store_get_group (EmpathyIndividualStore *self,
     const gchar *name,
-    GtkTreeIter *iter_group_to_set,
-    GtkTreeIter *iter_separator_to_set,
-    gboolean *created,
     gboolean is_fake_group)
 {
-  GtkTreeModel *model;
-  GtkTreeIter iter_group;
-  GtkTreeIter iter_separator;
-  GtkTreeIter *iter;
+  IndividualStoreGroup *group;
 
-  model = GTK_TREE_MODEL (self);
-  iter = g_hash_table_lookup (self->priv->empathy_group_cache, name);
+  group = g_hash_table_lookup (self->priv->empathy_group_cache, name);
+  if (group != NULL)
+    return group;
 
-  if (iter == NULL)
-    {
-      if (created)
-        *created = TRUE;
-
-      gtk_tree_store_insert_with_values (GTK_TREE_STORE (self), &iter_group,
-          NULL, 0,
-          EMPATHY_INDIVIDUAL_STORE_COL_ICON_STATUS, NULL,
-          EMPATHY_INDIVIDUAL_STORE_COL_NAME, name,
-          EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, TRUE,
-          EMPATHY_INDIVIDUAL_STORE_COL_IS_ACTIVE, FALSE,
-          EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, FALSE,
-          EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, is_fake_group,
-          -1);
-
-      g_hash_table_insert (self->priv->empathy_group_cache, g_strdup (name),
-          gtk_tree_iter_copy (&iter_group));
-
-      if (iter_group_to_set)
-        *iter_group_to_set = iter_group;
-
-      gtk_tree_store_insert_with_values (GTK_TREE_STORE (self), &iter_separator,
-          &iter_group, 0,
-          EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, TRUE,
-          -1);
+  group = g_slice_new0 (IndividualStoreGroup);
+  group->name = g_strdup (name);
 
-      if (iter_separator_to_set)
-        *iter_separator_to_set = iter_separator;
-    }
-  else
-    {
-      if (created)
-        *created = FALSE;
-
-      if (iter_group_to_set)
-        *iter_group_to_set = *iter;
-
-      iter_separator = *iter;
-
-      if (gtk_tree_model_iter_next (model, &iter_separator))
-        {
-          gboolean is_separator;
-
-          gtk_tree_model_get (model, &iter_separator,
-              EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator, -1);
-
-          if (is_separator && iter_separator_to_set)
-            *iter_separator_to_set = iter_separator;
-        }
-    }
-}
-
-static GList *
-individual_store_find_contact (EmpathyIndividualStore *self,
-    FolksIndividual *individual)
-{
-  GQueue *row_refs_queue;
-  GList *i;
-  GList *iters_list = NULL;
-
-  row_refs_queue = g_hash_table_lookup (self->priv->folks_individual_cache,
-      individual);
-  if (!row_refs_queue)
-    return NULL;
-
-  for (i = g_queue_peek_head_link (row_refs_queue) ; i != NULL ; i = i->next)
-    {
-      GtkTreeIter *iter = i->data;
+  gtk_tree_store_insert_with_values (GTK_TREE_STORE (self), &group->iter,
+      NULL, 0,
+      EMPATHY_INDIVIDUAL_STORE_COL_ICON_STATUS, NULL,
+      EMPATHY_INDIVIDUAL_STORE_COL_NAME, name,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_GROUP, TRUE,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_ACTIVE, FALSE,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, FALSE,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, is_fake_group,
+      -1);
 
-      iters_list = g_list_prepend (iters_list, gtk_tree_iter_copy (iter));
-    }
+  gtk_tree_store_insert_with_values (GTK_TREE_STORE (self), NULL,
+      &group->iter, 0,
+      EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, TRUE,
+      -1);
 
-  return iters_list;
-}
+  g_hash_table_insert (self->priv->empathy_group_cache, group->name, group);
 
-static void
-free_iters (GList *iters)
-{
-  g_list_foreach (iters, (GFunc) gtk_tree_iter_free, NULL);
-  g_list_free (iters);
+  return group;
 }
 
-void
-empathy_individual_store_remove_individual (EmpathyIndividualStore *self,
+/* Returns the rows of @individual, a borrowed
+ * Hash: IndividualStoreGroup* (NULL for the top level) -> GtkTreeIter*,
+ * or NULL if it has none */
+static GHashTable *
+individual_store_lookup_rows (EmpathyIndividualStore *self,
     FolksIndividual *individual)
 {
-  GtkTreeModel *model;
-  GQueue *row_refs;
-  GList *l;
-
-  row_refs = g_hash_table_lookup (self->priv->folks_individual_cache,
-      individual);
-  if (!row_refs)
-    return;
-
-  /* Clean up model */
-  model = GTK_TREE_MODEL (self);
-
-  for (l = g_queue_peek_head_link (row_refs); l; l = l->next)
-    {
-      GtkTreeIter *iter = l->data;
-      GtkTreeIter parent;
-
-      /* NOTE: it is only <= 2 here because we have
-       * separators after the group name, otherwise it
-       * should be 1.
-       */
-      if (gtk_tree_model_iter_parent (model, &parent, iter) &&
-          gtk_tree_model_iter_n_children (model, &parent) <= 2)
-        {
-          gchar *group_name;
-          gtk_tree_model_get (model, &parent,
-              EMPATHY_INDIVIDUAL_STORE_COL_NAME, &group_name,
-              -1);
-          g_hash_table_remove (self->priv->empathy_group_cache,
-              group_name);
-          gtk_tree_store_remove (GTK_TREE_STORE (self), &parent);
-        }
-      else
-        {
-          gtk_tree_store_remove (GTK_TREE_STORE (self), iter);
-        }
-    }
-
-  g_hash_table_remove (self->priv->folks_individual_cache, individual);
+  return g_hash_table_lookup (self->priv->folks_individual_cache, individual);
 }
 
-void
-empathy_individual_store_add_individual (EmpathyIndividualStore *self,
-    FolksIndividual *individual)
+/* Returns the set of groups @individual should be shown in, as
+ * Hash: gchar *group name -> is fake group. *at_top_level is set if it should
+ * be shown outside of any group. */
+static GHashTable *
+individual_store_dup_wanted_groups (EmpathyIndividualStore *self,
+    FolksIndividual *individual,
+    gboolean *at_top_level)
 {
-  GtkTreeIter iter;
+  GHashTable *wanted;
   GeeIterator *group_iter = NULL;
 
+  wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  *at_top_level = FALSE;
+
   if (EMP_STR_EMPTY (folks_alias_details_get_alias (
           FOLKS_ALIAS_DETAILS (individual))))
-    return;
+    return wanted;
 
-  if (self->priv->show_groups)
+  if (!self->priv->show_groups)
     {
-      GeeSet *group_set = NULL;
+      *at_top_level = TRUE;
+      return wanted;
+    }
 
-      group_set = folks_group_details_get_groups (
-          FOLKS_GROUP_DETAILS (individual));
+  group_iter = gee_iterable_iterator (GEE_ITERABLE (
+      folks_group_details_get_groups (FOLKS_GROUP_DETAILS (individual))));
 
-      if (gee_collection_get_size (GEE_COLLECTION (group_set)) > 0)
-        group_iter = gee_iterable_iterator (GEE_ITERABLE (group_set));
+  while (gee_iterator_next (group_iter))
+    {
+      g_hash_table_insert (wanted, gee_iterator_get (group_iter),
+          GINT_TO_POINTER (FALSE));
     }
+  g_clear_object (&group_iter);
 
   /* fall-back groups, in case there are no named groups */
-  if (group_iter == NULL)
+  if (g_hash_table_size (wanted) == 0)
     {
-      GtkTreeIter iter_group, *parent;
       EmpathyContact *contact;
       TpConnection *connection;
       gchar *protocol_name = NULL;
 
-      parent = &iter_group;
-
       contact = empathy_contact_dup_from_folks_individual (individual);
       if (contact != NULL)
         {
@@ -365,59 +390,171 @@ empathy_individual_store_add_individual (EmpathyIndividualStore *self,
           tp_connection_parse_object_path (connection, &protocol_name, NULL);
         }
 
-      if (!self->priv->show_groups)
-        parent = NULL;
-      else if (!tp_strdiff (protocol_name, "local-xmpp"))
+      if (!tp_strdiff (protocol_name, "local-xmpp"))
         {
           /* these are People Nearby */
-          individual_store_get_group (self,
-              EMPATHY_INDIVIDUAL_STORE_PEOPLE_NEARBY, &iter_group, NULL, NULL,
-              TRUE);
+          g_hash_table_insert (wanted,
+              g_strdup (EMPATHY_INDIVIDUAL_STORE_PEOPLE_NEARBY),
+              GINT_TO_POINTER (TRUE));
         }
       else
         {
-          individual_store_get_group (self,
-              EMPATHY_INDIVIDUAL_STORE_UNGROUPED,
-              &iter_group, NULL, NULL, TRUE);
+          g_hash_table_insert (wanted,
+              g_strdup (EMPATHY_INDIVIDUAL_STORE_UNGROUPED),
+              GINT_TO_POINTER (TRUE));
         }
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, parent,
-          individual);
-
       g_free (protocol_name);
       g_clear_object (&contact);
     }
 
-  /* Else add to each group. */
-  while (group_iter != NULL && gee_iterator_next (group_iter))
+  if (folks_favourite_details_get_is_favourite (
+          FOLKS_FAVOURITE_DETAILS (individual)))
     {
-      gchar *group_name = gee_iterator_get (group_iter);
-      GtkTreeIter iter_group;
+      /* Add contact to the fake 'Favorites' group */
+      g_hash_table_insert (wanted, g_strdup (EMPATHY_INDIVIDUAL_STORE_FAVORITE),
+          GINT_TO_POINTER (TRUE));
+    }
 
-      individual_store_get_group (self, group_name, &iter_group, NULL, NULL,
-          FALSE);
+  return wanted;
+}
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, &iter_group,
-          individual);
+/* Drops everything known about @individual, once it has no rows */
+static void
+individual_store_forget_individual (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  g_hash_table_remove (self->priv->folks_individual_cache, individual);
+  g_hash_table_remove (self->priv->sort_keys, individual);
+  g_hash_table_remove (self->priv->avatars, individual);
+  g_hash_table_remove (self->priv->dirty_individuals, individual);
+}
 
-      g_free (group_name);
+/* Adds and removes rows of @individual so it's shown in the groups it
+ * belongs to, leaving the rows in the other groups untouched. Returns %FALSE
+ * if it's no longer in the store. */
+static gboolean
+individual_store_sync_rows (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  GHashTable *rows;
+  GHashTable *wanted;
+  GHashTableIter iter;
+  gpointer key, value;
+  gboolean at_top_level;
+
+  wanted = individual_store_dup_wanted_groups (self, individual,
+      &at_top_level);
+
+  rows = individual_store_lookup_rows (self, individual);
+  if (rows == NULL)
+    {
+      rows = g_hash_table_new_full (NULL, NULL, NULL,
+          (GDestroyNotify) gtk_tree_iter_free);
+      g_hash_table_insert (self->priv->folks_individual_cache, individual,
+          rows);
     }
-  g_clear_object (&group_iter);
 
-  if (self->priv->show_groups &&
-      folks_favourite_details_get_is_favourite (
-          FOLKS_FAVOURITE_DETAILS (individual)))
+  /* Rows in groups it left */
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      /* Add contact to the fake 'Favorites' group */
-      GtkTreeIter iter_group;
+      IndividualStoreGroup *group = key;
+
+      if (group == NULL ? at_top_level :
+          g_hash_table_lookup_extended (wanted, group->name, NULL, NULL))
+        continue;
+
+      if (group != NULL && --group->n_individuals == 0)
+        {
+          /* Takes the row and the separator with it */
+          gtk_tree_store_remove (GTK_TREE_STORE (self), &group->iter);
+          g_hash_table_remove (self->priv->empathy_group_cache, group->name);
+        }
+      else
+        {
+          gtk_tree_store_remove (GTK_TREE_STORE (self), value);
+        }
+
+      g_hash_table_iter_remove (&iter);
+    }
+
+  /* Rows in groups it joined */
+  if (at_top_level &&
+      !g_hash_table_lookup_extended (rows, NULL, NULL, NULL))
+    {
+      GtkTreeIter row;
+
+      add_individual_to_store (GTK_TREE_STORE (self), &row, NULL, individual);
+      g_hash_table_insert (rows, NULL, gtk_tree_iter_copy (&row));
+    }
 
-      individual_store_get_group (self, EMPATHY_INDIVIDUAL_STORE_FAVORITE,
-          &iter_group, NULL, NULL, TRUE);
+  g_hash_table_iter_init (&iter, wanted);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      IndividualStoreGroup *group;
+      GtkTreeIter row;
 
-      add_individual_to_store (GTK_TREE_STORE (self), &iter, &iter_group,
+      group = individual_store_get_group (self, key, GPOINTER_TO_INT (value));
+      if (g_hash_table_lookup_extended (rows, group, NULL, NULL))
+        continue;
+
+      add_individual_to_store (GTK_TREE_STORE (self), &row, &group->iter,
           individual);
+      g_hash_table_insert (rows, group, gtk_tree_iter_copy (&row));
+      group->n_individuals++;
+    }
+
+  g_hash_table_unref (wanted);
+
+  if (g_hash_table_size (rows) > 0)
+    return TRUE;
+
+  individual_store_forget_individual (self, individual);
+
+  return FALSE;
+}
+
+void
+empathy_individual_store_remove_individual (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  GHashTable *rows;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  rows = individual_store_lookup_rows (self, individual);
+  if (rows == NULL)
+    return;
+
+  /* Clean up model */
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      IndividualStoreGroup *group = key;
+
+      if (group != NULL && --group->n_individuals == 0)
+        {
+          gtk_tree_store_remove (GTK_TREE_STORE (self), &group->iter);
+          g_hash_table_remove (self->priv->empathy_group_cache, group->name);
+        }
+      else
+        {
+          gtk_tree_store_remove (GTK_TREE_STORE (self), value);
+        }
     }
 
+  individual_store_forget_individual (self, individual);
+}
+
+void
+empathy_individual_store_add_individual (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  /* Also moves it between groups if it is already in the store */
+  if (!individual_store_sync_rows (self, individual))
+    return;
+
   individual_store_contact_update (self, individual);
 }
 
@@ -428,16 +565,22 @@ individual_store_contact_set_active (EmpathyIndividualStore *self,
     gboolean set_changed)
 {
   GtkTreeModel *model;
-  GList *iters, *l;
+  GHashTable *rows;
+  GHashTableIter iter;
+  gpointer row;
 
   model = GTK_TREE_MODEL (self);
 
-  iters = individual_store_find_contact (self, individual);
-  for (l = iters; l; l = l->next)
+  rows = individual_store_lookup_rows (self, individual);
+  if (rows == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, NULL, &row))
     {
       GtkTreePath *path;
 
-      gtk_tree_store_set (GTK_TREE_STORE (self), l->data,
+      gtk_tree_store_set (GTK_TREE_STORE (self), row,
           EMPATHY_INDIVIDUAL_STORE_COL_IS_ACTIVE, active,
           -1);
 
@@ -445,36 +588,67 @@ individual_store_contact_set_active (EmpathyIndividualStore *self,
 
       if (set_changed)
         {
-          path = gtk_tree_model_get_path (model, l->data);
-          gtk_tree_model_row_changed (model, path, l->data);
+          path = gtk_tree_model_get_path (model, row);
+          gtk_tree_model_row_changed (model, path, row);
           gtk_tree_path_free (path);
         }
     }
-
-  free_iters (iters);
 }
 
 static void individual_store_contact_active_free (ShowActiveData *data);
 
+static ShowActiveData *
+individual_store_contact_active_lookup (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  GList *link;
+
+  link = g_hash_table_lookup (self->priv->active_individuals, individual);
+
+  return link != NULL ? link->data : NULL;
+}
+static gboolean individual_store_contact_active_cb (
+    EmpathyIndividualStore *self);
+
+static void
+individual_store_contact_active_schedule (EmpathyIndividualStore *self)
+{
+  ShowActiveData *data;
+  gint64 delay;
+
+  data = g_queue_peek_head (&self->priv->active_queue);
+  if (data == NULL || self->priv->active_timeout != 0)
+    return;
+
+  delay = (data->expires - g_get_monotonic_time ()) / 1000;
+  self->priv->active_timeout = g_timeout_add (MAX (delay, 0) + 1,
+      (GSourceFunc) individual_store_contact_active_cb, self);
+}
+
+static void
+individual_store_contact_active_unqueue (ShowActiveData *data)
+{
+  EmpathyIndividualStorePriv *priv = data->self->priv;
+  GList *link;
+
+  link = g_hash_table_lookup (priv->active_individuals, data->individual);
+  g_hash_table_remove (priv->active_individuals, data->individual);
+  g_queue_delete_link (&priv->active_queue, link);
+}
+
 static void
 individual_store_contact_active_invalidated (ShowActiveData *data,
     GObject *old_object)
 {
-  /* Remove the timeout and free the struct, since the individual or individual
-   * store has disappeared. */
-  g_source_remove (data->timeout);
-
-  if (old_object == (GObject *) data->self)
-    data->self = NULL;
-  else if (old_object == (GObject *) data->individual)
-    data->individual = NULL;
-  else
-    g_assert_not_reached ();
+  /* Drop the highlight, since the individual has disappeared. The timeout is
+   * shared, it just finds one less individual to process. */
+  individual_store_contact_active_unqueue (data);
 
+  data->individual = NULL;
   individual_store_contact_active_free (data);
 }
 
-static ShowActiveData *
+static void
 individual_store_contact_active_new (EmpathyIndividualStore *self,
     FolksIndividual *individual,
     gboolean remove_)
@@ -485,33 +659,40 @@ individual_store_contact_active_new (EmpathyIndividualStore *self,
       folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
       remove_ ? "WILL" : "WILL NOT");
 
+  /* A new highlight replaces the pending one, so someone going online then
+   * offline quickly is only made inactive once the last one expires. */
+  data = individual_store_contact_active_lookup (self, individual);
+  if (data != NULL)
+    {
+      individual_store_contact_active_unqueue (data);
+      individual_store_contact_active_free (data);
+    }
+
   data = g_slice_new0 (ShowActiveData);
 
-  /* We don't actually want to force either the IndividualStore or the
-   * Individual to stay alive, since the user could quit Empathy or disable
-   * the account before the contact_active timeout is fired. */
-  g_object_weak_ref (G_OBJECT (self),
-      (GWeakNotify) individual_store_contact_active_invalidated, data);
+  /* We don't actually want to force the Individual to stay alive, since the
+   * user could disable the account before the contact_active timeout is
+   * fired. The store cancels its own highlights when disposed. */
   g_object_weak_ref (G_OBJECT (individual),
       (GWeakNotify) individual_store_contact_active_invalidated, data);
 
   data->self = self;
   data->individual = individual;
   data->remove = remove_;
-  data->timeout = 0;
+  data->expires = g_get_monotonic_time () +
+      ACTIVE_USER_SHOW_TIME * G_USEC_PER_SEC;
+
+  /* All highlights last as long, so the queue stays ordered by expiry */
+  g_queue_push_tail (&self->priv->active_queue, data);
+  g_hash_table_insert (self->priv->active_individuals, individual,
+      self->priv->active_queue.tail);
 
-  return data;
+  individual_store_contact_active_schedule (self);
 }
 
 static void
 individual_store_contact_active_free (ShowActiveData *data)
 {
-  if (data->self != NULL)
-    {
-      g_object_weak_unref (G_OBJECT (data->self),
-          (GWeakNotify) individual_store_contact_active_invalidated, data);
-    }
-
   if (data->individual != NULL)
     {
       g_object_weak_unref (G_OBJECT (data->individual),
@@ -522,23 +703,38 @@ individual_store_contact_active_free (ShowActiveData *data)
 }
 
 static gboolean
-individual_store_contact_active_cb (ShowActiveData *data)
+individual_store_contact_active_cb (EmpathyIndividualStore *self)
 {
-  if (data->remove)
+  ShowActiveData *data;
+  gint64 now;
+
+  self->priv->active_timeout = 0;
+  now = g_get_monotonic_time ();
+
+  while ((data = g_queue_peek_head (&self->priv->active_queue)) != NULL &&
+      data->expires <= now)
     {
-      DEBUG ("Individual'%s' active timeout, removing item",
+      individual_store_contact_active_unqueue (data);
+
+      if (data->remove)
+        {
+          DEBUG ("Individual'%s' active timeout, removing item",
+              folks_alias_details_get_alias (
+                FOLKS_ALIAS_DETAILS (data->individual)));
+          empathy_individual_store_remove_individual (self, data->individual);
+        }
+
+      DEBUG ("Individual'%s' no longer active",
           folks_alias_details_get_alias (
             FOLKS_ALIAS_DETAILS (data->individual)));
-      empathy_individual_store_remove_individual (data->self, data->individual);
-    }
 
-  DEBUG ("Individual'%s' no longer active",
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (data->individual)));
+      individual_store_contact_set_active (self, data->individual, FALSE,
+          TRUE);
 
-  individual_store_contact_set_active (data->self,
-      data->individual, FALSE, TRUE);
+      individual_store_contact_active_free (data);
+    }
 
-  individual_store_contact_active_free (data);
+  individual_store_contact_active_schedule (self);
 
   return FALSE;
 }
@@ -548,6 +744,21 @@ typedef struct {
   GCancellable *cancellable; /* owned */
 } LoadAvatarData;
 
+static void
+individual_avatar_free (IndividualAvatar *avatar)
+{
+  /* The load's data is freed in individual_avatar_pixbuf_received_cb() */
+  if (avatar->cancellable != NULL)
+    {
+      g_cancellable_cancel (avatar->cancellable);
+      g_object_unref (avatar->cancellable);
+    }
+
+  tp_clear_object (&avatar->icon);
+  tp_clear_object (&avatar->pixbuf);
+  g_slice_free (IndividualAvatar, avatar);
+}
+
 static void
 individual_avatar_pixbuf_received_cb (FolksIndividual *individual,
     GAsyncResult *result,
@@ -566,28 +777,42 @@ individual_avatar_pixbuf_received_cb (FolksIndividual *individual,
           error->message);
       g_clear_error (&error);
     }
-  else if (data->store != NULL)
+  else if (data->store != NULL && data->store->priv->avatars != NULL)
     {
-      GList *iters, *l;
+      IndividualAvatar *avatar;
+      GHashTable *rows;
+      GHashTableIter iter;
+      gpointer row;
 
-      iters = individual_store_find_contact (data->store, individual);
-      for (l = iters; l; l = l->next)
+      avatar = g_hash_table_lookup (data->store->priv->avatars, individual);
+
+      /* Superseded by a load of a newer avatar */
+      if (avatar == NULL || avatar->cancellable != data->cancellable)
+        goto out;
+
+      tp_clear_object (&avatar->cancellable);
+      if (pixbuf != NULL)
+        avatar->pixbuf = g_object_ref (pixbuf);
+
+      rows = individual_store_lookup_rows (data->store, individual);
+      if (rows != NULL)
         {
-          gtk_tree_store_set (GTK_TREE_STORE (data->store), l->data,
-              EMPATHY_INDIVIDUAL_STORE_COL_PIXBUF_AVATAR, pixbuf,
-              -1);
+          g_hash_table_iter_init (&iter, rows);
+          while (g_hash_table_iter_next (&iter, NULL, &row))
+            {
+              gtk_tree_store_set (GTK_TREE_STORE (data->store), row,
+                  EMPATHY_INDIVIDUAL_STORE_COL_PIXBUF_AVATAR, pixbuf,
+                  -1);
+            }
         }
-
-      free_iters (iters);
     }
 
+out:
   /* Free things */
   if (data->store != NULL)
     {
       g_object_remove_weak_pointer (G_OBJECT (data->store),
           (gpointer *) &data->store);
-      data->store->priv->avatar_cancellables = g_list_remove (
-          data->store->priv->avatar_cancellables, data->cancellable);
     }
 
   tp_clear_object (&pixbuf);
@@ -595,13 +820,71 @@ individual_avatar_pixbuf_received_cb (FolksIndividual *individual,
   g_slice_free (LoadAvatarData, data);
 }
 
+/* Returns the avatar to show in the rows of @individual, or NULL if it is not
+ * loaded yet. A load is only started if the avatar changed since the last one
+ * and then replaces any load still pending for @individual. */
+static GdkPixbuf *
+individual_store_update_avatar (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  IndividualAvatar *avatar;
+  GLoadableIcon *icon;
+  LoadAvatarData *load_avatar_data;
+
+  icon = folks_avatar_details_get_avatar (FOLKS_AVATAR_DETAILS (individual));
+
+  avatar = g_hash_table_lookup (self->priv->avatars, individual);
+  if (avatar == NULL)
+    {
+      avatar = g_slice_new0 (IndividualAvatar);
+      g_hash_table_insert (self->priv->avatars, individual, avatar);
+    }
+  else if (avatar->icon == icon ||
+      (avatar->icon != NULL && icon != NULL &&
+          g_icon_equal (G_ICON (avatar->icon), G_ICON (icon))))
+    {
+      /* Unchanged; if it's still loading the rows get it when it's done */
+      return avatar->pixbuf;
+    }
+
+  if (avatar->cancellable != NULL)
+    {
+      g_cancellable_cancel (avatar->cancellable);
+      tp_clear_object (&avatar->cancellable);
+    }
+
+  tp_clear_object (&avatar->icon);
+  tp_clear_object (&avatar->pixbuf);
+
+  if (icon == NULL)
+    return NULL;
+
+  avatar->icon = g_object_ref (icon);
+  avatar->cancellable = g_cancellable_new ();
+
+  /* Load the avatar asynchronously */
+  load_avatar_data = g_slice_new (LoadAvatarData);
+  load_avatar_data->store = self;
+  g_object_add_weak_pointer (G_OBJECT (self),
+      (gpointer *) &load_avatar_data->store);
+  load_avatar_data->cancellable = g_object_ref (avatar->cancellable);
+
+  empathy_pixbuf_avatar_from_individual_scaled_async (individual, 32, 32,
+      load_avatar_data->cancellable,
+      (GAsyncReadyCallback) individual_avatar_pixbuf_received_cb,
+      load_avatar_data);
+
+  return NULL;
+}
+
 static void
 individual_store_contact_update (EmpathyIndividualStore *self,
     FolksIndividual *individual)
 {
-  ShowActiveData *data;
   GtkTreeModel *model;
-  GList *iters, *l;
+  GHashTable *rows;
+  GHashTableIter iter;
+  gpointer row;
   gboolean in_list;
   gboolean was_online = TRUE;
   gboolean now_online = FALSE;
@@ -611,12 +894,13 @@ individual_store_contact_update (EmpathyIndividualStore *self,
   gboolean do_set_refresh = FALSE;
   gboolean show_avatar = FALSE;
   GdkPixbuf *pixbuf_status;
-  LoadAvatarData *load_avatar_data;
+  GdkPixbuf *pixbuf_avatar;
+  IndividualSortKey *sort_key = NULL;
 
   model = GTK_TREE_MODEL (self);
 
-  iters = individual_store_find_contact (self, individual);
-  if (!iters)
+  rows = individual_store_lookup_rows (self, individual);
+  if (!rows)
     {
       in_list = FALSE;
     }
@@ -648,10 +932,11 @@ individual_store_contact_update (EmpathyIndividualStore *self,
       DEBUG ("Individual'%s' in list:YES, should be:YES",
           folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
 
-      /* Get online state before. */
-      if (iters && g_list_length (iters) > 0)
+      /* Get online state before, it's the same in all the rows. */
+      g_hash_table_iter_init (&iter, rows);
+      if (g_hash_table_iter_next (&iter, NULL, &row))
         {
-          gtk_tree_model_get (model, iters->data,
+          gtk_tree_model_get (model, row,
               EMPATHY_INDIVIDUAL_STORE_COL_IS_ONLINE, &was_online, -1);
         }
 
@@ -684,25 +969,18 @@ individual_store_contact_update (EmpathyIndividualStore *self,
       show_avatar = TRUE;
     }
 
-  /* Load the avatar asynchronously */
-  load_avatar_data = g_slice_new (LoadAvatarData);
-  load_avatar_data->store = self;
-  g_object_add_weak_pointer (G_OBJECT (self),
-      (gpointer *) &load_avatar_data->store);
-  load_avatar_data->cancellable = g_cancellable_new ();
-
-  self->priv->avatar_cancellables = g_list_prepend (
-      self->priv->avatar_cancellables, load_avatar_data->cancellable);
-
-  empathy_pixbuf_avatar_from_individual_scaled_async (individual, 32, 32,
-      load_avatar_data->cancellable,
-      (GAsyncReadyCallback) individual_avatar_pixbuf_received_cb,
-      load_avatar_data);
+  pixbuf_avatar = individual_store_update_avatar (self, individual);
 
   pixbuf_status =
       empathy_individual_store_get_individual_status_icon (self, individual);
 
-  for (l = iters; l && set_model; l = l->next)
+  if (set_model)
+    sort_key = individual_store_update_sort_key (self, individual);
+
+  if (set_model)
+    g_hash_table_iter_init (&iter, rows);
+
+  while (set_model && g_hash_table_iter_next (&iter, NULL, &row))
     {
       gboolean can_audio_call, can_video_call;
       const gchar * const *types;
@@ -712,8 +990,9 @@ individual_store_contact_update (EmpathyIndividualStore *self,
 
       types = individual_get_client_types (individual);
 
-      gtk_tree_store_set (GTK_TREE_STORE (self), l->data,
+      gtk_tree_store_set (GTK_TREE_STORE (self), row,
           EMPATHY_INDIVIDUAL_STORE_COL_ICON_STATUS, pixbuf_status,
+          EMPATHY_INDIVIDUAL_STORE_COL_PIXBUF_AVATAR, pixbuf_avatar,
           EMPATHY_INDIVIDUAL_STORE_COL_PIXBUF_AVATAR_VISIBLE, show_avatar,
           EMPATHY_INDIVIDUAL_STORE_COL_NAME,
             folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
@@ -730,6 +1009,7 @@ individual_store_contact_update (EmpathyIndividualStore *self,
           EMPATHY_INDIVIDUAL_STORE_COL_CAN_AUDIO_CALL, can_audio_call,
           EMPATHY_INDIVIDUAL_STORE_COL_CAN_VIDEO_CALL, can_video_call,
           EMPATHY_INDIVIDUAL_STORE_COL_CLIENT_TYPES, types,
+          EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, sort_key,
           -1);
     }
 
@@ -739,21 +1019,62 @@ individual_store_contact_update (EmpathyIndividualStore *self,
           do_set_refresh);
 
       if (do_set_active)
-        {
-          data =
-              individual_store_contact_active_new (self, individual,
-              do_remove);
-          data->timeout = g_timeout_add_seconds (ACTIVE_USER_SHOW_TIME,
-              (GSourceFunc) individual_store_contact_active_cb, data);
-        }
+        individual_store_contact_active_new (self, individual, do_remove);
     }
+}
 
-  /* FIXME: when someone goes online then offline quickly, the
-   * first timeout sets the user to be inactive and the second
-   * timeout removes the user from the contact list, really we
-   * should remove the first timeout.
-   */
-  free_iters (iters);
+static gboolean
+individual_store_flush_updates_cb (EmpathyIndividualStore *self)
+{
+  GHashTable *dirty;
+  GHashTableIter iter;
+  gpointer individual;
+  gboolean batch;
+
+  self->priv->flush_updates_id = 0;
+
+  /* Updates queued while flushing are applied on the next pass */
+  dirty = self->priv->dirty_individuals;
+  self->priv->dirty_individuals = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+
+  DEBUG ("Applying updates of %u individuals", g_hash_table_size (dirty));
+
+  /* Sort once for the whole reconnection storm */
+  batch = g_hash_table_size (dirty) >= EMPATHY_INDIVIDUAL_STORE_MIN_BATCH;
+  if (batch)
+    empathy_individual_store_begin_batch (self);
+
+  g_hash_table_iter_init (&iter, dirty);
+  while (g_hash_table_iter_next (&iter, &individual, NULL))
+    individual_store_contact_update (self, individual);
+
+  if (batch)
+    empathy_individual_store_end_batch (self);
+
+  g_hash_table_unref (dirty);
+
+  return FALSE;
+}
+
+static void
+individual_store_queue_update (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  if (g_hash_table_lookup_extended (self->priv->dirty_individuals, individual,
+          NULL, NULL))
+    return;
+
+  g_hash_table_insert (self->priv->dirty_individuals,
+      g_object_ref (individual), NULL);
+
+  /* Before the next redraw, after the other pending notifications */
+  if (self->priv->flush_updates_id == 0)
+    {
+      self->priv->flush_updates_id = g_idle_add_full (
+          G_PRIORITY_HIGH_IDLE + 10,
+          (GSourceFunc) individual_store_flush_updates_cb, self, NULL);
+    }
 }
 
 static void
@@ -764,7 +1085,7 @@ individual_store_individual_updated_cb (FolksIndividual *individual,
   DEBUG ("Individual'%s' updated, checking roster is in sync...",
       folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -781,7 +1102,7 @@ individual_store_contact_updated_cb (EmpathyContact *contact,
   if (individual == NULL)
     return;
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_update (self, individual);
 }
 
 static void
@@ -864,7 +1185,7 @@ individual_store_favourites_changed_cb (FolksIndividual *individual,
       folks_favourite_details_get_is_favourite (
         FOLKS_FAVOURITE_DETAILS (individual)) ? "now" : "no longer");
 
-  empathy_individual_store_remove_individual (self, individual);
+  /* Adds or removes its row in the Favorites group */
   empathy_individual_store_add_individual (self, individual);
 }
 
@@ -927,19 +1248,24 @@ static void
 individual_store_dispose (GObject *object)
 {
   EmpathyIndividualStore *self = EMPATHY_INDIVIDUAL_STORE (object);
-  GList *l;
 
   if (self->priv->dispose_has_run)
     return;
   self->priv->dispose_has_run = TRUE;
 
   /* Cancel any pending avatar load operations */
-  for (l = self->priv->avatar_cancellables; l != NULL; l = l->next)
-    {
-      /* The cancellables are freed in individual_avatar_pixbuf_received_cb() */
-      g_cancellable_cancel (G_CANCELLABLE (l->data));
-    }
-  g_list_free (self->priv->avatar_cancellables);
+  tp_clear_pointer (&self->priv->avatars, g_hash_table_unref);
+
+  if (self->priv->flush_updates_id != 0)
+    g_source_remove (self->priv->flush_updates_id);
+  g_hash_table_unref (self->priv->dirty_individuals);
+
+  if (self->priv->active_timeout != 0)
+    g_source_remove (self->priv->active_timeout);
+  g_queue_foreach (&self->priv->active_queue,
+      (GFunc) individual_store_contact_active_free, NULL);
+  g_queue_clear (&self->priv->active_queue);
+  g_hash_table_unref (self->priv->active_individuals);
 
   if (self->priv->inhibit_active)
     {
@@ -949,6 +1275,7 @@ individual_store_dispose (GObject *object)
   g_hash_table_unref (self->priv->status_icons);
   g_hash_table_unref (self->priv->folks_individual_cache);
   g_hash_table_unref (self->priv->empathy_group_cache);
+  g_hash_table_unref (self->priv->sort_keys);
   G_OBJECT_CLASS (empathy_individual_store_parent_class)->dispose (object);
 }
 
@@ -977,6 +1304,9 @@ individual_store_get_property (GObject *object,
     case PROP_SORT_CRITERIUM:
       g_value_set_enum (value, self->priv->sort_criterium);
       break;
+    case PROP_IN_BATCH:
+      g_value_set_boolean (value, self->priv->batch_depth > 0);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
       break;
@@ -1059,6 +1389,14 @@ empathy_individual_store_class_init (EmpathyIndividualStoreClass *klass)
           EMPATHY_TYPE_INDIVIDUAL_STORE_SORT,
           EMPATHY_INDIVIDUAL_STORE_SORT_NAME, G_PARAM_READWRITE));
 
+  g_object_class_install_property (object_class,
+      PROP_IN_BATCH,
+      g_param_spec_boolean ("in-batch",
+          "In batch",
+          "Whether a batch of changes is being applied, rows are not "
+          "sorted until it is over",
+          FALSE, G_PARAM_READABLE));
+
   g_type_class_add_private (object_class,
       sizeof (EmpathyIndividualStorePriv));
 }
@@ -1083,8 +1421,8 @@ compare_separator_and_groups (gboolean is_separator_a,
     gboolean is_separator_b,
     const gchar *name_a,
     const gchar *name_b,
-    FolksIndividual *individual_a,
-    FolksIndividual *individual_b,
+    gconstpointer individual_a,
+    gconstpointer individual_b,
     gboolean fake_group_a,
     gboolean fake_group_b)
 {
@@ -1162,119 +1500,95 @@ compare_separator_and_groups (gboolean is_separator_a,
 }
 
 static gint
-individual_store_contact_sort (FolksIndividual *individual_a,
-    FolksIndividual *individual_b)
+individual_store_contact_sort (const IndividualSortKey *key_a,
+    const IndividualSortKey *key_b)
 {
   gint ret_val;
-  EmpathyContact *contact_a = NULL, *contact_b = NULL;
-  TpAccount *account_a, *account_b;
-
-  g_return_val_if_fail (individual_a != NULL || individual_b != NULL, 0);
 
   /* alias */
-  ret_val = g_utf8_collate (
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_a)),
-      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual_b)));
-
+  ret_val = strcmp (key_a->alias_key, key_b->alias_key);
   if (ret_val != 0)
-    goto out;
+    return ret_val;
 
-  contact_a = empathy_contact_dup_from_folks_individual (individual_a);
-  contact_b = empathy_contact_dup_from_folks_individual (individual_b);
-  if (contact_a != NULL && contact_b != NULL)
+  if (key_a->has_contact && key_b->has_contact)
     {
-      account_a = empathy_contact_get_account (contact_a);
-      account_b = empathy_contact_get_account (contact_b);
-
-      g_assert (account_a != NULL);
-      g_assert (account_b != NULL);
-
       /* protocol */
-      ret_val = g_strcmp0 (tp_account_get_protocol (account_a),
-          tp_account_get_protocol (account_b));
-
+      ret_val = g_strcmp0 (key_a->protocol, key_b->protocol);
       if (ret_val != 0)
-        goto out;
+        return ret_val;
 
       /* account ID */
-      ret_val = g_strcmp0 (tp_proxy_get_object_path (account_a),
-          tp_proxy_get_object_path (account_b));
-
+      ret_val = g_strcmp0 (key_a->account_path, key_b->account_path);
       if (ret_val != 0)
-        goto out;
+        return ret_val;
     }
 
   /* identifier */
-  ret_val = g_utf8_collate (folks_individual_get_id (individual_a),
-      folks_individual_get_id (individual_b));
-
-out:
-  tp_clear_object (&contact_a);
-  tp_clear_object (&contact_b);
-
-  return ret_val;
+  return strcmp (key_a->id_key, key_b->id_key);
 }
 
+/* Groups and separators have no sort key, only fetch their names (which
+ * allocates) when one of the rows is one of them */
 static gint
-individual_store_state_sort_func (GtkTreeModel *model,
+individual_store_compare_non_individuals (GtkTreeModel *model,
     GtkTreeIter *iter_a,
     GtkTreeIter *iter_b,
-    gpointer user_data)
+    const IndividualSortKey *key_a,
+    const IndividualSortKey *key_b)
 {
-  gint ret_val;
-  FolksIndividual *individual_a, *individual_b;
   gchar *name_a, *name_b;
   gboolean is_separator_a, is_separator_b;
   gboolean fake_group_a, fake_group_b;
-  FolksPresenceType folks_presence_type_a, folks_presence_type_b;
-  TpConnectionPresenceType tp_presence_a, tp_presence_b;
+  gint ret_val;
 
   gtk_tree_model_get (model, iter_a,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_a,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_a, -1);
   gtk_tree_model_get (model, iter_b,
       EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
       EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
 
-  if (individual_a == NULL || individual_b == NULL)
-    {
-      ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
-          name_a, name_b, individual_a, individual_b, fake_group_a,
-          fake_group_b);
-      goto free_and_out;
-    }
+  ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
+      name_a, name_b, key_a, key_b, fake_group_a, fake_group_b);
+
+  g_free (name_a);
+  g_free (name_b);
+
+  return ret_val;
+}
+
+static gint
+individual_store_state_sort_func (GtkTreeModel *model,
+    GtkTreeIter *iter_a,
+    GtkTreeIter *iter_b,
+    gpointer user_data)
+{
+  IndividualSortKey *key_a, *key_b;
+  gint ret_val;
+
+  gtk_tree_model_get (model, iter_a,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_a, -1);
+  gtk_tree_model_get (model, iter_b,
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_b, -1);
+
+  if (key_a == NULL || key_b == NULL)
+    return individual_store_compare_non_individuals (model, iter_a, iter_b,
+        key_a, key_b);
 
   /* If we managed to get this far, we can start looking at
    * the presences.
    */
-  folks_presence_type_a =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_a));
-  folks_presence_type_b =
-      folks_presence_details_get_presence_type (
-          FOLKS_PRESENCE_DETAILS (individual_b));
-  tp_presence_a = empathy_folks_presence_type_to_tp (folks_presence_type_a);
-  tp_presence_b = empathy_folks_presence_type_to_tp (folks_presence_type_b);
-
-  ret_val = -tp_connection_presence_type_cmp_availability (tp_presence_a,
-      tp_presence_b);
+  ret_val = -tp_connection_presence_type_cmp_availability (key_a->presence,
+      key_b->presence);
 
   if (ret_val == 0)
     {
       /* Fallback: compare by name et al. */
-      ret_val = individual_store_contact_sort (individual_a, individual_b);
+      ret_val = individual_store_contact_sort (key_a, key_b);
     }
 
-free_and_out:
-  g_free (name_a);
-  g_free (name_b);
-  tp_clear_object (&individual_a);
-  tp_clear_object (&individual_b);
-
   return ret_val;
 }
 
@@ -1284,35 +1598,18 @@ individual_store_name_sort_func (GtkTreeModel *model,
     GtkTreeIter *iter_b,
     gpointer user_data)
 {
-  gchar *name_a, *name_b;
-  FolksIndividual *individual_a, *individual_b;
-  gboolean is_separator_a = FALSE, is_separator_b = FALSE;
-  gint ret_val;
-  gboolean fake_group_a, fake_group_b;
+  IndividualSortKey *key_a, *key_b;
 
   gtk_tree_model_get (model, iter_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_a,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_a, -1);
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_a, -1);
   gtk_tree_model_get (model, iter_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_NAME, &name_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_INDIVIDUAL, &individual_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_SEPARATOR, &is_separator_b,
-      EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP, &fake_group_b, -1);
+      EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY, &key_b, -1);
 
-  if (individual_a == NULL || individual_b == NULL)
-    ret_val = compare_separator_and_groups (is_separator_a, is_separator_b,
-        name_a, name_b, individual_a, individual_b, fake_group_a, fake_group_b);
-  else
-    ret_val = individual_store_contact_sort (individual_a, individual_b);
+  if (key_a == NULL || key_b == NULL)
+    return individual_store_compare_non_individuals (model, iter_a, iter_b,
+        key_a, key_b);
 
-  tp_clear_object (&individual_a);
-  tp_clear_object (&individual_b);
-  g_free (name_a);
-  g_free (name_b);
-
-  return ret_val;
+  return individual_store_contact_sort (key_a, key_b);
 }
 
 static void
@@ -1336,6 +1633,7 @@ individual_store_setup (EmpathyIndividualStore *self)
     G_TYPE_BOOLEAN,             /* Is a fake group */
     G_TYPE_STRV,                /* Client types */
     G_TYPE_UINT,                /* Event count */
+    G_TYPE_POINTER,             /* Sort key */
   };
 
   gtk_tree_store_set_column_types (GTK_TREE_STORE (self),
@@ -1364,14 +1662,6 @@ individual_store_inhibit_active_cb (EmpathyIndividualStore *self)
   return FALSE;
 }
 
-static void
-g_queue_free_full_iter (gpointer data)
-{
-  GQueue *queue = (GQueue *) data;
-  g_queue_foreach (queue, (GFunc) gtk_tree_iter_free, NULL);
-  g_queue_free (queue);
-}
-
 static void
 empathy_individual_store_init (EmpathyIndividualStore *self)
 {
@@ -1387,9 +1677,17 @@ empathy_individual_store_init (EmpathyIndividualStore *self)
   self->priv->status_icons =
       g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
   self->priv->folks_individual_cache = g_hash_table_new_full (NULL, NULL, NULL,
-      g_queue_free_full_iter);
+      (GDestroyNotify) g_hash_table_unref);
   self->priv->empathy_group_cache = g_hash_table_new_full (g_str_hash,
-      g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+      g_str_equal, NULL, (GDestroyNotify) individual_store_group_free);
+  self->priv->sort_keys = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) individual_sort_key_free);
+  self->priv->avatars = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) individual_avatar_free);
+  g_queue_init (&self->priv->active_queue);
+  self->priv->active_individuals = g_hash_table_new (NULL, NULL);
+  self->priv->dirty_individuals = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
   individual_store_setup (self);
 }
 
@@ -1521,6 +1819,8 @@ empathy_individual_store_set_show_groups (EmpathyIndividualStore *self,
       /* Also clear the cache */
       g_hash_table_remove_all (self->priv->folks_individual_cache);
       g_hash_table_remove_all (self->priv->empathy_group_cache);
+      g_hash_table_remove_all (self->priv->sort_keys);
+      g_hash_table_remove_all (self->priv->avatars);
 
       klass->reload_individuals (self);
     }
@@ -1563,15 +1863,10 @@ empathy_individual_store_get_sort_criterium (EmpathyIndividualStore *self)
   return self->priv->sort_criterium;
 }
 
-void
-empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
-    EmpathyIndividualStoreSort sort_criterium)
+static void
+individual_store_apply_sort_criterium (EmpathyIndividualStore *self)
 {
-  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
-
-  self->priv->sort_criterium = sort_criterium;
-
-  switch (sort_criterium)
+  switch (self->priv->sort_criterium)
     {
     case EMPATHY_INDIVIDUAL_STORE_SORT_STATE:
       gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
@@ -1586,10 +1881,59 @@ empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
     default:
       g_assert_not_reached ();
     }
+}
+
+void
+empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
+    EmpathyIndividualStoreSort sort_criterium)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+
+  self->priv->sort_criterium = sort_criterium;
+
+  /* Applied once the batch is over */
+  if (self->priv->batch_depth == 0)
+    individual_store_apply_sort_criterium (self);
 
   g_object_notify (G_OBJECT (self), "sort-criterium");
 }
 
+/**
+ * empathy_individual_store_begin_batch:
+ * @self: an #EmpathyIndividualStore
+ *
+ * Suspends sorting until the matching empathy_individual_store_end_batch(),
+ * so adding many individuals inserts each row in constant time and the
+ * store is sorted only once at the end. Batches can be nested.
+ */
+void
+empathy_individual_store_begin_batch (EmpathyIndividualStore *self)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+
+  if (self->priv->batch_depth++ > 0)
+    return;
+
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+      GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+
+  g_object_notify (G_OBJECT (self), "in-batch");
+}
+
+void
+empathy_individual_store_end_batch (EmpathyIndividualStore *self)
+{
+  g_return_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self));
+  g_return_if_fail (self->priv->batch_depth > 0);
+
+  if (--self->priv->batch_depth > 0)
+    return;
+
+  individual_store_apply_sort_criterium (self);
+
+  g_object_notify (G_OBJECT (self), "in-batch");
+}
+
 gboolean
 empathy_individual_store_row_separator_func (GtkTreeModel *model,
     GtkTreeIter *iter,
@@ -1767,9 +2111,39 @@ empathy_individual_store_refresh_individual (EmpathyIndividualStore *self,
 {
   gboolean show_active;
 
+  /* Only the rows of the groups it joined or left are added or removed */
   show_active = self->priv->show_active;
   self->priv->show_active = FALSE;
-  empathy_individual_store_remove_individual (self, individual);
   empathy_individual_store_add_individual (self, individual);
   self->priv->show_active = show_active;
 }
+
+/* Emits row-changed on all the rows of @individual, so filters built on top
+ * of the store re-evaluate them. Returns %FALSE if @individual is not in the
+ * store. */
+gboolean
+empathy_individual_store_emit_individual_changed (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  GHashTable *rows;
+  GHashTableIter iter;
+  gpointer row;
+
+  g_return_val_if_fail (EMPATHY_IS_INDIVIDUAL_STORE (self), FALSE);
+
+  rows = individual_store_lookup_rows (self, individual);
+  if (rows == NULL)
+    return FALSE;
+
+  g_hash_table_iter_init (&iter, rows);
+  while (g_hash_table_iter_next (&iter, NULL, &row))
+    {
+      GtkTreePath *path;
+
+      path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), row);
+      gtk_tree_model_row_changed (GTK_TREE_MODEL (self), path, row);
+      gtk_tree_path_free (path);
+    }
+
+  return TRUE;
+}
@@ -66,6 +66,7 @@ typedef enum
   EMPATHY_INDIVIDUAL_STORE_COL_IS_FAKE_GROUP,
   EMPATHY_INDIVIDUAL_STORE_COL_CLIENT_TYPES,
   EMPATHY_INDIVIDUAL_STORE_COL_EVENT_COUNT,
+  EMPATHY_INDIVIDUAL_STORE_COL_SORT_KEY,
   EMPATHY_INDIVIDUAL_STORE_COL_COUNT,
 } EmpathyIndividualStoreCol;
 
@@ -122,6 +123,14 @@ void empathy_individual_store_set_sort_criterium (
     EmpathyIndividualStore *store,
     EmpathyIndividualStoreSort sort_criterium);
 
+/* Below this many additions, inserting each row at its sorted position is
+ * cheaper than sorting the whole store once */
+#define EMPATHY_INDIVIDUAL_STORE_MIN_BATCH 16
+
+void empathy_individual_store_begin_batch (EmpathyIndividualStore *self);
+
+void empathy_individual_store_end_batch (EmpathyIndividualStore *self);
+
 gboolean empathy_individual_store_row_separator_func (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer data);
@@ -157,5 +166,9 @@ void empathy_individual_store_add_individual (EmpathyIndividualStore *self,
 void empathy_individual_store_refresh_individual (EmpathyIndividualStore *self,
     FolksIndividual *individual);
 
+gboolean empathy_individual_store_emit_individual_changed (
+    EmpathyIndividualStore *self,
+    FolksIndividual *individual);
+
 G_END_DECLS
 #endif /* __EMPATHY_INDIVIDUAL_STORE_H__ */
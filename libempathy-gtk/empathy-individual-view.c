@@ -77,8 +77,23 @@ typedef struct
   gboolean show_uninteresting;
 
   GtkTreeModelFilter *filter;
+  /* TRUE while the store is filled in a batch with the filter detached from
+   * the view */
+  gboolean detached;
   GtkWidget *search_widget;
 
+  /* Search text the filter currently reflects, NULL when not searching */
+  gchar *search_text;
+  /* owned FolksIndividual -> bool (whether it matches search_text) */
+  GHashTable *search_matches;
+  /* owned string (path of a group row in the store) -> itself, groups whose
+   * visibility is verified once the search matches are retested, NULL the
+   * rest of the time */
+  GHashTable *retest_groups;
+  /* weak FolksIndividual -> IndividualFacts, see
+   * individual_view_get_individual_facts() */
+  GHashTable *individual_facts;
+
   guint expand_groups_idle_handler;
   /* owned string (group name) -> bool (whether to expand/contract) */
   GHashTable *expand_groups;
@@ -100,6 +115,19 @@ typedef struct
   guint timeout_id;
 } DragMotionData;
 
+/* What the filter needs to know about an individual besides the columns of
+ * the store */
+typedef enum
+{
+  INDIVIDUAL_FACTS_VALID = 1 << 0,
+  INDIVIDUAL_FACTS_UNTRUSTED = 1 << 1,
+  INDIVIDUAL_FACTS_INTERESTING = 1 << 2,
+  INDIVIDUAL_FACTS_FAVOURITE = 1 << 3,
+  /* One of the personas is the user's, so INTERESTING also depends on
+   * whether it is in the contact list and is not cached */
+  INDIVIDUAL_FACTS_USER = 1 << 4
+} IndividualFacts;
+
 typedef struct
 {
   EmpathyIndividualView *view;
@@ -1330,6 +1358,103 @@ individual_view_start_search_cb (EmpathyIndividualView *view,
   return TRUE;
 }
 
+/* Re-evaluate the individuals whose last search match was @matched */
+static void
+individual_view_retest_search_matches (EmpathyIndividualView *view,
+    gboolean matched)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  GHashTableIter iter;
+  gpointer individual, value, key;
+  GList *retest = NULL, *l;
+  GHashTable *groups;
+
+  /* The filter func updates search_matches, so collect them first */
+  g_hash_table_iter_init (&iter, priv->search_matches);
+  while (g_hash_table_iter_next (&iter, &individual, &value))
+    {
+      if (GPOINTER_TO_INT (value) == matched)
+        retest = g_list_prepend (retest, g_object_ref (individual));
+    }
+
+  /* Verifying the group of each changed row as it goes would refilter
+   * every group once per child */
+  priv->retest_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+
+  for (l = retest; l != NULL; l = l->next)
+    {
+      if (!empathy_individual_store_emit_individual_changed (priv->store,
+              l->data))
+        g_hash_table_remove (priv->search_matches, l->data);
+    }
+
+  g_list_free_full (retest, g_object_unref);
+
+  groups = priv->retest_groups;
+  priv->retest_groups = NULL;
+
+  g_hash_table_iter_init (&iter, groups);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      GtkTreePath *path;
+      GtkTreeIter group_iter;
+
+      path = gtk_tree_path_new_from_string (key);
+      if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->store), &group_iter,
+              path))
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (priv->store), path,
+            &group_iter);
+      gtk_tree_path_free (path);
+    }
+
+  g_hash_table_unref (groups);
+}
+
+static void
+individual_view_search_refilter (EmpathyIndividualView *view)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  const gchar *text = NULL;
+  gchar *old_text;
+
+  if (priv->search_widget != NULL &&
+      gtk_widget_get_visible (priv->search_widget))
+    text = empathy_live_search_get_text (
+        EMPATHY_LIVE_SEARCH (priv->search_widget));
+
+  old_text = priv->search_text;
+  priv->search_text = g_strdup (text);
+
+  /* Matching is by word prefixes, so extending the query can only hide
+   * rows which currently match and shortening it can only show rows which
+   * currently don't. Anything else needs a full refilter. */
+  if (priv->custom_filter == NULL && priv->store != NULL &&
+      old_text != NULL && text != NULL)
+    {
+      if (!tp_strdiff (old_text, text))
+        goto out;
+
+      if (g_str_has_prefix (text, old_text))
+        {
+          individual_view_retest_search_matches (view, TRUE);
+          goto out;
+        }
+
+      if (g_str_has_prefix (old_text, text))
+        {
+          individual_view_retest_search_matches (view, FALSE);
+          goto out;
+        }
+    }
+
+  g_hash_table_remove_all (priv->search_matches);
+  gtk_tree_model_filter_refilter (priv->filter);
+
+out:
+  g_free (old_text);
+}
+
 static void
 individual_view_search_text_notify_cb (EmpathyLiveSearch *search,
     GParamSpec *pspec,
@@ -1342,7 +1467,7 @@ individual_view_search_text_notify_cb (EmpathyLiveSearch *search,
   GtkTreeIter iter;
   gboolean set_cursor = FALSE;
 
-  gtk_tree_model_filter_refilter (priv->filter);
+  individual_view_search_refilter (view);
 
   /* Set cursor on the first contact. If it is already set on a group,
    * set it on its first child contact. Note that first child of a group
@@ -1645,6 +1770,10 @@ individual_view_verify_group_visibility (EmpathyIndividualView *view,
   GtkTreePath *parent_path;
   GtkTreeIter parent_iter;
 
+  /* Everything is refiltered once the batch is over */
+  if (priv->detached)
+    return;
+
   if (gtk_tree_path_get_depth (path) < 2)
     return;
 
@@ -1656,7 +1785,15 @@ individual_view_verify_group_visibility (EmpathyIndividualView *view,
   model = GTK_TREE_MODEL (priv->store);
   parent_path = gtk_tree_path_copy (path);
   gtk_tree_path_up (parent_path);
-  if (gtk_tree_model_get_iter (model, &parent_iter, parent_path))
+
+  /* individual_view_retest_search_matches() verifies it at the end */
+  if (priv->retest_groups != NULL)
+    {
+      gchar *str = gtk_tree_path_to_string (parent_path);
+
+      g_hash_table_insert (priv->retest_groups, str, str);
+    }
+  else if (gtk_tree_model_get_iter (model, &parent_iter, parent_path))
     {
       /* This tells the filter to verify the visibility of that row, and
        * show/hide it if necessary */
@@ -1683,6 +1820,201 @@ individual_view_store_row_deleted_cb (GtkTreeModel *model,
   individual_view_verify_group_visibility (view, path);
 }
 
+static void
+individual_view_store_in_batch_cb (EmpathyIndividualStore *store,
+    GParamSpec *pspec,
+    EmpathyIndividualView *view)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (view);
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gboolean in_batch, valid;
+
+  g_object_get (store, "in-batch", &in_batch, NULL);
+
+  if (in_batch)
+    {
+      /* The store is being (re)populated from scratch, build it without the
+       * view watching and show the result in one go. */
+      if (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (store), NULL) == 0)
+        {
+          priv->detached = TRUE;
+          gtk_tree_view_set_model (GTK_TREE_VIEW (view), NULL);
+        }
+
+      return;
+    }
+
+  if (!priv->detached)
+    return;
+
+  priv->detached = FALSE;
+  gtk_tree_model_filter_refilter (priv->filter);
+
+  model = GTK_TREE_MODEL (priv->filter);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (view), model);
+
+  /* Restore the expanded state of the groups */
+  for (valid = gtk_tree_model_get_iter_first (model, &iter);
+       valid; valid = gtk_tree_model_iter_next (model, &iter))
+    {
+      GtkTreePath *path = gtk_tree_model_get_path (model, &iter);
+
+      individual_view_row_has_child_toggled_cb (model, path, &iter, view);
+      gtk_tree_path_free (path);
+    }
+}
+
+static void individual_view_individual_facts_notify_cb (
+    EmpathyIndividualView *self,
+    GParamSpec *pspec,
+    FolksIndividual *individual);
+static void individual_view_individual_facts_personas_cb (
+    EmpathyIndividualView *self,
+    GeeSet *added,
+    GeeSet *removed,
+    FolksIndividual *individual);
+
+static void
+individual_view_individual_finalized_cb (EmpathyIndividualView *self,
+    GObject *individual)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+
+  g_hash_table_remove (priv->individual_facts, individual);
+}
+
+static void
+individual_view_forget_individual_facts (EmpathyIndividualView *self)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  GHashTableIter iter;
+  gpointer individual;
+
+  g_hash_table_iter_init (&iter, priv->individual_facts);
+  while (g_hash_table_iter_next (&iter, &individual, NULL))
+    {
+      g_signal_handlers_disconnect_by_func (individual,
+          individual_view_individual_facts_notify_cb, self);
+      g_signal_handlers_disconnect_by_func (individual,
+          individual_view_individual_facts_personas_cb, self);
+      g_object_weak_unref (individual,
+          (GWeakNotify) individual_view_individual_finalized_cb, self);
+    }
+
+  g_hash_table_remove_all (priv->individual_facts);
+}
+
+static void
+individual_view_invalidate_individual_facts (EmpathyIndividualView *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+
+  g_hash_table_insert (priv->individual_facts, individual,
+      GUINT_TO_POINTER (0));
+
+  /* The store may have updated the rows before we got notified */
+  if (priv->store != NULL)
+    empathy_individual_store_emit_individual_changed (priv->store, individual);
+}
+
+static void
+individual_view_individual_facts_notify_cb (EmpathyIndividualView *self,
+    GParamSpec *pspec,
+    FolksIndividual *individual)
+{
+  individual_view_invalidate_individual_facts (self, individual);
+}
+
+static void
+individual_view_individual_facts_personas_cb (EmpathyIndividualView *self,
+    GeeSet *added,
+    GeeSet *removed,
+    FolksIndividual *individual)
+{
+  individual_view_invalidate_individual_facts (self, individual);
+}
+
+/* Returns the INTERESTING and USER IndividualFacts of @individual */
+static IndividualFacts
+individual_view_get_persona_facts (FolksIndividual *individual)
+{
+  IndividualFacts facts = 0;
+  GeeSet *personas;
+  GeeIterator *iter;
+
+  personas = folks_individual_get_personas (individual);
+  iter = gee_iterable_iterator (GEE_ITERABLE (personas));
+  while (gee_iterator_next (iter))
+    {
+      FolksPersona *persona = gee_iterator_get (iter);
+
+      if (empathy_folks_persona_is_interesting (persona))
+        facts |= INDIVIDUAL_FACTS_INTERESTING;
+
+      if (TPF_IS_PERSONA (persona) && folks_persona_get_is_user (persona))
+        facts |= INDIVIDUAL_FACTS_USER;
+
+      g_clear_object (&persona);
+    }
+  g_clear_object (&iter);
+
+  return facts;
+}
+
+/* Returns the IndividualFacts of @individual, only looking at its personas
+ * again once they changed */
+static IndividualFacts
+individual_view_get_individual_facts (EmpathyIndividualView *self,
+    FolksIndividual *individual)
+{
+  EmpathyIndividualViewPriv *priv = GET_PRIV (self);
+  gpointer value;
+  IndividualFacts facts = INDIVIDUAL_FACTS_VALID;
+
+  if (g_hash_table_lookup_extended (priv->individual_facts, individual,
+          NULL, &value))
+    {
+      facts = GPOINTER_TO_UINT (value);
+      if ((facts & INDIVIDUAL_FACTS_USER) != 0)
+        {
+          facts &= ~(INDIVIDUAL_FACTS_INTERESTING | INDIVIDUAL_FACTS_USER);
+          facts |= individual_view_get_persona_facts (individual);
+        }
+
+      if ((facts & INDIVIDUAL_FACTS_VALID) != 0)
+        return facts;
+
+      facts = INDIVIDUAL_FACTS_VALID;
+    }
+  else
+    {
+      g_signal_connect_swapped (individual, "notify::trust-level",
+          G_CALLBACK (individual_view_individual_facts_notify_cb), self);
+      g_signal_connect_swapped (individual, "notify::is-favourite",
+          G_CALLBACK (individual_view_individual_facts_notify_cb), self);
+      g_signal_connect_swapped (individual, "personas-changed",
+          G_CALLBACK (individual_view_individual_facts_personas_cb), self);
+      g_object_weak_ref (G_OBJECT (individual),
+          (GWeakNotify) individual_view_individual_finalized_cb, self);
+    }
+
+  if (folks_individual_get_trust_level (individual) == FOLKS_TRUST_LEVEL_NONE)
+    facts |= INDIVIDUAL_FACTS_UNTRUSTED;
+
+  if (folks_favourite_details_get_is_favourite (
+          FOLKS_FAVOURITE_DETAILS (individual)))
+    facts |= INDIVIDUAL_FACTS_FAVOURITE;
+
+  facts |= individual_view_get_persona_facts (individual);
+
+  g_hash_table_insert (priv->individual_facts, individual,
+      GUINT_TO_POINTER (facts));
+
+  return facts;
+}
+
 static gboolean
 individual_view_is_visible_individual (EmpathyIndividualView *self,
     FolksIndividual *individual,
@@ -1694,47 +2026,28 @@ individual_view_is_visible_individual (EmpathyIndividualView *self,
 {
   EmpathyIndividualViewPriv *priv = GET_PRIV (self);
   EmpathyLiveSearch *live = EMPATHY_LIVE_SEARCH (priv->search_widget);
-  GeeSet *personas;
-  GeeIterator *iter;
+  IndividualFacts facts;
   gboolean is_favorite;
+  gboolean match;
 
   /* Always display individuals having pending events */
   if (event_count > 0)
     return TRUE;
 
+  facts = individual_view_get_individual_facts (self, individual);
+
   /* We're only giving the visibility wrt filtering here, not things like
    * presence. */
-  if (!priv->show_untrusted &&
-      folks_individual_get_trust_level (individual) == FOLKS_TRUST_LEVEL_NONE)
-    {
-      return FALSE;
-    }
-
-  if (!priv->show_uninteresting)
-    {
-      gboolean contains_interesting_persona = FALSE;
-
-      /* Hide all individuals which consist entirely of uninteresting
-       * personas */
-      personas = folks_individual_get_personas (individual);
-      iter = gee_iterable_iterator (GEE_ITERABLE (personas));
-      while (!contains_interesting_persona && gee_iterator_next (iter))
-        {
-          FolksPersona *persona = gee_iterator_get (iter);
-
-          if (empathy_folks_persona_is_interesting (persona))
-            contains_interesting_persona = TRUE;
-
-          g_clear_object (&persona);
-        }
-      g_clear_object (&iter);
+  if (!priv->show_untrusted && (facts & INDIVIDUAL_FACTS_UNTRUSTED) != 0)
+    return FALSE;
 
-      if (!contains_interesting_persona)
-        return FALSE;
-    }
+  /* Hide all individuals which consist entirely of uninteresting
+   * personas */
+  if (!priv->show_uninteresting &&
+      (facts & INDIVIDUAL_FACTS_INTERESTING) == 0)
+    return FALSE;
 
-  is_favorite = folks_favourite_details_get_is_favourite (
-      FOLKS_FAVOURITE_DETAILS (individual));
+  is_favorite = (facts & INDIVIDUAL_FACTS_FAVOURITE) != 0;
   if (!is_searching) {
     if (is_favorite && is_fake_group &&
         !tp_strdiff (group, EMPATHY_INDIVIDUAL_STORE_FAVORITE))
@@ -1744,9 +2057,15 @@ individual_view_is_visible_individual (EmpathyIndividualView *self,
     return (priv->show_offline || is_online);
   }
 
-  return empathy_individual_match_string (individual,
+  match = empathy_individual_match_string (individual,
       empathy_live_search_get_text (live),
       empathy_live_search_get_words (live));
+
+  /* Remember the result, see individual_view_search_refilter() */
+  g_hash_table_insert (priv->search_matches, g_object_ref (individual),
+      GINT_TO_POINTER (match));
+
+  return match;
 }
 
 static gchar *
@@ -2031,6 +2350,8 @@ individual_view_dispose (GObject *object)
   EmpathyIndividualView *view = EMPATHY_INDIVIDUAL_VIEW (object);
   EmpathyIndividualViewPriv *priv = GET_PRIV (view);
 
+  individual_view_forget_individual_facts (view);
+
   tp_clear_object (&priv->store);
   tp_clear_object (&priv->filter);
   tp_clear_object (&priv->tooltip_widget);
@@ -2048,6 +2369,9 @@ individual_view_finalize (GObject *object)
   if (priv->expand_groups_idle_handler != 0)
     g_source_remove (priv->expand_groups_idle_handler);
   g_hash_table_unref (priv->expand_groups);
+  g_hash_table_unref (priv->search_matches);
+  g_hash_table_unref (priv->individual_facts);
+  g_free (priv->search_text);
 
   G_OBJECT_CLASS (empathy_individual_view_parent_class)->finalize (object);
 }
@@ -2232,6 +2556,9 @@ empathy_individual_view_init (EmpathyIndividualView *view)
 
   priv->expand_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       (GDestroyNotify) g_free, NULL);
+  priv->search_matches = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
+  priv->individual_facts = g_hash_table_new (NULL, NULL);
 
   gtk_tree_view_set_row_separator_func (GTK_TREE_VIEW (view),
       empathy_individual_store_row_separator_func, NULL, NULL);
@@ -2822,6 +3149,8 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
           individual_view_store_row_changed_cb, self);
       g_signal_handlers_disconnect_by_func (priv->store,
           individual_view_store_row_deleted_cb, self);
+      g_signal_handlers_disconnect_by_func (priv->store,
+          individual_view_store_in_batch_cb, self);
 
       g_signal_handlers_disconnect_by_func (priv->filter,
           individual_view_row_has_child_toggled_cb, self);
@@ -2831,6 +3160,7 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
 
   tp_clear_object (&priv->filter);
   tp_clear_object (&priv->store);
+  priv->detached = FALSE;
 
   /* Set the new store */
   priv->store = store;
@@ -2856,6 +3186,8 @@ empathy_individual_view_set_store (EmpathyIndividualView *self,
           G_CALLBACK (individual_view_store_row_changed_cb), self, 0);
       tp_g_signal_connect_object (priv->store, "row-deleted",
           G_CALLBACK (individual_view_store_row_deleted_cb), self, 0);
+      tp_g_signal_connect_object (priv->store, "notify::in-batch",
+          G_CALLBACK (individual_view_store_in_batch_cb), self, 0);
     }
 }
 
@@ -238,6 +238,36 @@ empathy_live_search_match_words (const gchar *string,
   return TRUE;
 }
 
+/* Same as empathy_live_search_match_words() but @tokens is the result of
+ * empathy_live_search_strip_utf8_string() on the string, so callers matching
+ * the same string many times only pay for stripping it once. */
+gboolean
+empathy_live_search_match_stripped_words (GPtrArray *tokens,
+    GPtrArray *words)
+{
+  guint i, j;
+
+  if (words == NULL)
+    return TRUE;
+
+  if (tokens == NULL)
+    return FALSE;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+      gboolean found = FALSE;
+
+      for (j = 0; j < tokens->len && !found; j++)
+        found = g_str_has_prefix (g_ptr_array_index (tokens, j), word);
+
+      if (!found)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 fire_key_navigation_sig (EmpathyLiveSearch *self,
     GdkEventKey *event)
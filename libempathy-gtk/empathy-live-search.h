@@ -68,6 +68,9 @@ GPtrArray * empathy_live_search_strip_utf8_string (const gchar *string);
 gboolean empathy_live_search_match_words (const gchar *string,
     GPtrArray *words);
 
+gboolean empathy_live_search_match_stripped_words (GPtrArray *tokens,
+    GPtrArray *words);
+
 GPtrArray * empathy_live_search_get_words (EmpathyLiveSearch *self);
 
 /* Made public for unit tests */
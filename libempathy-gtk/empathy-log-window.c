@@ -48,6 +48,7 @@
 #include <libempathy/empathy-chatroom-manager.h>
 #include <libempathy/empathy-chatroom.h>
 #include <libempathy/empathy-gsettings.h>
+#include <libempathy/empathy-log-index.h>
 #include <libempathy/empathy-message.h>
 #include <libempathy/empathy-request-util.h>
 #include <libempathy/empathy-utils.h>
@@ -90,6 +91,18 @@ struct _EmpathyLogWindowPriv
   GtkWidget *webview;
 
   GtkTreeStore *store_events;
+  /* Top-level rows of store_events grouping chat events, see
+   * get_parent_iter_for_message().
+   * Hash: gchar *conversation_key -> GQueue of owned LogConversation,
+   * most recently extended first */
+  GHashTable *conversations;
+
+  /* Calls mirroring the changes of store_events into webview, run together
+   * once per main loop iteration by flush_script_id */
+  GString *pending_script;
+  guint flush_script_id;
+  /* Hash: gchar *icon name -> gchar *icon URI, "" if there is none */
+  GHashTable *icon_uris;
 
   GtkWidget *account_chooser;
 
@@ -100,6 +113,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -115,7 +129,31 @@ struct _EmpathyLogWindowPriv
   /* Used to cancel logger calls when no longer needed */
   guint count;
 
-  /* List of owned TplLogSearchHits, free with tpl_log_search_hit_free */
+  /* Owned Ctx of the dates selected but not loaded yet, newest first. They
+   * are loaded DATES_PER_PAGE at a time as the user scrolls up. */
+  GQueue pending_dates;
+  /* Owned Ctx of the dates whose events are in store_events, newest first.
+   * Beyond MAX_LOADED_PAGES pages, the ones at the end furthest from the
+   * viewport are removed and queued again, see log_window_evict_page(). */
+  GQueue loaded_dates;
+  /* Owned Ctx of the dates removed below the viewport, oldest first. They
+   * are loaded again as the user scrolls down. */
+  GQueue newer_dates;
+  gboolean loading_page;
+  /* Whether the page being loaded is older than the events shown */
+  gboolean loading_older;
+  /* Number of events added by the page being loaded */
+  guint page_events;
+  /* Whether to scroll to the newest event, until some have been shown */
+  gboolean scroll_to_end;
+  /* Older pages are inserted above the rows being read; while keep_position
+   * is set, the view follows them by staying from_bottom pixels away from
+   * the end of the document, until the user scrolls again. */
+  gboolean keep_position;
+  gdouble from_bottom;
+
+  /* List of owned EmpathyLogIndexHits, free with
+   * empathy_log_index_hits_free */
   GList *hits;
   guint source;
 
@@ -151,6 +189,11 @@ static void log_window_when_changed_cb           (GtkTreeSelection *selection,
 static void log_window_delete_menu_clicked_cb    (GtkMenuItem      *menuitem,
                                                   EmpathyLogWindow *self);
 static void start_spinner                        (void);
+static void log_window_cancel_loads              (EmpathyLogWindow *self);
+static void log_window_events_value_changed_cb   (GtkAdjustment    *adjustment,
+                                                  EmpathyLogWindow *self);
+static void log_window_events_changed_cb         (GtkAdjustment    *adjustment,
+                                                  EmpathyLogWindow *self);
 
 static void log_window_create_observer           (EmpathyLogWindow *window);
 static gboolean log_window_events_button_press_event (GtkWidget *webview,
@@ -225,6 +268,25 @@ enum
 /* Seconds between two messages to be considered one conversation */
 #define MAX_GAP 30*60
 
+/* Number of dates whose events are fetched together */
+#define DATES_PER_PAGE 7
+
+/* Number of pages whose events are shown at once; those more than a screen
+ * away from the viewport are removed beyond that */
+#define MAX_LOADED_PAGES 5
+
+/* Milliseconds to wait for more typing before searching */
+#define SEARCH_INDEX_DELAY 150
+#define SEARCH_LOGS_DELAY 500
+
+typedef struct
+{
+  /* Top-level row in store_events, GtkTreeStore iters persist */
+  GtkTreeIter iter;
+  /* Timestamp of the latest event in the conversation */
+  gint64 last_timestamp;
+} LogConversation;
+
 #define WHAT_TYPE_SEPARATOR -1
 
 typedef enum
@@ -298,6 +360,14 @@ ctx_free (Ctx *ctx)
   g_slice_free (Ctx, ctx);
 }
 
+static gint
+ctx_compare_dates_newest_first (Ctx *a,
+    Ctx *b,
+    gpointer user_data)
+{
+  return g_date_compare (b->date, a->date);
+}
+
 static void
 select_account_once_ready (EmpathyLogWindow *self,
     TpAccount *account,
@@ -359,6 +429,150 @@ toolbutton_av_clicked (GtkToolButton *toolbutton,
       TRUE, video, gtk_get_current_event_time ());
 }
 
+static gboolean
+flush_script_cb (EmpathyLogWindow *self)
+{
+  self->priv->flush_script_id = 0;
+
+  if (self->priv->pending_script->len == 0)
+    return FALSE;
+
+  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
+      self->priv->pending_script->str);
+  g_string_truncate (self->priv->pending_script, 0);
+
+  return FALSE;
+}
+
+/* Returns the script to append a call to, which is run with the others
+ * queued in the same main loop iteration */
+static GString *
+queue_script (EmpathyLogWindow *self)
+{
+  if (self->priv->flush_script_id == 0)
+    {
+      self->priv->flush_script_id = g_idle_add (
+          (GSourceFunc) flush_script_cb, self);
+    }
+
+  return self->priv->pending_script;
+}
+
+/* Runs the queued script now, for the DOM to reflect store_events */
+static void
+log_window_flush_script (EmpathyLogWindow *self)
+{
+  if (self->priv->flush_script_id == 0)
+    return;
+
+  g_source_remove (self->priv->flush_script_id);
+  flush_script_cb (self);
+}
+
+static void
+append_script_path (GString *script,
+    GtkTreePath *path)
+{
+  gint *indices;
+  gint i, depth;
+
+  indices = gtk_tree_path_get_indices_with_depth (path, &depth);
+
+  g_string_append_c (script, '[');
+  for (i = 0; i < depth; i++)
+    g_string_append_printf (script, i == 0 ? "%d" : ",%d", indices[i]);
+  g_string_append_c (script, ']');
+}
+
+/* Appends @str as a JSON string literal */
+static void
+append_script_string (GString *script,
+    const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (script, '"');
+
+  for (p = str; p != NULL && *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+          case '"':
+            g_string_append (script, "\\\"");
+            break;
+          case '\\':
+            g_string_append (script, "\\\\");
+            break;
+          case '\n':
+            g_string_append (script, "\\n");
+            break;
+          case '\r':
+            g_string_append (script, "\\r");
+            break;
+          case '\t':
+            g_string_append (script, "\\t");
+            break;
+          default:
+            if ((guchar) *p < 0x20)
+              {
+                g_string_append_printf (script, "\\u%04x", (guchar) *p);
+              }
+            /* U+2028 and U+2029 end lines in JavaScript */
+            else if (g_str_has_prefix (p, "\xe2\x80\xa8") ||
+                g_str_has_prefix (p, "\xe2\x80\xa9"))
+              {
+                g_string_append_printf (script, "\\u%04x",
+                    g_utf8_get_char (p));
+                p += 2;
+              }
+            else
+              {
+                g_string_append_c (script, *p);
+              }
+        }
+    }
+
+  g_string_append_c (script, '"');
+}
+
+static const gchar *
+get_icon_uri (EmpathyLogWindow *self,
+    const gchar *icon_name)
+{
+  gchar *uri;
+  GtkIconInfo *icon_info;
+
+  if (tp_str_empty (icon_name))
+    return "";
+
+  uri = g_hash_table_lookup (self->priv->icon_uris, icon_name);
+  if (uri != NULL)
+    return uri;
+
+  icon_info = gtk_icon_theme_lookup_icon (gtk_icon_theme_get_default (),
+      icon_name, GTK_ICON_SIZE_MENU, 0);
+
+  if (icon_info != NULL)
+    {
+      uri = g_strdup (gtk_icon_info_get_filename (icon_info));
+      gtk_icon_info_free (icon_info);
+    }
+
+  if (uri == NULL)
+    uri = g_strdup ("");
+
+  g_hash_table_insert (self->priv->icon_uris, g_strdup (icon_name), uri);
+
+  return uri;
+}
+
+static void
+icon_theme_changed_cb (GtkIconTheme *icon_theme,
+    EmpathyLogWindow *self)
+{
+  g_hash_table_remove_all (self->priv->icon_uris);
+}
+
 static void
 insert_or_change_row (EmpathyLogWindow *self,
     const char *method,
@@ -366,9 +580,8 @@ insert_or_change_row (EmpathyLogWindow *self,
     GtkTreePath *path,
     GtkTreeIter *iter)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script, *text, *date, *stock_icon;
-  char *icon = NULL;
+  GString *script = queue_script (self);
+  char *text, *date, *stock_icon;
 
   gtk_tree_model_get (model, iter,
       COL_EVENTS_TEXT, &text,
@@ -376,35 +589,19 @@ insert_or_change_row (EmpathyLogWindow *self,
       COL_EVENTS_ICON, &stock_icon,
       -1);
 
-  if (!tp_str_empty (stock_icon))
-    {
-      GtkIconInfo *icon_info = gtk_icon_theme_lookup_icon (
-          gtk_icon_theme_get_default (),
-          stock_icon,
-          GTK_ICON_SIZE_MENU, 0);
-
-      if (icon_info != NULL)
-        icon = g_strdup (gtk_icon_info_get_filename (icon_info));
-
-      gtk_icon_info_free (icon_info);
-    }
-
-  script = g_strdup_printf ("javascript:%s([%s], '%s', '%s', '%s');",
-      method,
-      g_strdelimit (str, ":", ','),
-      text,
-      icon != NULL ? icon : "",
-      date);
+  g_string_append_printf (script, "%s(", method);
+  append_script_path (script, path);
+  g_string_append_c (script, ',');
+  append_script_string (script, text);
+  g_string_append_c (script, ',');
+  append_script_string (script, get_icon_uri (self, stock_icon));
+  g_string_append_c (script, ',');
+  append_script_string (script, date);
+  g_string_append (script, ");\n");
 
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
   g_free (text);
   g_free (date);
   g_free (stock_icon);
-  g_free (icon);
-  g_free (script);
 }
 
 static void
@@ -430,17 +627,11 @@ store_events_row_deleted (GtkTreeModel *model,
     GtkTreePath *path,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
+  GString *script = queue_script (self);
 
-  script = g_strdup_printf ("javascript:deleteRow([%s]);",
-      g_strdelimit (str, ":", ','));
-
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
-  g_free (script);
+  g_string_append (script, "deleteRow(");
+  append_script_path (script, path);
+  g_string_append (script, ");\n");
 }
 
 static void
@@ -449,18 +640,12 @@ store_events_has_child_rows (GtkTreeModel *model,
     GtkTreeIter *iter,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
-  char *script;
+  GString *script = queue_script (self);
 
-  script = g_strdup_printf ("javascript:hasChildRows([%s], %u);",
-      g_strdelimit (str, ":", ','),
+  g_string_append (script, "hasChildRows(");
+  append_script_path (script, path);
+  g_string_append_printf (script, ", %u);\n",
       gtk_tree_model_iter_has_child (model, iter));
-
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
-  g_free (script);
 }
 
 static void
@@ -470,29 +655,17 @@ store_events_rows_reordered (GtkTreeModel *model,
     int *new_order,
     EmpathyLogWindow *self)
 {
-  char *str = gtk_tree_path_to_string (path);
+  GString *script = queue_script (self);
   int i, children = gtk_tree_model_iter_n_children (model, iter);
-  char **new_order_strv, *new_order_s;
-  char *script;
 
-  new_order_strv = g_new0 (char *, children + 1);
+  g_string_append (script, "reorderRows(");
+  append_script_path (script, path);
+  g_string_append (script, ", [");
 
   for (i = 0; i < children; i++)
-    new_order_strv[i] = g_strdup_printf ("%i", new_order[i]);
-
-  new_order_s = g_strjoinv (",", new_order_strv);
+    g_string_append_printf (script, i == 0 ? "%i" : ",%i", new_order[i]);
 
-  script = g_strdup_printf ("javascript:reorderRows([%s], [%s]);",
-      str == NULL ? "" : g_strdelimit (str, ":", ','),
-      new_order_s);
-
-  webkit_web_view_execute_script (WEBKIT_WEB_VIEW (self->priv->webview),
-      script);
-
-  g_free (str);
-  g_free (script);
-  g_free (new_order_s);
-  g_strfreev (new_order_strv);
+  g_string_append (script, "]);\n");
 }
 
 static gboolean
@@ -551,11 +724,19 @@ empathy_log_window_dispose (GObject *object)
       self->priv->current_dates = NULL;
     }
 
+  g_queue_foreach (&self->priv->pending_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->pending_dates);
+  g_queue_foreach (&self->priv->loaded_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->loaded_dates);
+  g_queue_foreach (&self->priv->newer_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->newer_dates);
   tp_clear_pointer (&self->priv->chain, _tpl_action_chain_free);
   tp_clear_pointer (&self->priv->channels, g_hash_table_unref);
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
+  tp_clear_pointer (&self->priv->hits, empathy_log_index_hits_free);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -564,7 +745,14 @@ empathy_log_window_dispose (GObject *object)
   tp_clear_object (&self->priv->gsettings_chat);
   tp_clear_object (&self->priv->gsettings_desktop);
 
+  if (self->priv->flush_script_id != 0)
+    {
+      g_source_remove (self->priv->flush_script_id);
+      self->priv->flush_script_id = 0;
+    }
+
   tp_clear_object (&self->priv->store_events);
+  tp_clear_pointer (&self->priv->conversations, g_hash_table_unref);
 
   G_OBJECT_CLASS (empathy_log_window_parent_class)->dispose (object);
 }
@@ -576,6 +764,8 @@ empathy_log_window_finalize (GObject *object)
 
   g_free (self->priv->last_find);
   g_free (self->priv->selected_chat_id);
+  g_string_free (self->priv->pending_script, TRUE);
+  g_hash_table_unref (self->priv->icon_uris);
 
   G_OBJECT_CLASS (empathy_log_window_parent_class)->finalize (object);
 }
@@ -603,6 +793,7 @@ empathy_log_window_init (EmpathyLogWindow *self)
   GFile *gfile;
   GtkWidget *vbox, *accounts, *search, *label, *closeitem;
   GtkWidget *scrolledwindow_events;
+  GtkAdjustment *vadjustment;
   gchar *uri;
 
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
@@ -614,6 +805,10 @@ empathy_log_window_init (EmpathyLogWindow *self)
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
 
+  /* Catch up with what was logged since the window was last opened */
+  self->priv->log_index = empathy_log_index_dup_singleton ();
+  empathy_log_index_update (self->priv->log_index);
+
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
       EMPATHY_PREFS_DESKTOP_INTERFACE_SCHEMA);
@@ -738,6 +933,14 @@ empathy_log_window_init (EmpathyLogWindow *self)
       self->priv->webview);
   gtk_widget_show (self->priv->webview);
 
+  /* load older events when scrolling up */
+  vadjustment = gtk_scrolled_window_get_vadjustment (
+      GTK_SCROLLED_WINDOW (scrolledwindow_events));
+  g_signal_connect (vadjustment, "value-changed",
+      G_CALLBACK (log_window_events_value_changed_cb), self);
+  g_signal_connect (vadjustment, "changed",
+      G_CALLBACK (log_window_events_changed_cb), self);
+
   empathy_webkit_bind_font_setting (WEBKIT_WEB_VIEW (self->priv->webview),
       self->priv->gsettings_desktop,
       EMPATHY_PREFS_DESKTOP_INTERFACE_FONT_NAME);
@@ -756,6 +959,12 @@ empathy_log_window_init (EmpathyLogWindow *self)
       G_CALLBACK (events_webview_handle_navigation), self);
 
   /* listen to changes to the treemodel */
+  self->priv->pending_script = g_string_new ("");
+  self->priv->icon_uris = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_free);
+  tp_g_signal_connect_object (gtk_icon_theme_get_default (), "changed",
+      G_CALLBACK (icon_theme_changed_cb), self, 0);
+
   g_signal_connect (self->priv->store_events, "row-inserted",
       G_CALLBACK (store_events_row_inserted), self);
   g_signal_connect (self->priv->store_events, "row-changed",
@@ -925,6 +1134,48 @@ maybe_refresh_logs (TpChannel *channel,
     }
 }
 
+/* Indexes a message the logger is logging, so it can be searched for
+ * straight away */
+static void
+log_window_index_message (EmpathyLogWindow *self,
+    TpChannel *channel,
+    TpAccount *account,
+    TpMessage *message)
+{
+  TpChannelTextMessageType type = tp_message_get_message_type (message);
+  TpHandleType handle_type;
+  TplEntity *target;
+  gint64 timestamp;
+  gchar *text;
+
+  if (account == NULL)
+    return;
+
+  if (type != TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL &&
+      type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
+    return;
+
+  tp_channel_get_handle (channel, &handle_type);
+  if (handle_type == TP_HANDLE_TYPE_ROOM)
+    target = tpl_entity_new_from_room_id (tp_channel_get_identifier (channel));
+  else
+    target = tpl_entity_new (tp_channel_get_identifier (channel),
+        TPL_ENTITY_CONTACT, NULL, NULL);
+
+  timestamp = tp_message_get_sent_timestamp (message);
+  if (timestamp == 0)
+    timestamp = tp_message_get_received_timestamp (message);
+  if (timestamp == 0)
+    timestamp = empathy_time_get_current ();
+
+  text = tp_message_to_text (message, NULL);
+  empathy_log_index_add_text (self->priv->log_index, account, target,
+      timestamp, text);
+
+  g_free (text);
+  g_object_unref (target);
+}
+
 static void
 on_msg_sent (TpTextChannel *channel,
     TpSignalledMessage *message,
@@ -934,6 +1185,9 @@ on_msg_sent (TpTextChannel *channel,
 {
   TpAccount *account = g_hash_table_lookup (self->priv->channels, channel);
 
+  log_window_index_message (self, TP_CHANNEL (channel), account,
+      TP_MESSAGE (message));
+
   maybe_refresh_logs (TP_CHANNEL (channel), account);
 }
 
@@ -950,6 +1204,8 @@ on_msg_received (TpTextChannel *channel,
       type != TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
     return;
 
+  log_window_index_message (self, TP_CHANNEL (channel), account, msg);
+
   maybe_refresh_logs (TP_CHANNEL (channel), account);
 }
 
@@ -1077,53 +1333,60 @@ event_get_target (TplEvent *event)
   return sender;
 }
 
-static gboolean
-model_is_parent (GtkTreeModel *model,
-    GtkTreeIter *iter,
-    TplEvent *event)
+static void
+log_conversation_free (LogConversation *conversation)
 {
-  TplEvent *stored_event;
-  TplEntity *target;
-  TpAccount *account;
-  gboolean found = FALSE;
-  GtkTreeIter parent;
+  g_slice_free (LogConversation, conversation);
+}
 
-  if (gtk_tree_model_iter_parent (model, &parent, iter))
-    return FALSE;
+static void
+log_conversation_queue_free (GQueue *queue)
+{
+  g_queue_free_full (queue, (GDestroyNotify) log_conversation_free);
+}
 
-  gtk_tree_model_get (model, iter,
-      COL_EVENTS_ACCOUNT, &account,
-      COL_EVENTS_TARGET, &target,
-      COL_EVENTS_EVENT, &stored_event,
-      -1);
+/* Events of the same type, on the same account and with the same contact or
+ * in the same room are grouped together */
+static gchar *
+event_dup_conversation_key (TplEvent *event)
+{
+  TplEntity *sender = tpl_event_get_sender (event);
+  TplEntity *receiver = tpl_event_get_receiver (event);
+  TplEntity *target;
 
-  if (G_OBJECT_TYPE (event) == G_OBJECT_TYPE (stored_event) &&
-      account_equal (account, tpl_event_get_account (event)) &&
-      (entity_equal (target, event_get_target (event)) ||
-      is_same_confroom (event, stored_event)))
-    {
-      GtkTreeIter child;
-      gint64 timestamp;
+  if (receiver != NULL &&
+      tpl_entity_get_entity_type (sender) == TPL_ENTITY_ROOM)
+    target = sender;
+  else if (receiver != NULL &&
+      tpl_entity_get_entity_type (receiver) == TPL_ENTITY_ROOM)
+    target = receiver;
+  else
+    target = event_get_target (event);
 
-      gtk_tree_model_iter_nth_child (model, &child, iter,
-          gtk_tree_model_iter_n_children (model, iter) - 1);
+  return g_strdup_printf ("%s %s %s", G_OBJECT_TYPE_NAME (event),
+      tp_proxy_get_object_path (tpl_event_get_account (event)),
+      tpl_entity_get_identifier (target));
+}
 
-      gtk_tree_model_get (model, &child,
-          COL_EVENTS_TS, &timestamp,
-          -1);
+static void
+log_window_clear_events (EmpathyLogWindow *self)
+{
+  /* Empty the view at once rather than row by row; what's still pending
+   * would be removed anyway */
+  g_signal_handlers_block_by_func (self->priv->store_events,
+      store_events_row_deleted, self);
+  gtk_tree_store_clear (self->priv->store_events);
+  g_signal_handlers_unblock_by_func (self->priv->store_events,
+      store_events_row_deleted, self);
 
-      if (ABS (tpl_event_get_timestamp (event) - timestamp) < MAX_GAP)
-        {
-          /* The gap is smaller than 30 min */
-          found = TRUE;
-        }
-    }
+  g_string_truncate (self->priv->pending_script, 0);
+  g_string_append (queue_script (self), "clearRows();\n");
 
-  g_object_unref (stored_event);
-  g_object_unref (account);
-  g_object_unref (target);
+  g_hash_table_remove_all (self->priv->conversations);
 
-  return found;
+  /* Nothing is shown anymore */
+  g_queue_foreach (&self->priv->loaded_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->loaded_dates);
 }
 
 static gchar *
@@ -1167,25 +1430,49 @@ get_parent_iter_for_message (TplEvent *event,
     GtkTreeIter *parent)
 {
   GtkTreeStore *store;
-  GtkTreeModel *model;
   GtkTreeIter iter;
-  gboolean parent_found = FALSE;
-  gboolean next;
+  GQueue *conversations;
+  LogConversation *conversation = NULL;
+  gint64 timestamp;
+  gchar *key;
+  GList *l;
 
   store = log_window->priv->store_events;
-  model = GTK_TREE_MODEL (store);
+  timestamp = tpl_event_get_timestamp (event);
 
-  for (next = gtk_tree_model_get_iter_first (model, &iter);
-       next;
-       next = gtk_tree_model_iter_next (model, &iter))
+  key = event_dup_conversation_key (event);
+  conversations = g_hash_table_lookup (log_window->priv->conversations, key);
+  if (conversations == NULL)
     {
-      if ((parent_found = model_is_parent (model, &iter, event)))
-        break;
+      conversations = g_queue_new ();
+      g_hash_table_insert (log_window->priv->conversations, key,
+          conversations);
+    }
+  else
+    {
+      g_free (key);
     }
 
-  if (parent_found)
+  /* Events mostly arrive in order, so this is usually the first one */
+  for (l = conversations->head; l != NULL; l = l->next)
     {
-      *parent = iter;
+      LogConversation *c = l->data;
+
+      if (ABS (timestamp - c->last_timestamp) < MAX_GAP)
+        {
+          /* The gap is smaller than 30 min */
+          conversation = c;
+          g_queue_unlink (conversations, l);
+          g_queue_push_head_link (conversations, l);
+          break;
+        }
+    }
+
+  if (conversation != NULL)
+    {
+      conversation->last_timestamp = MAX (conversation->last_timestamp,
+          timestamp);
+      *parent = conversation->iter;
     }
   else
     {
@@ -1213,6 +1500,11 @@ get_parent_iter_for_message (TplEvent *event,
 
       *parent = iter;
 
+      conversation = g_slice_new (LogConversation);
+      conversation->iter = iter;
+      conversation->last_timestamp = timestamp;
+      g_queue_push_head (conversations, conversation);
+
       g_free (body);
       g_free (pretty_date);
       g_date_time_unref (date);
@@ -1259,7 +1551,7 @@ log_window_append_chat_message (TplEvent *event,
   GtkTreeIter iter, parent;
   gchar *pretty_date, *alias, *body;
   GDateTime *date;
-  EmpathyStringParser *parsers;
+  EmpathyStringHtmlFlags flags = EMPATHY_STRING_HTML_NEWLINES;
   GString *msg;
 
   date = g_date_time_new_from_unix_local (
@@ -1273,13 +1565,13 @@ log_window_append_chat_message (TplEvent *event,
       tpl_entity_get_alias (tpl_event_get_sender (event)), -1);
 
   /* escape the text */
-  parsers = empathy_webkit_get_string_parser (
-      g_settings_get_boolean (log_window->priv->gsettings_chat,
-        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
+  if (g_settings_get_boolean (log_window->priv->gsettings_chat,
+        EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+    flags |= EMPATHY_STRING_HTML_SMILEYS;
   msg = g_string_new ("");
 
-  empathy_string_parser_substr (empathy_message_get_body (message), -1,
-      parsers, msg);
+  empathy_string_append_html (msg, empathy_message_get_body (message), -1,
+      flags);
 
   if (tpl_text_event_get_message_type (TPL_TEXT_EVENT (event))
       == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
@@ -1584,7 +1876,7 @@ model_has_entity (GtkTreeModel *model,
     GtkTreeIter *iter,
     gpointer data)
 {
-  TplLogSearchHit *hit = data;
+  EmpathyLogIndexHit *hit = data;
   TplEntity *e;
   TpAccount *a;
   gboolean ret = FALSE;
@@ -1654,7 +1946,7 @@ populate_events_from_search_hits (GList *accounts,
 
   for (l = log_window->priv->hits; l != NULL; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      EmpathyLogIndexHit *hit = l->data;
       GList *acc, *targ;
       gboolean found = FALSE;
 
@@ -1766,7 +2058,7 @@ populate_dates_from_search_hits (GList *accounts,
 
   for (l = log_window->priv->hits; l != NULL; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      EmpathyLogIndexHit *hit = l->data;
       GList *acc, *targ;
       gboolean found = FALSE;
 
@@ -1857,7 +2149,7 @@ populate_entities_from_search_hits (void)
 
   for (l = log_window->priv->hits; l; l = l->next)
     {
-      TplLogSearchHit *hit = l->data;
+      EmpathyLogIndexHit *hit = l->data;
 
       /* Protect against invalid data (corrupt or old log files). */
       if (hit->account == NULL || hit->target == NULL)
@@ -1921,38 +2213,61 @@ populate_entities_from_search_hits (void)
     gtk_tree_selection_select_iter (selection, &iter);
 }
 
+/* Takes ownership of @hits, a list of EmpathyLogIndexHits */
+static void
+log_window_set_hits (EmpathyLogWindow *self,
+    GList *hits)
+{
+  GtkTreeView *view;
+  GtkTreeSelection *selection;
+
+  tp_clear_pointer (&self->priv->hits, empathy_log_index_hits_free);
+  self->priv->hits = hits;
+
+  view = GTK_TREE_VIEW (self->priv->treeview_when);
+  selection = gtk_tree_view_get_selection (view);
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_when_changed_cb,
+      self);
+
+  populate_entities_from_search_hits ();
+}
+
 static void
 log_manager_searched_new_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
-  GList *hits;
-  GtkTreeView *view;
-  GtkTreeSelection *selection;
+  GList *tpl_hits, *hits = NULL, *l;
   GError *error = NULL;
 
   if (log_window == NULL)
     return;
 
   if (!tpl_log_manager_search_finish (TPL_LOG_MANAGER (manager),
-      result, &hits, &error))
+      result, &tpl_hits, &error))
     {
       DEBUG ("%s. Aborting", error->message);
       g_error_free (error);
       return;
     }
 
-  tp_clear_pointer (&log_window->priv->hits, tpl_log_manager_search_free);
-  log_window->priv->hits = hits;
+  for (l = tpl_hits; l != NULL; l = l->next)
+    {
+      TplLogSearchHit *hit = l->data;
 
-  view = GTK_TREE_VIEW (log_window->priv->treeview_when);
-  selection = gtk_tree_view_get_selection (view);
+      /* Protect against invalid data (corrupt or old log files). */
+      if (hit->account == NULL || hit->target == NULL || hit->date == NULL)
+        continue;
 
-  g_signal_handlers_unblock_by_func (selection,
-      log_window_when_changed_cb,
-      log_window);
+      hits = g_list_prepend (hits, empathy_log_index_hit_new (hit->account,
+          hit->target, hit->date, 0));
+    }
 
-  populate_entities_from_search_hits ();
+  tpl_log_manager_search_free (tpl_hits);
+
+  log_window_set_hits (log_window, g_list_reverse (hits));
 }
 
 static void
@@ -1964,7 +2279,7 @@ log_window_find_populate (EmpathyLogWindow *self,
   GtkTreeSelection *selection;
   GtkListStore *store;
 
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
 
   view = GTK_TREE_VIEW (self->priv->treeview_who);
   model = gtk_tree_view_get_model (view);
@@ -1981,7 +2296,7 @@ log_window_find_populate (EmpathyLogWindow *self,
 
   if (EMP_STR_EMPTY (search_criteria))
     {
-      tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+      tp_clear_pointer (&self->priv->hits, empathy_log_index_hits_free);
       webkit_web_view_set_highlight_text_matches (
           WEBKIT_WEB_VIEW (self->priv->webview), FALSE);
       log_window_who_populate (self);
@@ -1996,6 +2311,14 @@ log_window_find_populate (EmpathyLogWindow *self,
   webkit_web_view_mark_text_matches (WEBKIT_WEB_VIEW (self->priv->webview),
       search_criteria, FALSE, 0);
 
+  if (empathy_log_index_is_ready (self->priv->log_index))
+    {
+      log_window_set_hits (self,
+          empathy_log_index_search (self->priv->log_index, search_criteria));
+      return;
+    }
+
+  /* Until the index has been built, scan the logs */
   tpl_log_manager_search_async (self->priv->log_manager,
       search_criteria, TPL_EVENT_MASK_ANY,
       log_manager_searched_new_cb, NULL);
@@ -2045,8 +2368,13 @@ log_window_search_entry_changed_cb (GtkWidget *entry,
 
   if (self->priv->source != 0)
     g_source_remove (self->priv->source);
-  self->priv->source = g_timeout_add (500, (GSourceFunc) start_find_search,
-      self);
+
+  /* Searching the index is cheap enough to follow the typing closely,
+   * scanning the logs isn't */
+  self->priv->source = g_timeout_add (
+      empathy_log_index_is_ready (self->priv->log_index) ?
+          SEARCH_INDEX_DELAY : SEARCH_LOGS_DELAY,
+      (GSourceFunc) start_find_search, self);
 }
 
 static void
@@ -2455,8 +2783,7 @@ log_window_who_populate (EmpathyLogWindow *self)
       log_window_who_changed_cb,
       self);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_cancel_loads (self);
 
   if (!all_accounts && account == NULL)
     {
@@ -2643,6 +2970,9 @@ log_window_events_setup (EmpathyLogWindow *self)
       TPL_TYPE_ENTITY,      /* target */
       TPL_TYPE_EVENT);      /* event */
 
+  self->priv->conversations = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) log_conversation_queue_free);
+
   sortable = GTK_TREE_SORTABLE (store);
 
   gtk_tree_sortable_set_sort_column_id (sortable,
@@ -2725,7 +3055,7 @@ log_window_chats_accounts_changed_cb (GtkWidget *combobox,
     EmpathyLogWindow *self)
 {
   /* Clear all current messages shown in the textview */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
 
   log_window_who_populate (self);
 }
@@ -3117,9 +3447,7 @@ log_window_maybe_expand_events (void)
 
   /* If there's only one result, expand it */
   if (gtk_tree_model_iter_n_children (model, NULL) == 1)
-    webkit_web_view_execute_script (
-        WEBKIT_WEB_VIEW (log_window->priv->webview),
-        "javascript:expandAll()");
+    g_string_append (queue_script (log_window), "expandAll();\n");
 }
 
 static gboolean
@@ -3162,6 +3490,493 @@ start_spinner (void)
   _tpl_action_chain_append (log_window->priv->chain, show_events, NULL);
 }
 
+static void
+log_window_cancel_loads (EmpathyLogWindow *self)
+{
+  _tpl_action_chain_clear (self->priv->chain);
+  self->priv->count++;
+
+  g_queue_foreach (&self->priv->pending_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->pending_dates);
+  g_queue_foreach (&self->priv->loaded_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->loaded_dates);
+  g_queue_foreach (&self->priv->newer_dates, (GFunc) ctx_free, NULL);
+  g_queue_clear (&self->priv->newer_dates);
+  self->priv->loading_page = FALSE;
+}
+
+static void get_events_for_date (TplActionChain *chain, gpointer user_data);
+static void page_loaded (TplActionChain *chain, gpointer user_data);
+
+/* Returns the timestamp of the start of the day @days days after @date */
+static gint64
+log_window_date_get_timestamp (GDate *date,
+    gint days)
+{
+  GDateTime *start, *dt;
+  gint64 timestamp;
+
+  start = g_date_time_new_utc (g_date_get_year (date),
+      g_date_get_month (date), g_date_get_day (date),
+      0, 0, 0);
+  dt = g_date_time_add_days (start, days);
+  timestamp = g_date_time_to_unix (dt);
+
+  g_date_time_unref (dt);
+  g_date_time_unref (start);
+
+  return timestamp;
+}
+
+/* Forgets the conversation of the top-level row @iter if it is being
+ * @removed, otherwise updates its latest timestamp after some of its events
+ * were removed */
+static void
+log_window_update_conversation (EmpathyLogWindow *self,
+    GtkTreeIter *iter,
+    gboolean removed)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GQueue *conversations;
+  TplEvent *event;
+  gchar *key;
+  GList *l;
+
+  gtk_tree_model_get (model, iter,
+      COL_EVENTS_EVENT, &event,
+      -1);
+
+  key = event_dup_conversation_key (event);
+  conversations = g_hash_table_lookup (self->priv->conversations, key);
+  g_free (key);
+  g_object_unref (event);
+
+  if (conversations == NULL)
+    return;
+
+  for (l = conversations->head; l != NULL; l = l->next)
+    {
+      LogConversation *conversation = l->data;
+      GtkTreeIter last;
+      gint n;
+
+      /* All the iters of a GtkTreeStore row point to the same node */
+      if (conversation->iter.user_data != iter->user_data)
+        continue;
+
+      n = gtk_tree_model_iter_n_children (model, iter);
+      if (removed)
+        {
+          log_conversation_free (conversation);
+          g_queue_delete_link (conversations, l);
+        }
+      else if (n > 0 && gtk_tree_model_iter_nth_child (model, &last, iter,
+              n - 1))
+        {
+          gtk_tree_model_get (model, &last,
+              COL_EVENTS_TS, &conversation->last_timestamp,
+              -1);
+        }
+
+      break;
+    }
+}
+
+/* Removes the events from @from included to @to excluded. Conversations
+ * only partly in that range keep their other events. */
+static void
+log_window_remove_events (EmpathyLogWindow *self,
+    gint64 from,
+    gint64 to)
+{
+  GtkTreeStore *store = self->priv->store_events;
+  GtkTreeModel *model = GTK_TREE_MODEL (store);
+  GtkTreeIter iter;
+  gboolean valid;
+
+  valid = gtk_tree_model_get_iter_first (model, &iter);
+  while (valid)
+    {
+      GtkTreeIter child;
+      gboolean trimmed = FALSE;
+      gboolean next;
+      gint64 ts;
+
+      next = gtk_tree_model_iter_children (model, &child, &iter);
+      while (next)
+        {
+          gtk_tree_model_get (model, &child,
+              COL_EVENTS_TS, &ts,
+              -1);
+
+          if (ts >= from && ts < to)
+            {
+              next = gtk_tree_store_remove (store, &child);
+              trimmed = TRUE;
+            }
+          else
+            {
+              next = gtk_tree_model_iter_next (model, &child);
+            }
+        }
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_TS, &ts,
+          -1);
+
+      if (ts >= from && ts < to &&
+          !gtk_tree_model_iter_has_child (model, &iter))
+        {
+          log_window_update_conversation (self, &iter, TRUE);
+          valid = gtk_tree_store_remove (store, &iter);
+        }
+      else
+        {
+          if (trimmed)
+            log_window_update_conversation (self, &iter, FALSE);
+
+          valid = gtk_tree_model_iter_next (model, &iter);
+        }
+    }
+}
+
+/* Gets the position in the web view of the top-level rows of store_events
+ * from @first to @last included */
+static gboolean
+log_window_get_rows_extent (EmpathyLogWindow *self,
+    gint first,
+    gint last,
+    gdouble *top,
+    gdouble *bottom)
+{
+  WebKitDOMDocument *dom;
+  WebKitDOMNodeList *nodes;
+  WebKitDOMNode *node;
+  GError *error = NULL;
+
+  log_window_flush_script (self);
+
+  dom = webkit_web_view_get_dom_document (
+      WEBKIT_WEB_VIEW (self->priv->webview));
+  if (dom == NULL)
+    return FALSE;
+
+  nodes = webkit_dom_document_query_selector_all (dom, "#treeview > div",
+      &error);
+  if (nodes == NULL)
+    {
+      DEBUG ("Error getting the rows: %s",
+          error ? error->message : "No error");
+      g_clear_error (&error);
+      return FALSE;
+    }
+
+  node = webkit_dom_node_list_item (nodes, first);
+  if (node == NULL || !WEBKIT_DOM_IS_ELEMENT (node))
+    return FALSE;
+
+  *top = webkit_dom_element_get_offset_top (WEBKIT_DOM_ELEMENT (node));
+
+  node = webkit_dom_node_list_item (nodes, last);
+  if (node == NULL || !WEBKIT_DOM_IS_ELEMENT (node))
+    return FALSE;
+
+  *bottom = webkit_dom_element_get_offset_top (WEBKIT_DOM_ELEMENT (node)) +
+      webkit_dom_element_get_offset_height (WEBKIT_DOM_ELEMENT (node));
+
+  return TRUE;
+}
+
+static gdouble
+log_window_get_document_height (EmpathyLogWindow *self)
+{
+  WebKitDOMDocument *dom;
+  WebKitDOMHTMLElement *body;
+
+  log_window_flush_script (self);
+
+  dom = webkit_web_view_get_dom_document (
+      WEBKIT_WEB_VIEW (self->priv->webview));
+  if (dom == NULL)
+    return 0;
+
+  body = webkit_dom_document_get_body (dom);
+  if (body == NULL)
+    return 0;
+
+  return webkit_dom_element_get_scroll_height (WEBKIT_DOM_ELEMENT (body));
+}
+
+/* Before loading a page of dates older than the ones shown if @older, or
+ * newer ones otherwise, removes the page at the other end once there are
+ * MAX_LOADED_PAGES, unless it is within a screen of the viewport. Its dates
+ * are queued to be loaded again when scrolling back to them. */
+static void
+log_window_evict_page (EmpathyLogWindow *self,
+    gboolean older)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->store_events);
+  GQueue *loaded = &self->priv->loaded_dates;
+  GtkTreeIter iter;
+  GList *l, *next;
+  GDate *date;
+  gint64 from, to;
+  gint i, first = -1, last = -1;
+  guint n;
+  gboolean valid;
+
+  if (g_queue_get_length (loaded) < MAX_LOADED_PAGES * DATES_PER_PAGE)
+    return;
+
+  /* The page at the other end, with the other targets' events on its last
+   * date since they can't be told apart */
+  l = older ? loaded->head : loaded->tail;
+  for (n = 1; n < DATES_PER_PAGE; n++)
+    l = older ? l->next : l->prev;
+
+  date = ((Ctx *) l->data)->date;
+  for (next = older ? l->next : l->prev;
+       next != NULL && g_date_compare (((Ctx *) next->data)->date, date) == 0;
+       next = older ? next->next : next->prev)
+    n++;
+
+  if (n == g_queue_get_length (loaded))
+    return;
+
+  if (older)
+    {
+      from = log_window_date_get_timestamp (date, 0);
+      to = G_MAXINT64;
+    }
+  else
+    {
+      from = G_MININT64;
+      to = log_window_date_get_timestamp (date, 1);
+    }
+
+  /* Find the rows to remove, rows are sorted by timestamp */
+  valid = gtk_tree_model_get_iter_first (model, &iter);
+  for (i = 0; valid; i++)
+    {
+      GtkTreeIter child;
+      gint64 ts, last_ts;
+      gint children;
+
+      gtk_tree_model_get (model, &iter,
+          COL_EVENTS_TS, &ts,
+          -1);
+
+      last_ts = ts;
+      children = gtk_tree_model_iter_n_children (model, &iter);
+      if (children > 0 &&
+          gtk_tree_model_iter_nth_child (model, &child, &iter, children - 1))
+        gtk_tree_model_get (model, &child,
+            COL_EVENTS_TS, &last_ts,
+            -1);
+
+      if (ts < to && last_ts >= from)
+        {
+          if (first < 0)
+            first = i;
+          last = i;
+        }
+
+      valid = gtk_tree_model_iter_next (model, &iter);
+    }
+
+  if (first >= 0)
+    {
+      GtkAdjustment *adjustment;
+      gdouble top, bottom, value, page_size;
+
+      if (!log_window_get_rows_extent (self, first, last, &top, &bottom))
+        return;
+
+      adjustment = gtk_scrollable_get_vadjustment (
+          GTK_SCROLLABLE (self->priv->webview));
+      value = gtk_adjustment_get_value (adjustment);
+      page_size = gtk_adjustment_get_page_size (adjustment);
+
+      if (older ? top < value + 2 * page_size : bottom > value - page_size)
+        return;
+    }
+
+  DEBUG ("Removing %u %s dates", n, older ? "newer" : "older");
+
+  for (; n > 0; n--)
+    {
+      if (older)
+        g_queue_push_head (&self->priv->newer_dates, g_queue_pop_head (loaded));
+      else
+        g_queue_push_head (&self->priv->pending_dates,
+            g_queue_pop_tail (loaded));
+    }
+
+  if (first < 0)
+    return;
+
+  if (older)
+    {
+      gdouble height = log_window_get_document_height (self);
+
+      log_window_remove_events (self, from, to);
+
+      /* The view stays as far from the end as before the rows below it
+       * were removed */
+      if (self->priv->keep_position)
+        self->priv->from_bottom -= height -
+            log_window_get_document_height (self);
+    }
+  else
+    {
+      /* The script keeps the view where it was once the rows above it
+       * are removed */
+      g_string_append (queue_script (self), "startRemovingAbove();\n");
+      log_window_remove_events (self, from, to);
+      g_string_append (queue_script (self), "stopRemovingAbove();\n");
+    }
+}
+
+/* Appends the next DATES_PER_PAGE dates to the chain, older than the ones
+ * shown if @older, newer ones otherwise. Returns FALSE if there's nothing
+ * left to load */
+static gboolean
+log_window_load_page (EmpathyLogWindow *self,
+    gboolean older)
+{
+  GQueue *queue;
+  guint i;
+
+  queue = older ? &self->priv->pending_dates : &self->priv->newer_dates;
+
+  if (self->priv->loading_page || g_queue_is_empty (queue))
+    return FALSE;
+
+  log_window_evict_page (self, older);
+
+  for (i = 0; i < DATES_PER_PAGE; i++)
+    {
+      Ctx *ctx = g_queue_pop_head (queue);
+      Ctx *loaded;
+
+      if (ctx == NULL)
+        break;
+
+      loaded = ctx_new (self, ctx->account, ctx->entity, ctx->date,
+          ctx->event_mask, ctx->subtype, ctx->count);
+      if (older)
+        g_queue_push_tail (&self->priv->loaded_dates, loaded);
+      else
+        g_queue_push_head (&self->priv->loaded_dates, loaded);
+
+      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+    }
+
+  self->priv->loading_page = TRUE;
+  self->priv->loading_older = older;
+  self->priv->page_events = 0;
+  _tpl_action_chain_append (self->priv->chain, page_loaded, self);
+
+  return TRUE;
+}
+
+static void
+page_loaded (TplActionChain *chain,
+    gpointer user_data)
+{
+  EmpathyLogWindow *self = user_data;
+
+  self->priv->loading_page = FALSE;
+
+  /* Nothing to scroll to, keep going until something shows up */
+  if (self->priv->page_events == 0)
+    log_window_load_page (self, self->priv->loading_older);
+  else
+    self->priv->scroll_to_end = FALSE;
+
+  _tpl_action_chain_continue (chain);
+}
+
+/* Loads older dates if the view is within a screen of the top, or newer
+ * dates removed earlier if it is within a screen of the bottom */
+static void
+log_window_events_maybe_load_page (EmpathyLogWindow *self,
+    GtkAdjustment *adjustment)
+{
+  gdouble value = gtk_adjustment_get_value (adjustment);
+  gdouble page_size = gtk_adjustment_get_page_size (adjustment);
+  gdouble upper = gtk_adjustment_get_upper (adjustment);
+
+  if (self->priv->loading_page)
+    return;
+
+  if (value <= page_size &&
+      !g_queue_is_empty (&self->priv->pending_dates))
+    {
+      /* The first page scrolls to the end by itself */
+      if (!self->priv->scroll_to_end)
+        {
+          self->priv->keep_position = TRUE;
+          self->priv->from_bottom = upper - value;
+        }
+
+      log_window_load_page (self, TRUE);
+    }
+  else if (value + 2 * page_size >= upper &&
+      !g_queue_is_empty (&self->priv->newer_dates))
+    {
+      /* Added below the view, which doesn't need to move */
+      self->priv->keep_position = FALSE;
+      log_window_load_page (self, FALSE);
+    }
+  else
+    {
+      return;
+    }
+
+  _tpl_action_chain_start (self->priv->chain);
+}
+
+static void
+log_window_events_value_changed_cb (GtkAdjustment *adjustment,
+    EmpathyLogWindow *self)
+{
+  /* The user scrolled: keep what they now see while a page is loading,
+   * otherwise leave the view alone */
+  if (self->priv->keep_position && self->priv->loading_page)
+    self->priv->from_bottom = gtk_adjustment_get_upper (adjustment) -
+        gtk_adjustment_get_value (adjustment);
+  else
+    self->priv->keep_position = FALSE;
+
+  log_window_events_maybe_load_page (self, adjustment);
+}
+
+static void
+log_window_events_changed_cb (GtkAdjustment *adjustment,
+    EmpathyLogWindow *self)
+{
+  if (self->priv->keep_position)
+    {
+      gdouble value;
+
+      /* Scroll down by as much as was inserted above */
+      value = gtk_adjustment_get_upper (adjustment) - self->priv->from_bottom;
+      value = CLAMP (value, gtk_adjustment_get_lower (adjustment),
+          gtk_adjustment_get_upper (adjustment) -
+          gtk_adjustment_get_page_size (adjustment));
+
+      g_signal_handlers_block_by_func (adjustment,
+          log_window_events_value_changed_cb, self);
+      gtk_adjustment_set_value (adjustment, value);
+      g_signal_handlers_unblock_by_func (adjustment,
+          log_window_events_value_changed_cb, self);
+    }
+
+  /* Only loads more if what was inserted doesn't fill the screen */
+  log_window_events_maybe_load_page (self, adjustment);
+}
+
 static void
 log_window_got_messages_for_date_cb (GObject *manager,
     GAsyncResult *result,
@@ -3241,33 +4056,37 @@ log_window_got_messages_for_date_cb (GObject *manager,
           EmpathyMessage *msg = empathy_message_from_tpl_log_event (event);
           log_window_append_message (event, msg);
           tp_clear_object (&msg);
+          log_window->priv->page_events++;
         }
 
       g_object_unref (event);
     }
   g_list_free (events);
 
+  /* Show what we have while the other dates are loading */
+  if (log_window->priv->page_events > 0)
+    {
+      gtk_spinner_stop (GTK_SPINNER (log_window->priv->spinner));
+      gtk_notebook_set_current_page (
+          GTK_NOTEBOOK (log_window->priv->notebook), PAGE_EVENTS);
+    }
+
   model = GTK_TREE_MODEL (log_window->priv->store_events);
   n = gtk_tree_model_iter_n_children (model, NULL) - 1;
 
-  if (n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
+  if (log_window->priv->scroll_to_end &&
+      n >= 0 && gtk_tree_model_iter_nth_child (model, &iter, NULL, n))
     {
+      GString *script = queue_script (log_window);
       GtkTreePath *path;
-      char *str, *script;
 
+      /* After the rows still pending */
       path = gtk_tree_model_get_path (model, &iter);
-      str = gtk_tree_path_to_string (path);
-
-      script = g_strdup_printf ("javascript:scrollToRow([%s]);",
-          g_strdelimit (str, ":", ','));
-
-      webkit_web_view_execute_script (
-          WEBKIT_WEB_VIEW (log_window->priv->webview),
-          script);
+      g_string_append (script, "scrollToRow(");
+      append_script_path (script, path);
+      g_string_append (script, ");\n");
 
       gtk_tree_path_free (path);
-      g_free (str);
-      g_free (script);
     }
 
  out:
@@ -3304,8 +4123,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
   anytime = g_date_new_dmy (2, 1, -1);
   separator = g_date_new_dmy (1, 1, -1);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_cancel_loads (self);
 
   for (acc = accounts, targ = targets;
        acc != NULL && targ != NULL;
@@ -3325,7 +4143,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
 
               ctx = ctx_new (self, account, target, date, event_mask, subtype,
                   self->priv->count);
-              _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+              g_queue_push_tail (&self->priv->pending_dates, ctx);
             }
           else
             {
@@ -3350,7 +4168,7 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
                     {
                       ctx = ctx_new (self, account, target, d,
                           event_mask, subtype, self->priv->count);
-                      _tpl_action_chain_append (self->priv->chain, get_events_for_date, ctx);
+                      g_queue_push_tail (&self->priv->pending_dates, ctx);
                     }
 
                   g_date_free (d);
@@ -3359,6 +4177,14 @@ log_window_get_messages_for_dates (EmpathyLogWindow *self,
         }
     }
 
+  /* Newest first, older ones are loaded when scrolling up */
+  g_queue_sort (&self->priv->pending_dates,
+      (GCompareDataFunc) ctx_compare_dates_newest_first, NULL);
+
+  self->priv->scroll_to_end = TRUE;
+  self->priv->keep_position = FALSE;
+  log_window_load_page (self, TRUE);
+
   start_spinner ();
   _tpl_action_chain_start (self->priv->chain);
 
@@ -3554,10 +4380,9 @@ log_window_chats_get_messages (EmpathyLogWindow *self,
   store = GTK_LIST_STORE (model);
 
   /* Clear all current messages shown in the textview */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
 
-  _tpl_action_chain_clear (self->priv->chain);
-  self->priv->count++;
+  log_window_cancel_loads (self);
 
   /* If there's a search use the returned hits */
   if (self->priv->hits != NULL)
@@ -3715,7 +4540,7 @@ log_window_logger_clear_account_cb (TpProxy *proxy,
 
   /* Refresh the log viewer so the logs are cleared if the account
    * has been deleted */
-  gtk_tree_store_clear (self->priv->store_events);
+  log_window_clear_events (self);
   log_window_who_populate (self);
 
   /* Re-filter the account chooser so the accounts without logs get
@@ -28,67 +28,266 @@
 #include "empathy-smiley-manager.h"
 #include "empathy-ui-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
+typedef struct _SmileyAutomaton SmileyAutomaton;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
-	SmileyManagerTree *tree;
+	/* Every string given to empathy_smiley_manager_add(), see
+	 * SmileyPattern. */
+	GArray            *patterns;
+	/* Compiled from patterns, NULL when it has to be rebuilt */
+	SmileyAutomaton   *automaton;
+	/* icon name -> EmpathySmileyImage */
+	GHashTable        *images;
 	GSList            *smileys;
 } EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
+typedef struct {
+	gchar              *str;
+	EmpathySmileyImage *image;
+} SmileyPattern;
+
+/* Images are only loaded when first needed, and shared by the menu and
+ * the chat views. They are unloaded when the icon theme changes. */
+struct _EmpathySmileyImage {
+	gchar       *icon_name;
+	gchar       *str;       /* First string of the smiley */
 	GdkPixbuf   *pixbuf;
 	gchar       *path;
-	GSList      *childrens;
+	gboolean     path_loaded;
+};
+
+/* The smiley strings are compiled into a trie stored as a flat table: the
+ * characters used by smileys are mapped to classes 1..n_classes-1 and
+ * transitions[state * n_classes + class] is the next state, or 0 if there
+ * is none. Class 0 is every character not used by any smiley, it never
+ * has a transition. State 0 is the root. */
+struct _SmileyAutomaton {
+	guint16      ascii_classes[128];
+	GHashTable  *unichar_classes; /* gunichar -> class, for non-ASCII */
+	guint        n_classes;
+	guint16     *transitions;
+	/* For each state, index + 1 in patterns of the smiley ending
+	 * there, or 0 */
+	guint       *matches;
+	guint        n_states;
 };
 
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
+static void
+smiley_automaton_free (SmileyAutomaton *automaton)
 {
-	SmileyManagerTree *tree;
+	if (!automaton) {
+		return;
+	}
+
+	g_hash_table_destroy (automaton->unichar_classes);
+	g_free (automaton->transitions);
+	g_free (automaton->matches);
+	g_slice_free (SmileyAutomaton, automaton);
+}
 
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
+static guint
+smiley_automaton_get_class (SmileyAutomaton *automaton,
+			    gunichar         c)
+{
+	if (c < 128) {
+		return automaton->ascii_classes[c];
+	}
 
-	return tree;
+	return GPOINTER_TO_UINT (g_hash_table_lookup (automaton->unichar_classes,
+						      GUINT_TO_POINTER (c)));
 }
 
-static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+static SmileyAutomaton *
+smiley_automaton_new (GArray *patterns)
 {
-	GSList *l;
+	SmileyAutomaton *automaton;
+	GArray          *transitions;
+	GArray          *matches;
+	guint            i;
+	guint            zero = 0;
+
+	automaton = g_slice_new0 (SmileyAutomaton);
+	automaton->unichar_classes = g_hash_table_new (NULL, NULL);
+	automaton->n_classes = 1;
+
+	/* First give a class to each character used by a smiley, so we know
+	 * the width of a row in the table. */
+	for (i = 0; i < patterns->len; i++) {
+		SmileyPattern *pattern = &g_array_index (patterns, SmileyPattern, i);
+		const gchar   *p;
+
+		for (p = pattern->str; *p; p = g_utf8_next_char (p)) {
+			gunichar c = g_utf8_get_char (p);
+
+			if (smiley_automaton_get_class (automaton, c) != 0) {
+				continue;
+			}
 
-	if (!tree) {
-		return;
+			if (c < 128) {
+				automaton->ascii_classes[c] = automaton->n_classes;
+			} else {
+				g_hash_table_insert (automaton->unichar_classes,
+						     GUINT_TO_POINTER (c),
+						     GUINT_TO_POINTER (automaton->n_classes));
+			}
+			automaton->n_classes++;
+		}
 	}
 
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
+	/* Then insert the smileys, adding a zeroed row for each new state */
+	transitions = g_array_new (FALSE, TRUE, sizeof (guint16));
+	matches = g_array_new (FALSE, TRUE, sizeof (guint));
+	g_array_set_size (transitions, automaton->n_classes);
+	g_array_set_size (matches, 1);
+
+	for (i = 0; i < patterns->len; i++) {
+		SmileyPattern *pattern = &g_array_index (patterns, SmileyPattern, i);
+		const gchar   *p;
+		guint          state = 0;
+
+		for (p = pattern->str; *p; p = g_utf8_next_char (p)) {
+			guint    class;
+			guint16 *next;
+
+			class = smiley_automaton_get_class (automaton,
+							    g_utf8_get_char (p));
+			next = &g_array_index (transitions, guint16,
+					       state * automaton->n_classes + class);
+
+			if (*next == 0) {
+				if (matches->len > G_MAXUINT16) {
+					g_warning ("Too many smileys, ignoring '%s'",
+						   pattern->str);
+					break;
+				}
+
+				*next = matches->len;
+				g_array_set_size (transitions,
+						  transitions->len + automaton->n_classes);
+				g_array_append_val (matches, zero);
+			}
+
+			/* The array may have been reallocated, don't use next */
+			state = g_array_index (transitions, guint16,
+					       state * automaton->n_classes + class);
+		}
+
+		/* Smileys added last take precedence */
+		if (*p == '\0') {
+			g_array_index (matches, guint, state) = i + 1;
+		}
 	}
 
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
+	automaton->n_states = matches->len;
+	automaton->transitions = (guint16 *) g_array_free (transitions, FALSE);
+	automaton->matches = (guint *) g_array_free (matches, FALSE);
+
+	return automaton;
+}
+
+static SmileyAutomaton *
+smiley_manager_get_automaton (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+
+	if (!priv->automaton) {
+		priv->automaton = smiley_automaton_new (priv->patterns);
 	}
-	g_slist_free (tree->childrens);
-	g_free (tree->path);
-	g_slice_free (SmileyManagerTree, tree);
+
+	return priv->automaton;
+}
+
+static EmpathySmileyImage *
+smiley_image_new (const gchar *icon_name, const gchar *str)
+{
+	EmpathySmileyImage *image;
+
+	image = g_slice_new0 (EmpathySmileyImage);
+	image->icon_name = g_strdup (icon_name);
+	image->str = g_strdup (str);
+
+	return image;
+}
+
+static void
+smiley_image_unload (EmpathySmileyImage *image)
+{
+	if (image->pixbuf) {
+		g_object_unref (image->pixbuf);
+		image->pixbuf = NULL;
+	}
+	g_free (image->path);
+	image->path = NULL;
+	image->path_loaded = FALSE;
+}
+
+static void
+smiley_image_free (EmpathySmileyImage *image)
+{
+	smiley_image_unload (image);
+	g_free (image->icon_name);
+	g_free (image->str);
+	g_slice_free (EmpathySmileyImage, image);
+}
+
+static GdkPixbuf *
+smiley_image_get_pixbuf (EmpathySmileyImage *image)
+{
+	if (!image->pixbuf) {
+		image->pixbuf = empathy_pixbuf_from_icon_name (image->icon_name,
+							       GTK_ICON_SIZE_MENU);
+		if (image->pixbuf) {
+			g_object_set_data_full (G_OBJECT (image->pixbuf),
+						"smiley_str",
+						g_strdup (image->str), g_free);
+		}
+	}
+
+	return image->pixbuf;
+}
+
+static const gchar *
+smiley_image_get_path (EmpathySmileyImage *image)
+{
+	/* Remember failures too, this is checked for each hit */
+	if (!image->path_loaded) {
+		image->path = empathy_filename_from_icon_name (image->icon_name,
+							       GTK_ICON_SIZE_MENU);
+		image->path_loaded = TRUE;
+	}
+
+	return image->path;
+}
+
+static void
+smiley_image_unload_cb (gpointer key,
+			gpointer value,
+			gpointer user_data)
+{
+	smiley_image_unload (value);
+}
+
+static void
+smiley_manager_icon_theme_changed_cb (GtkIconTheme         *icon_theme,
+				      EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+
+	g_hash_table_foreach (priv->images, smiley_image_unload_cb, NULL);
 }
 
 static EmpathySmiley *
-smiley_new (GdkPixbuf *pixbuf, const gchar *str)
+smiley_new (EmpathySmileyImage *image, const gchar *str)
 {
 	EmpathySmiley *smiley;
 
 	smiley = g_slice_new0 (EmpathySmiley);
-	smiley->pixbuf = g_object_ref (pixbuf);
+	smiley->image = image;
 	smiley->str = g_strdup (str);
 
 	return smiley;
@@ -97,7 +296,6 @@ smiley_new (GdkPixbuf *pixbuf, const gchar *str)
 static void
 smiley_free (EmpathySmiley *smiley)
 {
-	g_object_unref (smiley->pixbuf);
 	g_free (smiley->str);
 	g_slice_free (EmpathySmiley, smiley);
 }
@@ -106,8 +304,23 @@ static void
 smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
+	guint                     i;
+
+	g_signal_handlers_disconnect_by_func (gtk_icon_theme_get_default (),
+					      smiley_manager_icon_theme_changed_cb,
+					      object);
+
+	smiley_automaton_free (priv->automaton);
+
+	for (i = 0; i < priv->patterns->len; i++) {
+		SmileyPattern *pattern = &g_array_index (priv->patterns,
+							 SmileyPattern, i);
+
+		g_free (pattern->str);
+	}
+	g_array_free (priv->patterns, TRUE);
+	g_hash_table_destroy (priv->images);
 
-	smiley_manager_tree_free (priv->tree);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -150,9 +363,15 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_array_new (FALSE, FALSE, sizeof (SmileyPattern));
+	priv->images = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					      (GDestroyNotify) smiley_image_free);
 	priv->smileys = NULL;
 
+	g_signal_connect (gtk_icon_theme_get_default (), "changed",
+			  G_CALLBACK (smiley_manager_icon_theme_changed_cb),
+			  manager);
+
 	empathy_smiley_manager_load (manager);
 }
 
@@ -162,102 +381,56 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
-{
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
-		}
-	}
-
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
-	}
-
-	return child;
-}
-
-static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
-
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
-	}
-
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
-}
-
 static void
 smiley_manager_add_valist (EmpathySmileyManager *manager,
-			   GdkPixbuf            *pixbuf,
-			   const gchar          *path,
+			   const gchar          *icon_name,
 			   const gchar          *first_str,
 			   va_list               var_args)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	EmpathySmileyImage       *image;
 	const gchar              *str;
 	EmpathySmiley            *smiley;
 
+	image = g_hash_table_lookup (priv->images, icon_name);
+	if (!image) {
+		image = smiley_image_new (icon_name, first_str);
+		g_hash_table_insert (priv->images, image->icon_name, image);
+	}
+
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		SmileyPattern pattern;
+
+		pattern.str = g_strdup (str);
+		pattern.image = image;
+		g_array_append_val (priv->patterns, pattern);
 	}
 
-	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
-				g_strdup (first_str), g_free);
-	smiley = smiley_new (pixbuf, first_str);
+	/* The automaton is compiled again the next time we parse a text */
+	smiley_automaton_free (priv->automaton);
+	priv->automaton = NULL;
+
+	smiley = smiley_new (image, first_str);
 	priv->smileys = g_slist_prepend (priv->smileys, smiley);
 }
 
+/* Only the strings and the icon name are kept here, the image is loaded
+ * the first time it is needed. */
 void
 empathy_smiley_manager_add (EmpathySmileyManager *manager,
 			    const gchar          *icon_name,
 			    const gchar          *first_str,
 			    ...)
 {
-	GdkPixbuf *pixbuf;
-	va_list    var_args;
+	va_list var_args;
 
 	g_return_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager));
 	g_return_if_fail (!EMP_STR_EMPTY (icon_name));
 	g_return_if_fail (!EMP_STR_EMPTY (first_str));
 
-	pixbuf = empathy_pixbuf_from_icon_name (icon_name, GTK_ICON_SIZE_MENU);
-	if (pixbuf) {
-		gchar *path;
-
-		va_start (var_args, first_str);
-		path = empathy_filename_from_icon_name (icon_name, GTK_ICON_SIZE_MENU);
-		smiley_manager_add_valist (manager, pixbuf, path, first_str, var_args);
-		va_end (var_args);
-		g_object_unref (pixbuf);
-		g_free (path);
-	}
+	va_start (var_args, first_str);
+	smiley_manager_add_valist (manager, icon_name, first_str, var_args);
+	va_end (var_args);
 }
 
 void
@@ -289,22 +462,6 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 	empathy_smiley_manager_add (manager, "face-worried",    ":-S",   ":S",   ":-s", ":s", NULL);
 }
 
-static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
-{
-	EmpathySmileyHit *hit;
-
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
-
-	return hit;
-}
-
 void
 empathy_smiley_hit_free (EmpathySmileyHit *hit)
 {
@@ -313,93 +470,128 @@ empathy_smiley_hit_free (EmpathySmileyHit *hit)
 	g_slice_free (EmpathySmileyHit, hit);
 }
 
-GSList *
-empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
-				  const gchar          *text,
-				  gssize                len)
+GdkPixbuf *
+empathy_smiley_hit_get_pixbuf (EmpathySmileyHit *hit)
+{
+	g_return_val_if_fail (hit != NULL, NULL);
+
+	return smiley_image_get_pixbuf (hit->image);
+}
+
+void
+empathy_smiley_manager_foreach_hit (EmpathySmileyManager *manager,
+				    const gchar          *text,
+				    gssize                len,
+				    EmpathySmileyHitFunc  func,
+				    gpointer              user_data)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
+	SmileyAutomaton          *automaton;
 	const gchar              *cur_str;
-	const gchar              *start = NULL;
+	const gchar              *end;
 
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
+	g_return_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager));
+	g_return_if_fail (text != NULL);
+	g_return_if_fail (func != NULL);
 
 	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
-		len = G_MAXSSIZE;
+		len = strlen (text);
 	}
 
 	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
+	 * is detected, func is called with a EmpathySmileyHit containing the
+	 * smiley image and the position of the text to be replaced by it.
+	 * The hit is only valid during the call.
+	 *
+	 * At each position we follow the automaton as far as it goes and keep
+	 * the longest smiley seen on the way. For example ">:)" and ":(" are
+	 * both valid smileys, when parsing text ">:(" we first follow '>' and
+	 * ':' then get stuck on '(' without having seen a smiley, so we look
+	 * again starting from ':' and find ":(". Smileys are only a few
+	 * characters long, so each character is looked at a bounded number
+	 * of times.
+	 *
+	 * cur_str is always at the begining of an UTF-8 character, because
+	 * we support unicode smileys! For example we could want to replace ™
+	 * by an image. */
+
+	automaton = smiley_manager_get_automaton (manager);
+	end = text + len;
+	cur_str = text;
+
+	while (cur_str < end && *cur_str != '\0') {
+		SmileyPattern *pattern = NULL;
+		const gchar   *p = cur_str;
+		const gchar   *match_end = NULL;
+		const gchar   *path = NULL;
+		guint          state = 0;
+		guint          match = 0;
+
+		while (p < end && *p != '\0') {
+			guint class;
+
+			class = smiley_automaton_get_class (automaton,
+							    g_utf8_get_char (p));
+			state = automaton->transitions[state * automaton->n_classes + class];
+			if (state == 0) {
+				break;
 			}
-			cur_tree = child;
-			continue;
-		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
+			p = g_utf8_next_char (p);
+			if (automaton->matches[state] != 0) {
+				match = automaton->matches[state];
+				match_end = p;
 			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
 		}
-	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+		if (match != 0) {
+			pattern = &g_array_index (priv->patterns, SmileyPattern,
+						  match - 1);
+			path = smiley_image_get_path (pattern->image);
+		}
+
+		/* Smileys whose image is missing from the theme are left
+		 * as text */
+		if (path != NULL) {
+			EmpathySmileyHit hit;
+
+			hit.image = pattern->image;
+			hit.path = path;
+			hit.start = cur_str - text;
+			hit.end = match_end - text;
+			func (manager, &hit, user_data);
+
+			cur_str = match_end;
+		} else {
+			cur_str = g_utf8_next_char (cur_str);
+		}
 	}
+}
+
+static void
+smiley_manager_parse_len_cb (EmpathySmileyManager *manager,
+			     EmpathySmileyHit     *hit,
+			     gpointer              user_data)
+{
+	GSList **hits = user_data;
+
+	*hits = g_slist_prepend (*hits, g_slice_dup (EmpathySmileyHit, hit));
+}
+
+GSList *
+empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
+				  const gchar          *text,
+				  gssize                len)
+{
+	GSList *hits = NULL;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
+	g_return_val_if_fail (text != NULL, NULL);
+
+	empathy_smiley_manager_foreach_hit (manager, text, len,
+					    smiley_manager_parse_len_cb,
+					    &hits);
 
 	return g_slist_reverse (hits);
 }
@@ -459,9 +651,15 @@ empathy_smiley_menu_new (EmpathySmileyManager *manager,
 		GtkWidget     *item;
 		GtkWidget     *image;
 		ActivateData  *data;
+		GdkPixbuf     *pixbuf;
 
 		smiley = l->data;
-		image = gtk_image_new_from_pixbuf (smiley->pixbuf);
+		pixbuf = smiley_image_get_pixbuf (smiley->image);
+		if (!pixbuf) {
+			continue;
+		}
+
+		image = gtk_image_new_from_pixbuf (pixbuf);
 
 		item = gtk_image_menu_item_new_with_label ("");
 		gtk_image_menu_item_set_image (GTK_IMAGE_MENU_ITEM (item), image);
@@ -47,22 +47,28 @@ struct _EmpathySmileyManagerClass {
 	GObjectClass parent_class;
 };
 
+typedef struct _EmpathySmileyImage EmpathySmileyImage;
+
 typedef struct {
-	GdkPixbuf   *pixbuf;
-	gchar       *str;
+	EmpathySmileyImage *image;
+	gchar              *str;
 } EmpathySmiley;
 
 typedef struct {
-	GdkPixbuf   *pixbuf; /* Pixbuf of the smiley */
-	const gchar *path;   /* Filename of the smiley image */
-	guint        start;  /* text[start:end] should be replaced by pixbuf */
-	guint        end;
+	EmpathySmileyImage *image;  /* Use empathy_smiley_hit_get_pixbuf() */
+	const gchar        *path;   /* Filename of the smiley image */
+	guint               start;  /* text[start:end] should be replaced by the image */
+	guint               end;
 } EmpathySmileyHit;
 
 typedef void (*EmpathySmileyMenuFunc) (EmpathySmileyManager *manager,
 				       EmpathySmiley        *smiley,
 				       gpointer              user_data);
 
+typedef void (*EmpathySmileyHitFunc) (EmpathySmileyManager *manager,
+				      EmpathySmileyHit     *hit,
+				      gpointer              user_data);
+
 GType                 empathy_smiley_manager_get_type        (void) G_GNUC_CONST;
 EmpathySmileyManager *empathy_smiley_manager_dup_singleton   (void);
 void                  empathy_smiley_manager_load            (EmpathySmileyManager *manager);
@@ -74,10 +80,16 @@ GSList *              empathy_smiley_manager_get_all         (EmpathySmileyManag
 GSList *              empathy_smiley_manager_parse_len       (EmpathySmileyManager *manager,
 							      const gchar          *text,
 							      gssize                len);
+void                  empathy_smiley_manager_foreach_hit     (EmpathySmileyManager *manager,
+							      const gchar          *text,
+							      gssize                len,
+							      EmpathySmileyHitFunc  func,
+							      gpointer              user_data);
 GtkWidget *           empathy_smiley_menu_new                (EmpathySmileyManager *manager,
 							      EmpathySmileyMenuFunc func,
 							      gpointer              user_data);
 void                  empathy_smiley_hit_free                (EmpathySmileyHit     *hit);
+GdkPixbuf *           empathy_smiley_hit_get_pixbuf          (EmpathySmileyHit     *hit);
 
 G_END_DECLS
 
@@ -56,6 +56,19 @@ uri_regex_dup_singleton (void)
 	return g_regex_ref (uri_regex);
 }
 
+static EmpathySmileyManager *
+smiley_manager_get_singleton (void)
+{
+	static EmpathySmileyManager *smiley_manager = NULL;
+
+	/* We intentionally leak the manager so its automaton is kept */
+	if (!smiley_manager) {
+		smiley_manager = empathy_smiley_manager_dup_singleton ();
+	}
+
+	return smiley_manager;
+}
+
 void
 empathy_string_parser_substr (const gchar *text,
 			      gssize len,
@@ -116,6 +129,36 @@ empathy_string_match_link (const gchar *text,
 	g_regex_unref (uri_regex);
 }
 
+typedef struct {
+	const gchar *text;
+	guint last;
+	EmpathyStringReplace replace_func;
+	EmpathyStringParser *sub_parsers;
+	gpointer user_data;
+} MatchSmileyData;
+
+static void
+match_smiley_hit_cb (EmpathySmileyManager *smiley_manager,
+		     EmpathySmileyHit *hit,
+		     gpointer user_data)
+{
+	MatchSmileyData *data = user_data;
+
+	if (hit->start > data->last) {
+		/* Append the text between last smiley (or the
+		 * start of the message) and this smiley */
+		empathy_string_parser_substr (data->text + data->last,
+					      hit->start - data->last,
+					      data->sub_parsers,
+					      data->user_data);
+	}
+
+	data->replace_func (data->text + hit->start, hit->end - hit->start,
+			    hit, data->user_data);
+
+	data->last = hit->end;
+}
+
 void
 empathy_string_match_smiley (const gchar *text,
 			     gssize len,
@@ -123,35 +166,17 @@ empathy_string_match_smiley (const gchar *text,
 			     EmpathyStringParser *sub_parsers,
 			     gpointer user_data)
 {
-	guint last = 0;
-	EmpathySmileyManager *smiley_manager;
-	GSList *hits, *l;
-
-	smiley_manager = empathy_smiley_manager_dup_singleton ();
-	hits = empathy_smiley_manager_parse_len (smiley_manager, text, len);
-
-	for (l = hits; l; l = l->next) {
-		EmpathySmileyHit *hit = l->data;
-
-		if (hit->start > last) {
-			/* Append the text between last smiley (or the
-			 * start of the message) and this smiley */
-			empathy_string_parser_substr (text + last,
-						      hit->start - last,
-						      sub_parsers, user_data);
-		}
+	MatchSmileyData data = { text, 0, replace_func, sub_parsers,
+				 user_data };
 
-		replace_func (text + hit->start, hit->end - hit->start,
-			      hit, user_data);
+	if (len < 0)
+		len = strlen (text);
 
-		last = hit->end;
+	empathy_smiley_manager_foreach_hit (smiley_manager_get_singleton (),
+					    text, len, match_smiley_hit_cb,
+					    &data);
 
-		empathy_smiley_hit_free (hit);
-	}
-	g_slist_free (hits);
-	g_object_unref (smiley_manager);
-
-	empathy_string_parser_substr (text + last, len - last,
+	empathy_string_parser_substr (text + data.last, len - data.last,
 				      sub_parsers, user_data);
 }
 
@@ -221,20 +246,212 @@ empathy_string_replace_escaped (const gchar *text,
 	g_free (escaped);
 }
 
+/* Same escaping as g_markup_escape_text(), but appending directly to string.
+ * '\r' are removed, and '\n' replaced by <br/> if newlines is TRUE. */
+static void
+string_append_escaped (GString *string,
+		       const gchar *text,
+		       gsize len,
+		       gboolean newlines)
+{
+	const gchar *end = text + len;
+	const gchar *p = text;
+
+	while (p < end) {
+		const gchar *next;
+		gunichar c;
+
+		switch (*p) {
+		case '&':
+			g_string_append (string, "&amp;");
+			p++;
+			continue;
+		case '<':
+			g_string_append (string, "&lt;");
+			p++;
+			continue;
+		case '>':
+			g_string_append (string, "&gt;");
+			p++;
+			continue;
+		case '\'':
+			g_string_append (string, "&apos;");
+			p++;
+			continue;
+		case '"':
+			g_string_append (string, "&quot;");
+			p++;
+			continue;
+		case '\r':
+			p++;
+			continue;
+		case '\n':
+			if (newlines)
+				g_string_append (string, "<br/>");
+			else
+				g_string_append_c (string, '\n');
+			p++;
+			continue;
+		}
+
+		if ((guchar) *p < 0x80) {
+			c = *p;
+			next = p + 1;
+		} else {
+			c = g_utf8_get_char (p);
+			next = MIN (g_utf8_next_char (p), end);
+		}
+
+		if ((0x1 <= c && c <= 0x8) ||
+		    (0xb <= c && c <= 0xc) ||
+		    (0xe <= c && c <= 0x1f) ||
+		    (0x7f <= c && c <= 0x84) ||
+		    (0x86 <= c && c <= 0x9f)) {
+			g_string_append_printf (string, "&#x%x;", c);
+		} else {
+			g_string_append_len (string, p, next - p);
+		}
+
+		p = next;
+	}
+}
+
+typedef struct {
+	GString *string;
+	const gchar *text;
+	guint last;
+	gboolean newlines;
+} AppendHtmlData;
+
+static void
+append_html_smiley_hit_cb (EmpathySmileyManager *smiley_manager,
+			   EmpathySmileyHit *hit,
+			   gpointer user_data)
+{
+	AppendHtmlData *data = user_data;
+
+	string_append_escaped (data->string, data->text + data->last,
+			       hit->start - data->last, data->newlines);
+
+	/* Replace smiley by a <img/> tag */
+	g_string_append_printf (data->string,
+		"<img src=\"%s\" alt=\"%.*s\" title=\"%.*s\"/>",
+		hit->path,
+		(int) (hit->end - hit->start), data->text + hit->start,
+		(int) (hit->end - hit->start), data->text + hit->start);
+
+	data->last = hit->end;
+}
+
+/* Append text between links, replacing smileys if we have a manager */
+static void
+string_append_html_text (GString *string,
+			 const gchar *text,
+			 gsize len,
+			 EmpathySmileyManager *smiley_manager,
+			 EmpathyStringHtmlFlags flags)
+{
+	AppendHtmlData data = { string, text, 0,
+				(flags & EMPATHY_STRING_HTML_NEWLINES) != 0 };
+
+	if (smiley_manager != NULL) {
+		empathy_smiley_manager_foreach_hit (smiley_manager, text, len,
+						    append_html_smiley_hit_cb,
+						    &data);
+	}
+
+	string_append_escaped (string, text + data.last, len - data.last,
+			       data.newlines);
+}
+
+/**
+ * empathy_string_append_html:
+ * @string: the #GString to append to
+ * @text: the text to parse
+ * @len: length of @text in bytes, or -1 if it is nul-terminated
+ * @flags: #EmpathyStringHtmlFlags
+ *
+ * Appends @text to @string as HTML, with links replaced by
+ * <a href=""></a> tags and, depending on @flags, smileys replaced by
+ * <img/> tags and new lines by <br/>. The rest of the text is escaped.
+ *
+ * This produces the same output as empathy_string_parser_substr() with
+ * the link, smiley, newline and escaping parsers, but links, smileys and
+ * plain text are handled in a single pass writing straight into @string.
+ */
+void
+empathy_string_append_html (GString *string,
+			    const gchar *text,
+			    gssize len,
+			    EmpathyStringHtmlFlags flags)
+{
+	EmpathySmileyManager *smiley_manager = NULL;
+	GRegex     *uri_regex;
+	GMatchInfo *match_info = NULL;
+	gsize       old_len;
+	gint        last = 0;
+
+	g_return_if_fail (string != NULL);
+	g_return_if_fail (text != NULL);
+
+	if (len < 0)
+		len = strlen (text);
+
+	/* Make room for the text and a bit of markup at once */
+	old_len = string->len;
+	g_string_set_size (string, old_len + len + len / 4);
+	g_string_truncate (string, old_len);
+
+	if (flags & EMPATHY_STRING_HTML_SMILEYS)
+		smiley_manager = smiley_manager_get_singleton ();
+
+	uri_regex = uri_regex_dup_singleton ();
+	if (uri_regex != NULL &&
+	    g_regex_match_full (uri_regex, text, len, 0, 0, &match_info, NULL)) {
+		gint s = 0, e = 0;
+
+		do {
+			gchar *real_url;
+
+			g_match_info_fetch_pos (match_info, 0, &s, &e);
+
+			/* Append the text between last link (or the
+			 * start of the message) and this link */
+			string_append_html_text (string, text + last, s - last,
+						 smiley_manager, flags);
+
+			/* Append the link inside <a href=""></a> tag */
+			real_url = empathy_make_absolute_url_len (text + s, e - s);
+			g_string_append (string, "<a href=\"");
+			string_append_escaped (string, real_url,
+					       strlen (real_url), FALSE);
+			g_string_append (string, "\">");
+			string_append_escaped (string, text + s, e - s, FALSE);
+			g_string_append (string, "</a>");
+			g_free (real_url);
+
+			last = e;
+		} while (g_match_info_next (match_info, NULL));
+	}
+
+	string_append_html_text (string, text + last, len - last,
+				 smiley_manager, flags);
+
+	if (match_info != NULL)
+		g_match_info_free (match_info);
+	if (uri_regex != NULL)
+		g_regex_unref (uri_regex);
+}
+
 gchar *
 empathy_add_link_markup (const gchar *text)
 {
-	EmpathyStringParser parsers[] = {
-		{empathy_string_match_link, empathy_string_replace_link},
-		{empathy_string_match_all, empathy_string_replace_escaped},
-		{NULL, NULL}
-	};
 	GString *string;
 
 	g_return_val_if_fail (text != NULL, NULL);
 
 	string = g_string_sized_new (strlen (text));
-	empathy_string_parser_substr (text, -1, parsers, string);
+	empathy_string_append_html (string, text, -1, 0);
 
 	return g_string_free (string, FALSE);
 }
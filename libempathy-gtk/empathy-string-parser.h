@@ -82,6 +82,17 @@ empathy_string_replace_escaped (const gchar *text,
 				gpointer match_data,
 				gpointer user_data);
 
+typedef enum {
+	EMPATHY_STRING_HTML_SMILEYS = 1 << 0,
+	EMPATHY_STRING_HTML_NEWLINES = 1 << 1,
+} EmpathyStringHtmlFlags;
+
+void
+empathy_string_append_html (GString *string,
+			    const gchar *text,
+			    gssize len,
+			    EmpathyStringHtmlFlags flags);
+
 /* Returns a new string with <a> html tag around links, and escape the rest.
  * To be used with gtk_label_set_markup() for example */
 gchar *
@@ -52,6 +52,10 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Number of message blocks allowed over the scrollback limit, so old
+ * blocks are removed from the DOM in batches rather than one at a time */
+#define SCROLLBACK_EVICT_BATCH 100
+
 typedef struct {
 	EmpathyAdiumData     *data;
 	EmpathySmileyManager *smiley_manager;
@@ -74,42 +78,106 @@ typedef struct {
 	gboolean              allow_scrolling;
 	gchar                *variant;
 	gboolean              in_construction;
+	/* Script of the messages appended since the outermost
+	 * theme_adium_begin_batch(), NULL if not batching */
+	guint                 batch_depth;
+	GString              *batch_script;
+	/* Maximum number of message blocks in #Chat, 0 for no limit */
+	guint                 scrollback_limit;
+	/* ThemeAdiumBlock for each top-level block in #Chat, oldest first */
+	GArray               *blocks;
+	/* Id given to the next block, see ThemeAdiumBlock */
+	guint                 next_block_id;
+	/* Timestamp of the oldest message displayed if older ones were
+	 * removed, 0 if there is nothing more to show from the logs */
+	gint64                evicted_before;
+	gboolean              history_requested;
+	GtkAdjustment        *vadjustment;
 } EmpathyThemeAdiumPriv;
 
+typedef struct {
+	/* The first message of the block has the class
+	 * "x-empathy-block-<id>", to find where it starts in the DOM */
+	guint      id;
+	/* Timestamp of the first message of the block */
+	gint64     timestamp;
+	/* Owned EmpathyMessage of the block sent at that very timestamp, NULL
+	 * for events. Used to recognize them when older messages asked from
+	 * the logs include that second. */
+	GPtrArray *head;
+} ThemeAdiumBlock;
+
+/* Keywords a message template can contain, see
+ * http://trac.adium.im/wiki/CreatingMessageStyles */
+typedef enum {
+	ADIUM_SEGMENT_LITERAL,
+	ADIUM_SEGMENT_USER_ICON_PATH,
+	ADIUM_SEGMENT_SENDER_SCREEN_NAME,
+	ADIUM_SEGMENT_SENDER,
+	ADIUM_SEGMENT_SENDER_COLOR,
+	ADIUM_SEGMENT_MESSAGE,
+	ADIUM_SEGMENT_TIME,
+	ADIUM_SEGMENT_SHORT_TIME,
+	ADIUM_SEGMENT_SERVICE,
+	ADIUM_SEGMENT_MESSAGE_CLASSES,
+} AdiumSegmentType;
+
+typedef struct {
+	AdiumSegmentType type;
+	/* LITERAL: the text, already escaped for a javascript string.
+	 * TIME: the strftime format, or NULL for the default one. */
+	gchar *str;
+	gsize len;
+} AdiumSegment;
+
+typedef struct {
+	/* AdiumSegment in template order */
+	GArray *segments;
+	/* Sum of literal lengths, used to preallocate the script */
+	gsize literal_len;
+} AdiumTemplate;
+
 struct _EmpathyAdiumData {
 	gint  ref_count;
 	gchar *path;
 	gchar *basedir;
+	gchar *basedir_uri;
 	gchar *default_avatar_filename;
 	gchar *default_incoming_avatar_filename;
 	gchar *default_outgoing_avatar_filename;
 	GHashTable *info;
 	guint version;
 	gboolean custom_template;
-	/* gchar* -> gchar* both owned */
-	GHashTable *date_format_cache;
 
 	/* HTML bits */
 	const gchar *template_html;
-	const gchar *content_html;
-	const gchar *in_content_html;
-	const gchar *in_context_html;
-	const gchar *in_nextcontent_html;
-	const gchar *in_nextcontext_html;
-	const gchar *out_content_html;
-	const gchar *out_context_html;
-	const gchar *out_nextcontent_html;
-	const gchar *out_nextcontext_html;
-	const gchar *status_html;
-
-	/* Above html strings are pointers to strings stored in this array.
-	 * We do this because of fallbacks, some htmls could be pointing the
-	 * same string. */
+	/* variant path -> template_html formatted for that variant, both owned.
+	 * Shared by all views using this data, only used in the main thread
+	 * once the data is loaded. */
+	GHashTable *pages;
+
+	/* Message templates, compiled once when the theme is loaded */
+	AdiumTemplate *content;
+	AdiumTemplate *in_content;
+	AdiumTemplate *in_context;
+	AdiumTemplate *in_nextcontent;
+	AdiumTemplate *in_nextcontext;
+	AdiumTemplate *out_content;
+	AdiumTemplate *out_context;
+	AdiumTemplate *out_nextcontent;
+	AdiumTemplate *out_nextcontext;
+	AdiumTemplate *status;
+
+	/* Above html string and templates are pointers to items stored in
+	 * these arrays. We do this because of fallbacks, some templates could
+	 * be pointing the same item. */
 	GPtrArray *strings_to_free;
+	GPtrArray *templates_to_free;
 };
 
 static void theme_adium_iface_init (EmpathyChatViewIface *iface);
 static gchar * adium_info_dup_path_for_variant (GHashTable *info, const gchar *variant);
+static const gchar * adium_data_get_page (EmpathyAdiumData *data, const gchar *variant);
 
 enum {
 	PROP_0,
@@ -117,6 +185,30 @@ enum {
 	PROP_VARIANT,
 };
 
+enum {
+	HISTORY_REQUESTED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* Template.html only knows how to append messages. This inserts a message
+ * block above the others, keeping what the user is looking at in place.
+ * Insertion points are dropped, they must stay in the last block. */
+static const gchar *prepend_function =
+	"window.empathyPrependHTML = function (html) {"
+	"  var chat = document.getElementById ('Chat');"
+	"  var range = document.createRange ();"
+	"  range.selectNode (chat);"
+	"  var fragment = range.createContextualFragment (html);"
+	"  var inserts = fragment.querySelectorAll ('#insert');"
+	"  for (var i = 0; i < inserts.length; i++)"
+	"    inserts[i].parentNode.removeChild (inserts[i]);"
+	"  var height = document.body.scrollHeight;"
+	"  chat.insertBefore (fragment, chat.firstChild);"
+	"  window.scrollBy (0, document.body.scrollHeight - height);"
+	"};";
+
 G_DEFINE_TYPE_WITH_CODE (EmpathyThemeAdium, empathy_theme_adium,
 			 WEBKIT_TYPE_WEB_VIEW,
 			 G_IMPLEMENT_INTERFACE (EMPATHY_TYPE_CHAT_VIEW,
@@ -242,25 +334,48 @@ string_with_format (const gchar *format,
 	return g_string_free (result, FALSE);
 }
 
+static void
+theme_adium_remove_blocks (EmpathyThemeAdiumPriv *priv,
+			   guint                  n)
+{
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		ThemeAdiumBlock *block;
+
+		block = &g_array_index (priv->blocks, ThemeAdiumBlock, i);
+		if (block->head != NULL) {
+			g_ptr_array_unref (block->head);
+		}
+	}
+
+	g_array_remove_range (priv->blocks, 0, n);
+}
+
 static void
 theme_adium_load_template (EmpathyThemeAdium *theme)
 {
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
-	gchar                 *basedir_uri;
-	gchar                 *variant_path;
-	gchar                 *template;
+
+	/* Anything batched so far was meant for the page we are replacing */
+	if (priv->batch_script != NULL) {
+		g_string_truncate (priv->batch_script, 0);
+	}
+
+	theme_adium_remove_blocks (priv, priv->blocks->len);
+	priv->evicted_before = 0;
+	priv->history_requested = FALSE;
+
+	/* The page will be loaded by empathy_theme_adium_set_data () */
+	if (priv->data == NULL) {
+		return;
+	}
 
 	priv->pages_loading++;
-	basedir_uri = g_strconcat ("file://", priv->data->basedir, NULL);
-	variant_path = adium_info_dup_path_for_variant (priv->data->info,
-		priv->variant);
-	template = string_with_format (priv->data->template_html,
-		variant_path, NULL);
+
 	webkit_web_view_load_html_string (WEBKIT_WEB_VIEW (theme),
-					  template, basedir_uri);
-	g_free (basedir_uri);
-	g_free (variant_path);
-	g_free (template);
+		adium_data_get_page (priv->data, priv->variant),
+		priv->data->basedir_uri);
 }
 
 static gchar *
@@ -269,18 +384,20 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 	const gchar *token)
 {
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (self);
-	EmpathyStringParser *parsers;
+	EmpathyStringHtmlFlags flags = EMPATHY_STRING_HTML_NEWLINES;
 	GString *string;
 
 	/* Check if we have to parse smileys */
-	parsers = empathy_webkit_get_string_parser (
-		g_settings_get_boolean (priv->gsettings_chat,
-			EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
+	if (g_settings_get_boolean (priv->gsettings_chat,
+			EMPATHY_PREFS_CHAT_SHOW_SMILEYS))
+		flags |= EMPATHY_STRING_HTML_SMILEYS;
 
-	/* Parse text and construct string with links and smileys replaced
-	 * by html tags. Also escape text to make sure html code is
-	 * displayed verbatim. */
-	string = g_string_sized_new (strlen (text));
+	string = g_string_sized_new (strlen (text) + 128);
+
+	/* Wrap body in order to make tabs and multiple spaces displayed
+	 * properly. See bug #625745. */
+	g_string_append (string, "<div style=\"display: inline; "
+					       "white-space: pre-wrap\"'>");
 
 	/* wrap this in HTML that allows us to find the message for later
 	 * editing */
@@ -289,15 +406,14 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
 			"<span id=\"message-token-%s\">",
 			token);
 
-	empathy_string_parser_substr (text, -1, parsers, string);
+	/* Parse text and construct string with links and smileys replaced
+	 * by html tags. Also escape text to make sure html code is
+	 * displayed verbatim. */
+	empathy_string_append_html (string, text, -1, flags);
 
 	if (!tp_str_empty (token))
 		g_string_append (string, "</span>");
 
-	/* Wrap body in order to make tabs and multiple spaces displayed
-	 * properly. See bug #625745. */
-	g_string_prepend (string, "<div style=\"display: inline; "
-					       "white-space: pre-wrap\"'>");
 	g_string_append (string, "</div>");
 
 	return g_string_free (string, FALSE);
@@ -394,8 +510,8 @@ static gchar *colors[] = {
 	"yellowgreen",
 };
 
-static const gchar *
-nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
+static gchar *
+nsdate_to_strftime (const gchar *nsdate)
 {
 	/* Convert from NSDateFormatter (http://www.stepcase.com/blog/2008/12/02/format-string-for-the-iphone-nsdateformatter/)
 	 * to strftime supported by g_date_time_format.
@@ -484,7 +600,6 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 		"z", NULL, // (Specific GMT Timezone Abbreviation)
 		"Z", "%z", // +0000 (RFC 822 Timezone)
 	};
-	const gchar *str;
 	GString *string;
 	guint i, j;
 
@@ -492,11 +607,6 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 		return NULL;
 	}
 
-	str = g_hash_table_lookup (data->date_format_cache, nsdate);
-	if (str != NULL) {
-		return str;
-	}
-
 	/* Copy nsdate into string, replacing occurences of NSDateFormatter tags
 	 * by corresponding strftime tag. */
 	string = g_string_sized_new (strlen (nsdate));
@@ -522,65 +632,97 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
 		}
 	}
 
-	DEBUG ("Date format converted '%s' → '%s'", nsdate, string->str);
-
-	/* The cache takes ownership of string->str */
-	g_hash_table_insert (data->date_format_cache, g_strdup (nsdate), string->str);
 	return g_string_free (string, FALSE);
 }
 
+static void
+adium_template_add_segment (AdiumTemplate *tmpl,
+			    GString *literal,
+			    AdiumSegmentType type,
+			    gchar *str)
+{
+	AdiumSegment segment;
+
+	/* Flush pending literal text first */
+	if (literal->len > 0) {
+		segment.type = ADIUM_SEGMENT_LITERAL;
+		segment.len = literal->len;
+		segment.str = g_strndup (literal->str, literal->len);
+		g_array_append_val (tmpl->segments, segment);
+
+		tmpl->literal_len += literal->len;
+		g_string_truncate (literal, 0);
+	}
+
+	if (type == ADIUM_SEGMENT_LITERAL) {
+		g_free (str);
+		return;
+	}
+
+	segment.type = type;
+	segment.str = str;
+	segment.len = 0;
+	g_array_append_val (tmpl->segments, segment);
+}
 
 static void
-theme_adium_append_html (EmpathyThemeAdium *theme,
-			 const gchar       *func,
-			 const gchar       *html,
-		         const gchar       *message,
-		         const gchar       *avatar_filename,
-		         const gchar       *name,
-		         const gchar       *contact_id,
-		         const gchar       *service_name,
-		         const gchar       *message_classes,
-		         gint64             timestamp,
-		         gboolean           is_backlog,
-		         gboolean           outgoing)
+adium_template_free (AdiumTemplate *tmpl)
 {
-	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
-	GString     *string;
-	const gchar *cur = NULL;
-	gchar       *script;
+	guint i;
+
+	for (i = 0; i < tmpl->segments->len; i++) {
+		g_free (g_array_index (tmpl->segments, AdiumSegment, i).str);
+	}
+	g_array_free (tmpl->segments, TRUE);
+
+	g_slice_free (AdiumTemplate, tmpl);
+}
+
+/* Split html into literal segments and keywords needing replacement, so
+ * theme_adium_append_html() doesn't have to parse it for each message */
+static AdiumTemplate *
+adium_template_compile (const gchar *html)
+{
+	AdiumTemplate *tmpl;
+	GString       *literal;
+	const gchar   *cur;
+
+	if (html == NULL) {
+		return NULL;
+	}
+
+	tmpl = g_slice_new0 (AdiumTemplate);
+	tmpl->segments = g_array_new (FALSE, FALSE, sizeof (AdiumSegment));
+	literal = g_string_sized_new (strlen (html));
 
-	/* Make some search-and-replace in the html code */
-	string = g_string_sized_new (strlen (html) + strlen (message));
-	g_string_append_printf (string, "%s(\"", func);
 	for (cur = html; *cur != '\0'; cur++) {
-		const gchar *replace = NULL;
-		gchar       *dup_replace = NULL;
-		gchar       *format = NULL;
+		gchar *format = NULL;
+
+		if (*cur != '%') {
+			escape_and_append_len (literal, cur, 1);
+			continue;
+		}
 
 		/* Those are all well known keywords that needs replacement in
 		 * html files. Please keep them in the same order than the adium
 		 * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
 		if (theme_adium_match (&cur, "%userIconPath%")) {
-			replace = avatar_filename;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_USER_ICON_PATH, NULL);
 		} else if (theme_adium_match (&cur, "%senderScreenName%")) {
-			replace = contact_id;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SENDER_SCREEN_NAME, NULL);
 		} else if (theme_adium_match (&cur, "%sender%")) {
-			replace = name;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SENDER, NULL);
 		} else if (theme_adium_match (&cur, "%senderColor%")) {
 			/* A color derived from the user's name.
 			 * FIXME: If a colon separated list of HTML colors is at
 			 * Incoming/SenderColors.txt it will be used instead of
 			 * the default colors.
 			 */
-
-			/* Ensure we always use the same color when sending messages
-			 * (bgo #658821) */
-			if (outgoing) {
-				replace = "inherit";
-			} else if (contact_id != NULL) {
-				guint hash = g_str_hash (contact_id);
-				replace = colors[hash % G_N_ELEMENTS (colors)];
-			}
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SENDER_COLOR, NULL);
 		} else if (theme_adium_match (&cur, "%senderStatusIcon%")) {
 			/* FIXME: The path to the status icon of the sender
 			 * (available, away, etc...)
@@ -596,7 +738,8 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 			 *  We don't have access to that yet so we use
 			 * local alias instead.
 			 */
-			replace = name;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SENDER, NULL);
 		} else if (theme_adium_match_with_format (&cur, "%textbackgroundcolor{", &format)) {
 			/* FIXME: This keyword is used to represent the
 			 * highlight background color. "X" is the opacity of the
@@ -604,28 +747,18 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 			 * between.
 			 */
 		} else if (theme_adium_match (&cur, "%message%")) {
-			replace = message;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_MESSAGE, NULL);
 		} else if (theme_adium_match (&cur, "%time%") ||
 			   theme_adium_match_with_format (&cur, "%time{", &format)) {
-			const gchar *strftime_format;
-
-			strftime_format = nsdate_to_strftime (priv->data, format);
-			if (is_backlog) {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					strftime_format ? strftime_format :
-					EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
-			} else {
-				dup_replace = empathy_time_to_string_local (timestamp,
-					strftime_format ? strftime_format :
-					EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			}
-			replace = dup_replace;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_TIME, nsdate_to_strftime (format));
 		} else if (theme_adium_match (&cur, "%shortTime%")) {
-			dup_replace = empathy_time_to_string_local (timestamp,
-				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
-			replace = dup_replace;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SHORT_TIME, NULL);
 		} else if (theme_adium_match (&cur, "%service%")) {
-			replace = service_name;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_SERVICE, NULL);
 		} else if (theme_adium_match (&cur, "%variant%")) {
 			/* FIXME: The name of the active message style variant,
 			 * with all spaces replaced with an underscore.
@@ -635,9 +768,10 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 		} else if (theme_adium_match (&cur, "%userIcons%")) {
 			/* FIXME: mus t be "hideIcons" if use preference is set
 			 * to hide avatars */
-			replace = "showIcons";
+			escape_and_append_len (literal, "showIcons", -1);
 		} else if (theme_adium_match (&cur, "%messageClasses%")) {
-			replace = message_classes;
+			adium_template_add_segment (tmpl, literal,
+				ADIUM_SEGMENT_MESSAGE_CLASSES, NULL);
 		} else if (theme_adium_match (&cur, "%status%")) {
 			/* FIXME: A description of the status event. This is
 			 * neither in the user's local language nor expected to
@@ -666,15 +800,112 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 			 *	fileTransferCompleted
 			 */
 		} else {
-			escape_and_append_len (string, cur, 1);
+			escape_and_append_len (literal, cur, 1);
+		}
+
+		g_free (format);
+	}
+
+	/* Flush trailing literal text */
+	adium_template_add_segment (tmpl, literal, ADIUM_SEGMENT_LITERAL, NULL);
+	g_string_free (literal, TRUE);
+
+	return tmpl;
+}
+
+
+static void
+theme_adium_append_html (EmpathyThemeAdium *theme,
+			 const gchar       *func,
+			 AdiumTemplate     *tmpl,
+		         const gchar       *message,
+		         const gchar       *avatar_filename,
+		         const gchar       *name,
+		         const gchar       *contact_id,
+		         const gchar       *service_name,
+		         const gchar       *message_classes,
+		         gint64             timestamp,
+		         gboolean           is_backlog,
+		         gboolean           outgoing)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	GString     *string;
+	gchar       *script;
+	guint        i;
+
+	if (priv->batch_script != NULL) {
+		/* The template goes straight in the batch; shouldScroll is
+		 * defined by theme_adium_flush_batch() */
+		string = priv->batch_script;
+	} else {
+		string = g_string_sized_new (tmpl->literal_len + strlen (message) + 64);
+	}
+
+	/* Fill the compiled template's keywords */
+	g_string_append_printf (string, "%s(\"", func);
+	for (i = 0; i < tmpl->segments->len; i++) {
+		AdiumSegment *segment = &g_array_index (tmpl->segments,
+			AdiumSegment, i);
+		const gchar  *replace = NULL;
+		gchar        *dup_replace = NULL;
+
+		switch (segment->type) {
+		case ADIUM_SEGMENT_LITERAL:
+			g_string_append_len (string, segment->str, segment->len);
 			continue;
+		case ADIUM_SEGMENT_USER_ICON_PATH:
+			replace = avatar_filename;
+			break;
+		case ADIUM_SEGMENT_SENDER_SCREEN_NAME:
+			replace = contact_id;
+			break;
+		case ADIUM_SEGMENT_SENDER:
+			replace = name;
+			break;
+		case ADIUM_SEGMENT_SENDER_COLOR:
+			/* Ensure we always use the same color when sending messages
+			 * (bgo #658821) */
+			if (outgoing) {
+				replace = "inherit";
+			} else if (contact_id != NULL) {
+				guint hash = g_str_hash (contact_id);
+				replace = colors[hash % G_N_ELEMENTS (colors)];
+			}
+			break;
+		case ADIUM_SEGMENT_MESSAGE:
+			replace = message;
+			break;
+		case ADIUM_SEGMENT_TIME:
+			if (is_backlog) {
+				dup_replace = empathy_time_to_string_local (timestamp,
+					segment->str ? segment->str :
+					EMPATHY_TIME_DATE_FORMAT_DISPLAY_SHORT);
+			} else {
+				dup_replace = empathy_time_to_string_local (timestamp,
+					segment->str ? segment->str :
+					EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			}
+			replace = dup_replace;
+			break;
+		case ADIUM_SEGMENT_SHORT_TIME:
+			dup_replace = empathy_time_to_string_local (timestamp,
+				EMPATHY_TIME_FORMAT_DISPLAY_SHORT);
+			replace = dup_replace;
+			break;
+		case ADIUM_SEGMENT_SERVICE:
+			replace = service_name;
+			break;
+		case ADIUM_SEGMENT_MESSAGE_CLASSES:
+			replace = message_classes;
+			break;
 		}
 
-		/* Here we have a replacement to make */
 		escape_and_append_len (string, replace, -1);
-
 		g_free (dup_replace);
-		g_free (format);
+	}
+	if (priv->batch_script != NULL) {
+		g_string_append (string, "\", shouldScroll);");
+		return;
 	}
 	g_string_append (string, "\")");
 
@@ -683,17 +914,247 @@ theme_adium_append_html (EmpathyThemeAdium *theme,
 	g_free (script);
 }
 
+/* Run the batched script at once so the DOM gets a single insertion and a
+ * single scroll, whatever the number of messages. Template.html coalesces
+ * appended messages for 25ms, so they are flushed before scrolling to them. */
+static void
+theme_adium_flush_batch (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	gchar *script;
+
+	if (priv->batch_script == NULL || priv->batch_script->len == 0) {
+		return;
+	}
+
+	script = g_strdup_printf ("(function () {"
+				  "var shouldScroll = %s;"
+				  "%s"
+				  "if (typeof coalescedHTML != 'undefined')"
+				  "  coalescedHTML.cancel ();"
+				  "alignChat (shouldScroll);"
+				  "}) ();",
+				  priv->allow_scrolling ? "nearBottom ()" : "false",
+				  priv->batch_script->str);
+	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme), script);
+	g_free (script);
+
+	g_string_truncate (priv->batch_script, 0);
+}
+
+static gboolean
+theme_adium_is_at_bottom (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	gdouble page_size;
+
+	if (priv->vadjustment == NULL) {
+		return TRUE;
+	}
+
+	/* Same margin as nearBottom () in Template.html */
+	page_size = gtk_adjustment_get_page_size (priv->vadjustment);
+	return gtk_adjustment_get_value (priv->vadjustment) + page_size * 1.2 >=
+		gtk_adjustment_get_upper (priv->vadjustment);
+}
+
+/* Remove the oldest message blocks from #Chat once there are
+ * SCROLLBACK_EVICT_BATCH more than the scrollback limit. Themes may insert
+ * any number of top-level nodes per message, so everything before the node
+ * holding the first block to keep is removed. */
+static void
+theme_adium_maybe_evict (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	WebKitDOMDocument *dom;
+	WebKitDOMElement *chat;
+	WebKitDOMElement *element;
+	WebKitDOMNode *keep, *parent;
+	ThemeAdiumBlock *block;
+	gchar *selector;
+	guint n, removed = 0;
+	GError *error = NULL;
+
+	if (priv->scrollback_limit == 0 || priv->batch_script != NULL ||
+	    priv->blocks->len < priv->scrollback_limit + SCROLLBACK_EVICT_BATCH) {
+		return;
+	}
+
+	/* Don't remove messages the user scrolled back to read, wait until
+	 * they are at the bottom again */
+	if (!theme_adium_is_at_bottom (theme)) {
+		return;
+	}
+
+	dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (theme));
+	if (dom == NULL) {
+		return;
+	}
+
+	chat = webkit_dom_document_get_element_by_id (dom, "Chat");
+	if (chat == NULL) {
+		DEBUG ("No Chat element, can't remove old messages");
+		return;
+	}
+
+	/* Messages coalesced by Template.html are not in the DOM yet */
+	webkit_web_view_execute_script (WEBKIT_WEB_VIEW (theme),
+		"if (typeof coalescedHTML != 'undefined') coalescedHTML.cancel ();");
+
+	n = priv->blocks->len - priv->scrollback_limit;
+	block = &g_array_index (priv->blocks, ThemeAdiumBlock, n);
+	selector = g_strdup_printf (".x-empathy-block-%u", block->id);
+	element = webkit_dom_document_query_selector (dom, selector, &error);
+	g_free (selector);
+
+	if (element == NULL) {
+		/* The theme doesn't use %messageClasses% */
+		DEBUG ("Can't find message block %u, not removing old "
+		       "messages: %s", block->id,
+		       error ? error->message : "No error");
+		g_clear_error (&error);
+		return;
+	}
+
+	/* Find the child of #Chat holding the block */
+	keep = WEBKIT_DOM_NODE (element);
+	parent = webkit_dom_node_get_parent_node (keep);
+	while (parent != NULL && parent != WEBKIT_DOM_NODE (chat)) {
+		keep = parent;
+		parent = webkit_dom_node_get_parent_node (keep);
+	}
+
+	if (parent == NULL) {
+		DEBUG ("Message block %u is not in Chat", block->id);
+		return;
+	}
+
+	while (TRUE) {
+		WebKitDOMNode *child;
+
+		child = webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (chat));
+		if (child == NULL || child == keep) {
+			break;
+		}
+
+		webkit_dom_node_remove_child (WEBKIT_DOM_NODE (chat), child,
+					      &error);
+		if (error != NULL) {
+			DEBUG ("Error removing old message: %s", error->message);
+			g_clear_error (&error);
+			break;
+		}
+
+		removed++;
+	}
+
+	DEBUG ("Removed %u old nodes", removed);
+
+	if (webkit_dom_node_get_first_child (WEBKIT_DOM_NODE (chat)) != keep) {
+		/* Some older blocks are still there, try again later */
+		return;
+	}
+
+	theme_adium_remove_blocks (priv, n);
+	priv->evicted_before = g_array_index (priv->blocks, ThemeAdiumBlock,
+					      0).timestamp;
+	priv->history_requested = FALSE;
+}
+
+static ThemeAdiumBlock
+theme_adium_block_new (EmpathyThemeAdiumPriv *priv,
+		       gint64                 timestamp,
+		       EmpathyMessage        *msg)
+{
+	ThemeAdiumBlock block = { priv->next_block_id++, timestamp, NULL };
+
+	if (msg != NULL) {
+		block.head = g_ptr_array_new_with_free_func (g_object_unref);
+		g_ptr_array_add (block.head, g_object_ref (msg));
+	}
+
+	return block;
+}
+
+static void
+theme_adium_add_block (EmpathyThemeAdium *theme,
+		       gint64             timestamp,
+		       EmpathyMessage    *msg)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	ThemeAdiumBlock block = theme_adium_block_new (priv, timestamp, msg);
+
+	g_array_append_val (priv->blocks, block);
+	theme_adium_maybe_evict (theme);
+}
+
+/* Adds @msg, joined with the last block, to its head if it was sent at the
+ * same time as the block's first message */
+static void
+theme_adium_join_last_block (EmpathyThemeAdium *theme,
+			     gint64             timestamp,
+			     EmpathyMessage    *msg)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	ThemeAdiumBlock *block;
+
+	if (priv->blocks->len == 0) {
+		return;
+	}
+
+	block = &g_array_index (priv->blocks, ThemeAdiumBlock,
+				priv->blocks->len - 1);
+	if (block->timestamp == timestamp && block->head != NULL) {
+		g_ptr_array_add (block->head, g_object_ref (msg));
+	}
+}
+
+static void
+theme_adium_begin_batch (EmpathyChatView *view)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	if (priv->batch_depth++ == 0) {
+		priv->batch_script = g_string_sized_new (4096);
+	}
+}
+
+static void
+theme_adium_end_batch (EmpathyChatView *view)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	g_return_if_fail (priv->batch_depth > 0);
+
+	if (--priv->batch_depth > 0) {
+		return;
+	}
+
+	theme_adium_flush_batch (EMPATHY_THEME_ADIUM (view));
+	g_string_free (priv->batch_script, TRUE);
+	priv->batch_script = NULL;
+
+	theme_adium_maybe_evict (EMPATHY_THEME_ADIUM (view));
+}
+
 static void
 theme_adium_append_event_escaped (EmpathyChatView *view,
 				  const gchar     *escaped)
 {
 	EmpathyThemeAdium     *theme = EMPATHY_THEME_ADIUM (view);
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
-
-	theme_adium_append_html (theme, "appendMessage",
-				 priv->data->status_html, escaped, NULL, NULL, NULL,
-				 NULL, "event",
-				 empathy_time_get_current (), FALSE, FALSE);
+	gint64                 timestamp = empathy_time_get_current ();
+	gchar                 *classes;
+
+	classes = g_strdup_printf ("event x-empathy-block-%u",
+				   priv->next_block_id);
+	theme_adium_append_html (theme,
+				 priv->batch_script != NULL ?
+					"appendMessageNoScroll" : "appendMessage",
+				 priv->data->status, escaped, NULL, NULL, NULL,
+				 NULL, classes, timestamp, FALSE, FALSE);
+	theme_adium_add_block (theme, timestamp, NULL);
+	g_free (classes);
 
 	/* There is no last contact */
 	if (priv->last_contact) {
@@ -756,6 +1217,9 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *theme)
 
 	priv->has_unread_message = FALSE;
 
+	/* Batched messages must be in the DOM to lose their marks */
+	theme_adium_flush_batch (theme);
+
 	dom = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (theme));
 	if (dom == NULL) {
 		return;
@@ -773,11 +1237,12 @@ theme_adium_remove_all_focus_marks (EmpathyThemeAdium *theme)
 	theme_adium_remove_focus_marks (theme, nodes);
 }
 
+/* If prepend is TRUE, msg is an old message displayed above the others */
 static void
-theme_adium_append_message (EmpathyChatView *view,
-			    EmpathyMessage  *msg)
+theme_adium_add_message (EmpathyThemeAdium *theme,
+			 EmpathyMessage    *msg,
+			 gboolean           prepend)
 {
-	EmpathyThemeAdium     *theme = EMPATHY_THEME_ADIUM (view);
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 	EmpathyContact        *sender;
 	TpMessage             *tp_msg;
@@ -788,18 +1253,14 @@ theme_adium_append_message (EmpathyChatView *view,
 	EmpathyAvatar         *avatar;
 	const gchar           *avatar_filename = NULL;
 	gint64                 timestamp;
-	const gchar           *html = NULL;
+	AdiumTemplate         *tmpl = NULL;
 	const gchar           *func;
 	const gchar           *service_name;
 	GString               *message_classes = NULL;
 	gboolean               is_backlog;
 	gboolean               consecutive;
 	gboolean               action;
-
-	if (priv->pages_loading != 0) {
-		queue_item (&priv->message_queue, QUEUED_MESSAGE, msg, NULL);
-		return;
-	}
+	gboolean               scroll;
 
 	/* Get information */
 	sender = empathy_message_get_sender (msg);
@@ -858,9 +1319,11 @@ theme_adium_append_message (EmpathyChatView *view,
 	 * - senders are the same contact,
 	 * - last message was recieved recently,
 	 * - last message and this message both are/aren't backlog, and
-	 * - DisableCombineConsecutive is not set in theme's settings */
+	 * - DisableCombineConsecutive is not set in theme's settings
+	 * Prepended messages are never joined. */
 	is_backlog = empathy_message_is_backlog (msg);
-	consecutive = empathy_contact_equal (priv->last_contact, sender) &&
+	consecutive = !prepend &&
+		empathy_contact_equal (priv->last_contact, sender) &&
 		(timestamp - priv->last_timestamp < MESSAGE_JOIN_PERIOD) &&
 		(is_backlog == priv->last_is_backlog) &&
 		!tp_asv_get_boolean (priv->data->info,
@@ -868,7 +1331,7 @@ theme_adium_append_message (EmpathyChatView *view,
 
 	/* Define message classes */
 	message_classes = g_string_new ("message");
-	if (!priv->has_focus && !is_backlog) {
+	if (!priv->has_focus && !is_backlog && !prepend) {
 		if (!priv->has_unread_message) {
 			g_string_append (message_classes, " firstFocus");
 			priv->has_unread_message = TRUE;
@@ -899,7 +1362,7 @@ theme_adium_append_message (EmpathyChatView *view,
 	 * status - the message is a status change
 	 * event - the message is a notification of something happening
 	 *         (for example, encryption being turned on)
-	 * %status% - See %status% in theme_adium_append_html ()
+	 * %status% - See %status% in adium_template_compile ()
 	 */
 
 	/* This is slightly a hack, but it's the only way to add
@@ -919,54 +1382,93 @@ theme_adium_append_message (EmpathyChatView *view,
 		}
 	}
 
-	/* Define javascript function to use */
-	if (consecutive) {
-		func = priv->allow_scrolling ? "appendNextMessage" : "appendNextMessageNoScroll";
+	/* Mark where the block starts, see theme_adium_maybe_evict () */
+	if (!consecutive) {
+		g_string_append_printf (message_classes,
+		    " x-empathy-block-%u", priv->next_block_id);
+	}
+
+	/* Define javascript function to use. When batching, scrolling is
+	 * done once at the end of the batch. */
+	scroll = priv->allow_scrolling && priv->batch_script == NULL;
+	if (prepend) {
+		func = "empathyPrependHTML";
+	} else if (consecutive) {
+		func = scroll ? "appendNextMessage" : "appendNextMessageNoScroll";
 	} else {
-		func = priv->allow_scrolling ? "appendMessage" : "appendMessageNoScroll";
+		func = scroll ? "appendMessage" : "appendMessageNoScroll";
 	}
 
 	if (empathy_contact_is_user (sender)) {
 		/* out */
 		if (is_backlog) {
 			/* context */
-			html = consecutive ? priv->data->out_nextcontext_html : priv->data->out_context_html;
+			tmpl = consecutive ? priv->data->out_nextcontext : priv->data->out_context;
 		} else {
 			/* content */
-			html = consecutive ? priv->data->out_nextcontent_html : priv->data->out_content_html;
+			tmpl = consecutive ? priv->data->out_nextcontent : priv->data->out_content;
 		}
 
 		/* remove all the unread marks when we are sending a message */
-		theme_adium_remove_all_focus_marks (theme);
+		if (!prepend) {
+			theme_adium_remove_all_focus_marks (theme);
+		}
 	} else {
 		/* in */
 		if (is_backlog) {
 			/* context */
-			html = consecutive ? priv->data->in_nextcontext_html : priv->data->in_context_html;
+			tmpl = consecutive ? priv->data->in_nextcontext : priv->data->in_context;
 		} else {
 			/* content */
-			html = consecutive ? priv->data->in_nextcontent_html : priv->data->in_content_html;
+			tmpl = consecutive ? priv->data->in_nextcontent : priv->data->in_content;
 		}
 	}
 
-	theme_adium_append_html (theme, func, html, body_escaped,
+	theme_adium_append_html (theme, func, tmpl, body_escaped,
 				 avatar_filename, name_escaped, contact_id,
 				 service_name, message_classes->str,
 				 timestamp, is_backlog, empathy_contact_is_user (sender));
 
-	/* Keep the sender of the last displayed message */
-	if (priv->last_contact) {
-		g_object_unref (priv->last_contact);
+	if (prepend) {
+		ThemeAdiumBlock block = theme_adium_block_new (priv, timestamp,
+							       msg);
+
+		g_array_prepend_val (priv->blocks, block);
+	} else {
+		if (consecutive) {
+			theme_adium_join_last_block (theme, timestamp, msg);
+		} else {
+			theme_adium_add_block (theme, timestamp, msg);
+		}
+
+		/* Keep the sender of the last displayed message */
+		if (priv->last_contact) {
+			g_object_unref (priv->last_contact);
+		}
+		priv->last_contact = g_object_ref (sender);
+		priv->last_timestamp = timestamp;
+		priv->last_is_backlog = is_backlog;
 	}
-	priv->last_contact = g_object_ref (sender);
-	priv->last_timestamp = timestamp;
-	priv->last_is_backlog = is_backlog;
 
 	g_free (body_escaped);
 	g_free (name_escaped);
 	g_string_free (message_classes, TRUE);
 }
 
+static void
+theme_adium_append_message (EmpathyChatView *view,
+			    EmpathyMessage  *msg)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (view);
+
+	if (priv->pages_loading != 0) {
+		queue_item (&priv->message_queue, QUEUED_MESSAGE, msg, NULL);
+		return;
+	}
+
+	theme_adium_add_message (EMPATHY_THEME_ADIUM (view), msg, FALSE);
+}
+
 static void
 theme_adium_append_event (EmpathyChatView *view,
 			  const gchar     *str)
@@ -1009,6 +1511,9 @@ theme_adium_edit_message (EmpathyChatView *view,
 		return;
 	}
 
+	/* The message to edit could still be in the batch */
+	theme_adium_flush_batch (EMPATHY_THEME_ADIUM (view));
+
 	id = g_strdup_printf ("message-token-%s",
 		empathy_message_get_supersedes (message));
 	/* we don't pass a token here, because doing so will return another
@@ -1321,6 +1826,8 @@ theme_adium_iface_init (EmpathyChatViewIface *iface)
 	iface->copy_clipboard = theme_adium_copy_clipboard;
 	iface->focus_toggled = theme_adium_focus_toggled;
 	iface->message_acknowledged = theme_adium_message_acknowledged;
+	iface->begin_batch = theme_adium_begin_batch;
+	iface->end_batch = theme_adium_end_batch;
 }
 
 static void
@@ -1338,7 +1845,10 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 	if (priv->pages_loading != 0)
 		return;
 
-	/* Display queued messages */
+	webkit_web_view_execute_script (view, prepend_function);
+
+	/* Display queued messages, all at once */
+	theme_adium_begin_batch (chat_view);
 	for (l = priv->message_queue.head; l != NULL; l = l->next) {
 		QueuedItem *item = l->data;
 
@@ -1361,6 +1871,7 @@ theme_adium_load_finished_cb (WebKitWebView  *view,
 	}
 
 	g_queue_clear (&priv->message_queue);
+	theme_adium_end_batch (chat_view);
 }
 
 static void
@@ -1368,7 +1879,14 @@ theme_adium_finalize (GObject *object)
 {
 	EmpathyThemeAdiumPriv *priv = GET_PRIV (object);
 
-	empathy_adium_data_unref (priv->data);
+	tp_clear_pointer (&priv->data, empathy_adium_data_unref);
+
+	if (priv->batch_script != NULL) {
+		g_string_free (priv->batch_script, TRUE);
+	}
+
+	theme_adium_remove_blocks (priv, priv->blocks->len);
+	g_array_free (priv->blocks, TRUE);
 
 	g_object_unref (priv->gsettings_chat);
 	g_object_unref (priv->gsettings_desktop);
@@ -1376,6 +1894,66 @@ theme_adium_finalize (GObject *object)
 	G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
 
+/* Ask for older messages when the user scrolls to the top after some were
+ * removed to honour the scrollback limit */
+static void
+theme_adium_vadjustment_value_changed_cb (GtkAdjustment     *adjustment,
+					  EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	if (priv->evicted_before == 0 || priv->history_requested) {
+		return;
+	}
+
+	if (gtk_adjustment_get_value (adjustment) >
+	    gtk_adjustment_get_lower (adjustment)) {
+		return;
+	}
+
+	DEBUG ("Requesting messages older than %" G_GINT64_FORMAT,
+		priv->evicted_before);
+	priv->history_requested = TRUE;
+	g_signal_emit (theme, signals[HISTORY_REQUESTED], 0,
+		       priv->evicted_before);
+}
+
+static void
+theme_adium_notify_vadjustment_cb (GObject    *object,
+				   GParamSpec *pspec,
+				   gpointer    user_data)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (object);
+
+	if (priv->vadjustment != NULL) {
+		g_signal_handlers_disconnect_by_func (priv->vadjustment,
+			theme_adium_vadjustment_value_changed_cb, object);
+		g_object_unref (priv->vadjustment);
+	}
+
+	priv->vadjustment = gtk_scrollable_get_vadjustment (
+		GTK_SCROLLABLE (object));
+
+	if (priv->vadjustment != NULL) {
+		g_object_ref (priv->vadjustment);
+		g_signal_connect (priv->vadjustment, "value-changed",
+			G_CALLBACK (theme_adium_vadjustment_value_changed_cb),
+			object);
+	}
+}
+
+static void
+theme_adium_notify_scrollback_limit_cb (GSettings   *gsettings,
+					const gchar *key,
+					gpointer     user_data)
+{
+	EmpathyThemeAdium *theme = user_data;
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+
+	priv->scrollback_limit = g_settings_get_uint (gsettings, key);
+	theme_adium_maybe_evict (theme);
+}
+
 static void
 theme_adium_dispose (GObject *object)
 {
@@ -1400,6 +1978,13 @@ theme_adium_dispose (GObject *object)
 		g_queue_clear (&priv->acked_messages);
 	}
 
+	if (priv->vadjustment != NULL) {
+		g_signal_handlers_disconnect_by_func (priv->vadjustment,
+			theme_adium_vadjustment_value_changed_cb, object);
+		g_object_unref (priv->vadjustment);
+		priv->vadjustment = NULL;
+	}
+
 	G_OBJECT_CLASS (empathy_theme_adium_parent_class)->dispose (object);
 }
 
@@ -1469,15 +2054,13 @@ theme_adium_inspect_web_view_cb (WebKitWebInspector *inspector,
 }
 
 static void
-theme_adium_constructed (GObject *object)
+theme_adium_set_default_font (EmpathyThemeAdium *theme)
 {
-	EmpathyThemeAdiumPriv *priv = GET_PRIV (object);
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
 	const gchar           *font_family = NULL;
 	gint                   font_size = 0;
-	WebKitWebView         *webkit_view = WEBKIT_WEB_VIEW (object);
-	WebKitWebInspector    *webkit_inspector;
+	WebKitWebView         *webkit_view = WEBKIT_WEB_VIEW (theme);
 
-	/* Set default settings */
 	font_family = tp_asv_get_string (priv->data->info, "DefaultFontFamily");
 	font_size = tp_asv_get_int32 (priv->data->info, "DefaultFontSize", NULL);
 
@@ -1491,6 +2074,22 @@ theme_adium_constructed (GObject *object)
 			priv->gsettings_desktop,
 			EMPATHY_PREFS_DESKTOP_INTERFACE_DOCUMENT_FONT_NAME);
 	}
+}
+
+static void
+theme_adium_constructed (GObject *object)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (object);
+	WebKitWebView         *webkit_view = WEBKIT_WEB_VIEW (object);
+	WebKitWebInspector    *webkit_inspector;
+
+	/* Set default settings */
+	if (priv->data != NULL) {
+		theme_adium_set_default_font (EMPATHY_THEME_ADIUM (object));
+	} else {
+		/* Queue everything until the theme data is set */
+		priv->pages_loading++;
+	}
 
 	/* Setup webkit inspector */
 	webkit_inspector = webkit_web_view_get_inspector (webkit_view);
@@ -1568,6 +2167,20 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
 
 	widget_class->button_press_event = theme_adium_button_press_event;
 
+	/* Emitted with the timestamp of the oldest message displayed when
+	 * the user scrolls back past it. The handler should give the messages
+	 * sent until then, that second included, to
+	 * empathy_theme_adium_prepend_messages(). */
+	signals[HISTORY_REQUESTED] =
+		g_signal_new ("history-requested",
+			      G_OBJECT_CLASS_TYPE (object_class),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      g_cclosure_marshal_generic,
+			      G_TYPE_NONE,
+			      1, G_TYPE_INT64);
+
 	g_object_class_install_property (object_class,
 					 PROP_ADIUM_DATA,
 					 g_param_spec_boxed ("adium-data",
@@ -1602,6 +2215,7 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 	g_queue_init (&priv->message_queue);
 	priv->allow_scrolling = TRUE;
 	priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
+	priv->blocks = g_array_new (FALSE, FALSE, sizeof (ThemeAdiumBlock));
 
 	g_signal_connect (theme, "load-finished",
 			  G_CALLBACK (theme_adium_load_finished_cb),
@@ -1609,6 +2223,9 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 	g_signal_connect (theme, "navigation-policy-decision-requested",
 			  G_CALLBACK (theme_adium_navigation_policy_decision_requested_cb),
 			  NULL);
+	g_signal_connect (theme, "notify::vadjustment",
+			  G_CALLBACK (theme_adium_notify_vadjustment_cb),
+			  NULL);
 
 	priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
 	priv->gsettings_desktop = g_settings_new (
@@ -1620,14 +2237,21 @@ empathy_theme_adium_init (EmpathyThemeAdium *theme)
 		theme);
 
 	theme_adium_update_enable_webkit_developer_tools (theme);
+
+	g_signal_connect (priv->gsettings_chat,
+		"changed::" EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT,
+		G_CALLBACK (theme_adium_notify_scrollback_limit_cb),
+		theme);
+	priv->scrollback_limit = g_settings_get_uint (priv->gsettings_chat,
+		EMPATHY_PREFS_CHAT_SCROLLBACK_LIMIT);
 }
 
+/* @data may be NULL if the theme is still loading, see
+ * empathy_theme_adium_set_data () */
 EmpathyThemeAdium *
 empathy_theme_adium_new (EmpathyAdiumData *data,
 			 const gchar *variant)
 {
-	g_return_val_if_fail (data != NULL, NULL);
-
 	return g_object_new (EMPATHY_TYPE_THEME_ADIUM,
 			     "adium-data", data,
 			     "variant", variant,
@@ -1649,7 +2273,7 @@ empathy_theme_adium_set_variant (EmpathyThemeAdium *theme,
 	g_free (priv->variant);
 	priv->variant = g_strdup (variant);
 
-	if (priv->in_construction) {
+	if (priv->in_construction || priv->data == NULL) {
 		return;
 	}
 
@@ -1666,6 +2290,115 @@ empathy_theme_adium_set_variant (EmpathyThemeAdium *theme,
 	g_object_notify (G_OBJECT (theme), "variant");
 }
 
+/* Loads the page of a view created without theme data. Messages given to
+ * the view until then are displayed once the page is loaded. */
+void
+empathy_theme_adium_set_data (EmpathyThemeAdium *theme,
+			      EmpathyAdiumData *data)
+{
+	EmpathyThemeAdiumPriv *priv;
+
+	g_return_if_fail (EMPATHY_IS_THEME_ADIUM (theme));
+	g_return_if_fail (data != NULL);
+
+	priv = GET_PRIV (theme);
+	g_return_if_fail (priv->data == NULL);
+
+	priv->data = empathy_adium_data_ref (data);
+	theme_adium_set_default_font (theme);
+
+	/* The page being loaded replaces the one we waited for since
+	 * construction */
+	priv->pages_loading--;
+	theme_adium_load_template (theme);
+}
+
+/* Returns whether @msg is displayed among the oldest messages, those sent
+ * at the timestamp given to EmpathyThemeAdium::history-requested */
+static gboolean
+theme_adium_is_oldest_message (EmpathyThemeAdium *theme,
+			       EmpathyMessage    *msg)
+{
+	EmpathyThemeAdiumPriv *priv = GET_PRIV (theme);
+	guint i, j;
+
+	for (i = 0; i < priv->blocks->len; i++) {
+		ThemeAdiumBlock *block;
+
+		block = &g_array_index (priv->blocks, ThemeAdiumBlock, i);
+		if (block->timestamp != priv->evicted_before) {
+			break;
+		}
+
+		for (j = 0; block->head != NULL && j < block->head->len; j++) {
+			if (empathy_message_equal (msg,
+			    g_ptr_array_index (block->head, j))) {
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/* Displays messages older than the ones in the view, oldest first, in
+ * answer to EmpathyThemeAdium::history-requested. Messages already displayed
+ * are skipped. An empty list means there is nothing older. */
+void
+empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+				      GList             *messages)
+{
+	EmpathyThemeAdiumPriv *priv;
+	GList *older = NULL;
+	GList *l;
+
+	g_return_if_fail (EMPATHY_IS_THEME_ADIUM (theme));
+
+	priv = GET_PRIV (theme);
+	priv->history_requested = FALSE;
+
+	/* The page was replaced since the request */
+	if (priv->pages_loading != 0 || priv->evicted_before == 0) {
+		return;
+	}
+
+	/* Check them all before the view changes, newest first */
+	for (l = g_list_last (messages); l != NULL; l = l->prev) {
+		if (!theme_adium_is_oldest_message (theme, l->data)) {
+			older = g_list_prepend (older, l->data);
+		}
+	}
+
+	if (older == NULL) {
+		priv->evicted_before = 0;
+		return;
+	}
+
+	theme_adium_begin_batch (EMPATHY_CHAT_VIEW (theme));
+	for (l = g_list_last (older); l != NULL; l = l->prev) {
+		theme_adium_add_message (theme, l->data, TRUE);
+	}
+	theme_adium_end_batch (EMPATHY_CHAT_VIEW (theme));
+
+	priv->evicted_before = empathy_message_get_timestamp (older->data);
+
+	g_list_free (older);
+}
+
+/* Tells that the older messages asked with
+ * EmpathyThemeAdium::history-requested can't be given, so they are asked
+ * again next time the user scrolls to the top */
+void
+empathy_theme_adium_history_failed (EmpathyThemeAdium *theme)
+{
+	EmpathyThemeAdiumPriv *priv;
+
+	g_return_if_fail (EMPATHY_IS_THEME_ADIUM (theme));
+
+	priv = GET_PRIV (theme);
+	priv->history_requested = FALSE;
+}
+
 void
 empathy_theme_adium_show_inspector (EmpathyThemeAdium *theme)
 {
@@ -1872,72 +2605,76 @@ empathy_adium_data_new_with_info (const gchar *path, GHashTable *info)
 	data->path = g_strdup (path);
 	data->basedir = g_strconcat (path, G_DIR_SEPARATOR_S "Contents"
 		G_DIR_SEPARATOR_S "Resources" G_DIR_SEPARATOR_S, NULL);
+	data->basedir_uri = g_strconcat ("file://", data->basedir, NULL);
+	data->pages = g_hash_table_new_full (g_str_hash, g_str_equal,
+		g_free, g_free);
 	data->info = g_hash_table_ref (info);
 	data->version = adium_info_get_version (info);
 	data->strings_to_free = g_ptr_array_new_with_free_func (g_free);
-	data->date_format_cache = g_hash_table_new_full (g_str_hash,
-		g_str_equal, g_free, g_free);
-
-	DEBUG ("Loading theme at %s", path);
+	data->templates_to_free = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) adium_template_free);
 
 #define LOAD(path, var) \
 		tmp = g_build_filename (data->basedir, path, NULL); \
 		g_file_get_contents (tmp, &var, NULL, NULL); \
 		g_free (tmp); \
 
-#define LOAD_CONST(path, var) \
+#define LOAD_TEMPLATE(path, var) \
 	{ \
 		gchar *content; \
+		AdiumTemplate *tmpl; \
 		LOAD (path, content); \
-		if (content != NULL) { \
-			g_ptr_array_add (data->strings_to_free, content); \
+		tmpl = adium_template_compile (content); \
+		if (tmpl != NULL) { \
+			g_ptr_array_add (data->templates_to_free, tmpl); \
 		} \
-		var = content; \
-	}
-
-	/* Load html files */
-	LOAD_CONST ("Content.html", data->content_html);
-	LOAD_CONST ("Incoming/Content.html", data->in_content_html);
-	LOAD_CONST ("Incoming/NextContent.html", data->in_nextcontent_html);
-	LOAD_CONST ("Incoming/Context.html", data->in_context_html);
-	LOAD_CONST ("Incoming/NextContext.html", data->in_nextcontext_html);
-	LOAD_CONST ("Outgoing/Content.html", data->out_content_html);
-	LOAD_CONST ("Outgoing/NextContent.html", data->out_nextcontent_html);
-	LOAD_CONST ("Outgoing/Context.html", data->out_context_html);
-	LOAD_CONST ("Outgoing/NextContext.html", data->out_nextcontext_html);
-	LOAD_CONST ("Status.html", data->status_html);
+		var = tmpl; \
+		g_free (content); \
+	}
+
+	/* Load and compile html files */
+	LOAD_TEMPLATE ("Content.html", data->content);
+	LOAD_TEMPLATE ("Incoming/Content.html", data->in_content);
+	LOAD_TEMPLATE ("Incoming/NextContent.html", data->in_nextcontent);
+	LOAD_TEMPLATE ("Incoming/Context.html", data->in_context);
+	LOAD_TEMPLATE ("Incoming/NextContext.html", data->in_nextcontext);
+	LOAD_TEMPLATE ("Outgoing/Content.html", data->out_content);
+	LOAD_TEMPLATE ("Outgoing/NextContent.html", data->out_nextcontent);
+	LOAD_TEMPLATE ("Outgoing/Context.html", data->out_context);
+	LOAD_TEMPLATE ("Outgoing/NextContext.html", data->out_nextcontext);
+	LOAD_TEMPLATE ("Status.html", data->status);
 	LOAD ("Template.html", template_html);
 	LOAD ("Footer.html", footer_html);
 
-#undef LOAD_CONST
+#undef LOAD_TEMPLATE
 #undef LOAD
 
 	/* HTML fallbacks: If we have at least content OR in_content, then
 	 * everything else gets a fallback */
 
-#define FALLBACK(html, fallback) \
-	if (html == NULL) { \
-		html = fallback; \
+#define FALLBACK(tmpl, fallback) \
+	if (tmpl == NULL) { \
+		tmpl = fallback; \
 	}
 
 	/* in_nextcontent -> in_content -> content */
-	FALLBACK (data->in_content_html,      data->content_html);
-	FALLBACK (data->in_nextcontent_html,  data->in_content_html);
+	FALLBACK (data->in_content,      data->content);
+	FALLBACK (data->in_nextcontent,  data->in_content);
 
 	/* context -> content */
-	FALLBACK (data->in_context_html,      data->in_content_html);
-	FALLBACK (data->in_nextcontext_html,  data->in_nextcontent_html);
-	FALLBACK (data->out_context_html,     data->out_content_html);
-	FALLBACK (data->out_nextcontext_html, data->out_nextcontent_html);
+	FALLBACK (data->in_context,      data->in_content);
+	FALLBACK (data->in_nextcontext,  data->in_nextcontent);
+	FALLBACK (data->out_context,     data->out_content);
+	FALLBACK (data->out_nextcontext, data->out_nextcontent);
 
 	/* out -> in */
-	FALLBACK (data->out_content_html,     data->in_content_html);
-	FALLBACK (data->out_nextcontent_html, data->in_nextcontent_html);
-	FALLBACK (data->out_context_html,     data->in_context_html);
-	FALLBACK (data->out_nextcontext_html, data->in_nextcontext_html);
+	FALLBACK (data->out_content,     data->in_content);
+	FALLBACK (data->out_nextcontent, data->in_nextcontent);
+	FALLBACK (data->out_context,     data->in_context);
+	FALLBACK (data->out_nextcontext, data->in_nextcontext);
 
 	/* status -> in_content */
-	FALLBACK (data->status_html,          data->in_content_html);
+	FALLBACK (data->status,          data->in_content);
 
 #undef FALLBACK
 
@@ -2004,6 +2741,8 @@ empathy_adium_data_new (const gchar *path)
 	EmpathyAdiumData *data;
 	GHashTable *info;
 
+	DEBUG ("Loading theme at %s", path);
+
 	info = empathy_adium_info_new (path);
 	data = empathy_adium_data_new_with_info (path, info);
 	g_hash_table_unref (info);
@@ -2011,6 +2750,144 @@ empathy_adium_data_new (const gchar *path)
 	return data;
 }
 
+typedef struct {
+	gchar *path;
+	gchar *variant;
+	GCancellable *cancellable;
+	EmpathyAdiumData *data;
+} AdiumDataLoadClosure;
+
+static void
+adium_data_load_closure_free (AdiumDataLoadClosure *closure)
+{
+	g_free (closure->path);
+	g_free (closure->variant);
+	tp_clear_object (&closure->cancellable);
+	tp_clear_pointer (&closure->data, empathy_adium_data_unref);
+
+	g_slice_free (AdiumDataLoadClosure, closure);
+}
+
+/* Runs in a worker thread, the data isn't shared with anyone yet. Don't
+ * use DEBUG() here, the debug sender is not thread safe. */
+static void
+adium_data_load_thread (GSimpleAsyncResult *result,
+			GObject *object,
+			GCancellable *cancellable)
+{
+	AdiumDataLoadClosure *closure;
+	GHashTable *info;
+
+	closure = g_simple_async_result_get_op_res_gpointer (result);
+
+	if (g_cancellable_is_cancelled (cancellable)) {
+		return;
+	}
+
+	info = empathy_adium_info_new (closure->path);
+	if (info == NULL) {
+		g_simple_async_result_set_error (result, G_IO_ERROR,
+			G_IO_ERROR_INVALID_DATA, "Invalid theme info in %s",
+			closure->path);
+		return;
+	}
+
+	closure->data = empathy_adium_data_new_with_info (closure->path, info);
+	g_hash_table_unref (info);
+
+	/* Scan the Variants directory now rather than in the main thread */
+	empathy_adium_info_get_available_variants (closure->data->info);
+}
+
+/* Load the theme at @path, and its page for @variant, in a thread. */
+void
+empathy_adium_data_new_async (const gchar *path,
+			      const gchar *variant,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data)
+{
+	GSimpleAsyncResult *result;
+	AdiumDataLoadClosure *closure;
+
+	g_return_if_fail (empathy_adium_path_is_valid (path));
+
+	result = g_simple_async_result_new (NULL, callback, user_data,
+		empathy_adium_data_new_async);
+
+	closure = g_slice_new0 (AdiumDataLoadClosure);
+	closure->path = g_strdup (path);
+	closure->variant = g_strdup (variant);
+	if (cancellable != NULL)
+		closure->cancellable = g_object_ref (cancellable);
+
+	g_simple_async_result_set_op_res_gpointer (result, closure,
+		(GDestroyNotify) adium_data_load_closure_free);
+
+	DEBUG ("Loading theme at %s in a thread", path);
+
+	g_simple_async_result_run_in_thread (result, adium_data_load_thread,
+		G_PRIORITY_DEFAULT, cancellable);
+	g_object_unref (result);
+}
+
+EmpathyAdiumData *
+empathy_adium_data_new_finish (GAsyncResult *result,
+			       GError **error)
+{
+	GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+	AdiumDataLoadClosure *closure;
+
+	g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
+		empathy_adium_data_new_async), NULL);
+
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+
+	closure = g_simple_async_result_get_op_res_gpointer (simple);
+
+	/* The load may have been cancelled after the thread finished */
+	if (g_cancellable_set_error_if_cancelled (closure->cancellable, error))
+		return NULL;
+
+	if (closure->data == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+			"Theme loading was cancelled");
+		return NULL;
+	}
+
+	/* Prepare the page views will load, so the first one doesn't have
+	 * to build it */
+	adium_data_get_page (closure->data, closure->variant);
+
+	return empathy_adium_data_ref (closure->data);
+}
+
+/* The template page for @variant, built the first time a view asks for it
+ * and then shared by all views of the same variant. */
+static const gchar *
+adium_data_get_page (EmpathyAdiumData *data,
+		     const gchar *variant)
+{
+	gchar *variant_path;
+	gchar *page;
+
+	variant_path = adium_info_dup_path_for_variant (data->info, variant);
+
+	page = g_hash_table_lookup (data->pages, variant_path);
+	if (page != NULL) {
+		g_free (variant_path);
+		return page;
+	}
+
+	page = string_with_format (data->template_html, variant_path, NULL);
+
+	/* The table takes ownership of variant_path and page */
+	g_hash_table_insert (data->pages, variant_path, page);
+
+	return page;
+}
+
 EmpathyAdiumData  *
 empathy_adium_data_ref (EmpathyAdiumData *data)
 {
@@ -2029,12 +2906,14 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
 	if (g_atomic_int_dec_and_test (&data->ref_count)) {
 		g_free (data->path);
 		g_free (data->basedir);
+		g_free (data->basedir_uri);
+		g_hash_table_unref (data->pages);
 		g_free (data->default_avatar_filename);
 		g_free (data->default_incoming_avatar_filename);
 		g_free (data->default_outgoing_avatar_filename);
 		g_hash_table_unref (data->info);
 		g_ptr_array_unref (data->strings_to_free);
-		tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
+		g_ptr_array_unref (data->templates_to_free);
 
 		g_slice_free (EmpathyAdiumData, data);
 	}
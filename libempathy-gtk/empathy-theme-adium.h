@@ -53,7 +53,12 @@ EmpathyThemeAdium *empathy_theme_adium_new      (EmpathyAdiumData *data,
 						 const gchar *variant);
 void               empathy_theme_adium_set_variant (EmpathyThemeAdium *theme,
 						    const gchar *variant);
+void               empathy_theme_adium_set_data (EmpathyThemeAdium *theme,
+						 EmpathyAdiumData *data);
 void               empathy_theme_adium_show_inspector (EmpathyThemeAdium *theme);
+void               empathy_theme_adium_prepend_messages (EmpathyThemeAdium *theme,
+							 GList *messages);
+void               empathy_theme_adium_history_failed (EmpathyThemeAdium *theme);
 
 gboolean           empathy_adium_path_is_valid (const gchar *path);
 
@@ -66,6 +71,13 @@ GType              empathy_adium_data_get_type (void) G_GNUC_CONST;
 EmpathyAdiumData  *empathy_adium_data_new (const gchar *path);
 EmpathyAdiumData  *empathy_adium_data_new_with_info (const gchar *path,
 						     GHashTable *info);
+void               empathy_adium_data_new_async (const gchar *path,
+						 const gchar *variant,
+						 GCancellable *cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer user_data);
+EmpathyAdiumData  *empathy_adium_data_new_finish (GAsyncResult *result,
+						  GError **error);
 EmpathyAdiumData  *empathy_adium_data_ref (EmpathyAdiumData *data);
 void               empathy_adium_data_unref (EmpathyAdiumData *data);
 GHashTable        *empathy_adium_data_get_info (EmpathyAdiumData *data);
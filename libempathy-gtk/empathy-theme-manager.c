@@ -54,9 +54,15 @@ typedef struct {
 	gboolean     in_constructor;
 
 	EmpathyAdiumData *adium_data;
+	/* Path of the theme being loaded in a thread, and how to cancel it */
+	gchar *adium_loading_path;
+	GCancellable *adium_loading_cancellable;
 	gchar *adium_variant;
 	/* list of weakref to EmpathyThemeAdium objects */
 	GList *adium_views;
+	/* list of weakref to EmpathyThemeAdium objects waiting for the theme
+	 * being loaded */
+	GList *adium_pending_views;
 } EmpathyThemeManagerPriv;
 
 enum {
@@ -374,6 +380,18 @@ theme_manager_update_boxes_theme (EmpathyThemeManager *manager,
 	}
 }
 
+static void
+theme_manager_track_adium_view (EmpathyThemeManager *manager,
+				EmpathyThemeAdium   *theme)
+{
+	EmpathyThemeManagerPriv *priv = GET_PRIV (manager);
+
+	priv->adium_views = g_list_prepend (priv->adium_views, theme);
+	g_object_weak_ref (G_OBJECT (theme),
+			   theme_manager_view_weak_notify_cb,
+			   &priv->adium_views);
+}
+
 static EmpathyThemeAdium *
 theme_manager_create_adium_view (EmpathyThemeManager *manager)
 {
@@ -381,14 +399,100 @@ theme_manager_create_adium_view (EmpathyThemeManager *manager)
 	EmpathyThemeAdium *theme;
 
 	theme = empathy_theme_adium_new (priv->adium_data, priv->adium_variant);
-	priv->adium_views = g_list_prepend (priv->adium_views, theme);
+	theme_manager_track_adium_view (manager, theme);
+
+	return theme;
+}
+
+static EmpathyThemeAdium *
+theme_manager_create_pending_adium_view (EmpathyThemeManager *manager)
+{
+	EmpathyThemeManagerPriv *priv = GET_PRIV (manager);
+	EmpathyThemeAdium *theme;
+
+	theme = empathy_theme_adium_new (NULL, priv->adium_variant);
+	priv->adium_pending_views = g_list_prepend (priv->adium_pending_views,
+						    theme);
 	g_object_weak_ref (G_OBJECT (theme),
 			   theme_manager_view_weak_notify_cb,
-			   &priv->adium_views);
+			   &priv->adium_pending_views);
 
 	return theme;
 }
 
+static void
+theme_manager_cancel_adium_load (EmpathyThemeManager *manager)
+{
+	EmpathyThemeManagerPriv *priv = GET_PRIV (manager);
+
+	if (priv->adium_loading_cancellable != NULL) {
+		g_cancellable_cancel (priv->adium_loading_cancellable);
+	}
+
+	tp_clear_object (&priv->adium_loading_cancellable);
+	tp_clear_pointer (&priv->adium_loading_path, g_free);
+}
+
+static void
+theme_manager_set_adium_data (EmpathyThemeManager *manager,
+			      EmpathyAdiumData    *data)
+{
+	EmpathyThemeManagerPriv *priv = GET_PRIV (manager);
+
+	/* We can stop tracking existing views since we won't be able to
+	 * change them live anymore */
+	clear_list_of_views (&priv->adium_views);
+	tp_clear_pointer (&priv->adium_data, empathy_adium_data_unref);
+	priv->adium_data = data;
+
+	/* Views created while the theme was loading can finally show it */
+	while (priv->adium_pending_views != NULL) {
+		EmpathyThemeAdium *theme = priv->adium_pending_views->data;
+
+		g_object_weak_unref (G_OBJECT (theme),
+				     theme_manager_view_weak_notify_cb,
+				     &priv->adium_pending_views);
+		priv->adium_pending_views = g_list_delete_link (
+			priv->adium_pending_views, priv->adium_pending_views);
+
+		empathy_theme_adium_set_data (theme, data);
+		theme_manager_track_adium_view (manager, theme);
+	}
+
+	theme_manager_emit_changed (manager);
+}
+
+static void
+theme_manager_adium_data_loaded_cb (GObject      *source,
+				    GAsyncResult *result,
+				    gpointer      user_data)
+{
+	EmpathyAdiumData *data;
+	GError *error = NULL;
+
+	data = empathy_adium_data_new_finish (result, &error);
+	if (data == NULL) {
+		/* Cancelled loads happen when the manager is finalized, so
+		 * don't touch it */
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			EmpathyThemeManager *manager = user_data;
+
+			/* Views waiting for it keep waiting for the next
+			 * theme to be loaded */
+			DEBUG ("Failed to load theme: %s", error->message);
+			theme_manager_cancel_adium_load (manager);
+		}
+
+		g_error_free (error);
+		return;
+	}
+
+	DEBUG ("Theme at %s loaded", empathy_adium_data_get_path (data));
+
+	theme_manager_cancel_adium_load (user_data);
+	theme_manager_set_adium_data (user_data, data);
+}
+
 static void
 theme_manager_notify_adium_path_cb (GSettings   *gsettings_chat,
 				    const gchar *key,
@@ -401,7 +505,9 @@ theme_manager_notify_adium_path_cb (GSettings   *gsettings_chat,
 
 	new_path = g_settings_get_string (gsettings_chat, key);
 
-	if (priv->adium_data != NULL) {
+	if (priv->adium_loading_path != NULL) {
+		current_path = priv->adium_loading_path;
+	} else if (priv->adium_data != NULL) {
 		current_path = empathy_adium_data_get_path (priv->adium_data);
 	}
 
@@ -418,15 +524,15 @@ theme_manager_notify_adium_path_cb (GSettings   *gsettings_chat,
 		return;
 	}
 
-	/* Load new theme data, we can stop tracking existing views since we
-	 * won't be able to change them live anymore */
-	clear_list_of_views (&priv->adium_views);
-	tp_clear_pointer (&priv->adium_data, empathy_adium_data_unref);
-	priv->adium_data = empathy_adium_data_new (new_path);
-
-	theme_manager_emit_changed (manager);
+	/* Load new theme data in a thread, views keep using the current one
+	 * until it is ready. */
+	theme_manager_cancel_adium_load (manager);
+	priv->adium_loading_path = new_path;
+	priv->adium_loading_cancellable = g_cancellable_new ();
 
-	g_free (new_path);
+	empathy_adium_data_new_async (new_path, priv->adium_variant,
+		priv->adium_loading_cancellable,
+		theme_manager_adium_data_loaded_cb, manager);
 }
 
 static void
@@ -452,6 +558,11 @@ theme_manager_notify_adium_variant_cb (GSettings   *gsettings_chat,
 		empathy_theme_adium_set_variant (EMPATHY_THEME_ADIUM (l->data),
 			priv->adium_variant);
 	}
+
+	for (l = priv->adium_pending_views; l; l = l->next) {
+		empathy_theme_adium_set_variant (EMPATHY_THEME_ADIUM (l->data),
+			priv->adium_variant);
+	}
 }
 
 EmpathyChatView *
@@ -464,6 +575,15 @@ empathy_theme_manager_create_view (EmpathyThemeManager *manager)
 
 	DEBUG ("Using theme %s", priv->name);
 
+	if (strcmp (priv->name, "adium") == 0 && priv->adium_data == NULL &&
+	    priv->adium_loading_path != NULL) {
+		/* Don't wait for the theme, the view queues messages until
+		 * it is loaded */
+		DEBUG ("Theme is still loading, it will be used once loaded");
+		return EMPATHY_CHAT_VIEW (
+			theme_manager_create_pending_adium_view (manager));
+	}
+
 	if (strcmp (priv->name, "adium") == 0 && priv->adium_data != NULL)  {
 		return EMPATHY_CHAT_VIEW (theme_manager_create_adium_view (manager));
 	}
@@ -583,6 +703,8 @@ theme_manager_finalize (GObject *object)
 	clear_list_of_views (&priv->boxes_views);
 
 	clear_list_of_views (&priv->adium_views);
+	clear_list_of_views (&priv->adium_pending_views);
+	theme_manager_cancel_adium_load (EMPATHY_THEME_MANAGER (object));
 	g_free (priv->adium_variant);
 	tp_clear_pointer (&priv->adium_data, empathy_adium_data_unref);
 
@@ -629,15 +751,8 @@ empathy_theme_manager_init (EmpathyThemeManager *manager)
 				      EMPATHY_PREFS_CHAT_THEME,
 				      manager);
 
-	/* Take the adium path/variant and track changes */
-	g_signal_connect (priv->gsettings_chat,
-			  "changed::" EMPATHY_PREFS_CHAT_ADIUM_PATH,
-			  G_CALLBACK (theme_manager_notify_adium_path_cb),
-			  manager);
-	theme_manager_notify_adium_path_cb (priv->gsettings_chat,
-					    EMPATHY_PREFS_CHAT_ADIUM_PATH,
-					    manager);
-
+	/* Take the adium variant/path and track changes. The variant goes
+	 * first so the theme loading can prepare its page. */
 	g_signal_connect (priv->gsettings_chat,
 			  "changed::" EMPATHY_PREFS_CHAT_THEME_VARIANT,
 			  G_CALLBACK (theme_manager_notify_adium_variant_cb),
@@ -645,6 +760,14 @@ empathy_theme_manager_init (EmpathyThemeManager *manager)
 	theme_manager_notify_adium_variant_cb (priv->gsettings_chat,
 					       EMPATHY_PREFS_CHAT_THEME_VARIANT,
 					       manager);
+
+	g_signal_connect (priv->gsettings_chat,
+			  "changed::" EMPATHY_PREFS_CHAT_ADIUM_PATH,
+			  G_CALLBACK (theme_manager_notify_adium_path_cb),
+			  manager);
+	theme_manager_notify_adium_path_cb (priv->gsettings_chat,
+					    EMPATHY_PREFS_CHAT_ADIUM_PATH,
+					    manager);
 	priv->in_constructor = FALSE;
 }
 
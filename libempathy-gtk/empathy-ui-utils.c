@@ -51,6 +51,7 @@
 #include <libempathy/empathy-debug.h>
 #include <libempathy/empathy-utils.h>
 #include <libempathy/empathy-ft-factory.h>
+#include <libempathy/empathy-gsettings.h>
 
 void
 empathy_gtk_init (void)
@@ -467,6 +468,185 @@ avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
 	return pixbuf;
 }
 
+/* Decoded and scaled avatars, shared by everything showing avatars. Entries
+ * are keyed by the avatar's token or file and the requested size, and the
+ * least recently used ones are dropped once the total size of the pixbufs
+ * goes over EMPATHY_PREFS_UI_AVATAR_CACHE_SIZE. */
+typedef struct {
+	gchar     *key;
+	GdkPixbuf *pixbuf;
+	gsize      size;
+} AvatarCacheEntry;
+
+typedef struct {
+	/* key -> GList link in lru */
+	GHashTable *entries;
+	/* owned AvatarCacheEntry, most recently used first */
+	GQueue      lru;
+	gsize       size;
+	gsize       max_size;
+	GSettings  *gsettings;
+	/* key -> PixbufAvatarFromIndividualClosure loading it, so concurrent
+	 * requests for the same avatar share a single load */
+	GHashTable *pending;
+} AvatarCache;
+
+static void
+avatar_cache_trim (AvatarCache *cache)
+{
+	while (cache->size > cache->max_size && cache->lru.tail != NULL) {
+		AvatarCacheEntry *entry = g_queue_pop_tail (&cache->lru);
+
+		g_hash_table_remove (cache->entries, entry->key);
+		cache->size -= entry->size;
+
+		g_free (entry->key);
+		g_object_unref (entry->pixbuf);
+		g_slice_free (AvatarCacheEntry, entry);
+	}
+}
+
+static void
+avatar_cache_size_changed_cb (GSettings   *gsettings,
+			      const gchar *key,
+			      AvatarCache *cache)
+{
+	cache->max_size = (gsize) g_settings_get_uint (gsettings,
+		EMPATHY_PREFS_UI_AVATAR_CACHE_SIZE) * 1024;
+	avatar_cache_trim (cache);
+}
+
+static AvatarCache *
+avatar_cache_get (void)
+{
+	/* Intentionally leaked */
+	static AvatarCache *cache = NULL;
+
+	if (G_UNLIKELY (cache == NULL)) {
+		cache = g_slice_new0 (AvatarCache);
+		cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+		cache->pending = g_hash_table_new (g_str_hash, g_str_equal);
+		g_queue_init (&cache->lru);
+		cache->gsettings = g_settings_new (EMPATHY_PREFS_UI_SCHEMA);
+
+		g_signal_connect (cache->gsettings,
+			"changed::" EMPATHY_PREFS_UI_AVATAR_CACHE_SIZE,
+			G_CALLBACK (avatar_cache_size_changed_cb), cache);
+		avatar_cache_size_changed_cb (cache->gsettings, NULL, cache);
+	}
+
+	return cache;
+}
+
+/* Returns NULL if avatars from @source can't be cached */
+static gchar *
+avatar_cache_build_key (const gchar *source,
+			gint         width,
+			gint         height)
+{
+	if (EMP_STR_EMPTY (source)) {
+		return NULL;
+	}
+
+	return g_strdup_printf ("%dx%d:%s", width, height, source);
+}
+
+/* Attributes of an avatar file its key is built from */
+#define AVATAR_CACHE_FILE_ATTRIBUTES \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_STANDARD_SIZE
+
+/* Avatars are keyed by the URI of the file they are stored in, whichever
+ * way they are loaded, so each one is only cached once per size. Avatar
+ * files can be rewritten in place, so their modification time and size, from
+ * @info queried with AVATAR_CACHE_FILE_ATTRIBUTES, are part of the key. */
+static gchar *
+avatar_cache_build_file_key (GFile     *file,
+			     GFileInfo *info,
+			     gint       width,
+			     gint       height)
+{
+	gchar *uri, *source, *key;
+
+	uri = g_file_get_uri (file);
+	source = g_strdup_printf ("%s@%" G_GUINT64_FORMAT ":%" G_GOFFSET_FORMAT,
+		uri,
+		g_file_info_get_attribute_uint64 (info,
+			G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_size (info));
+	key = avatar_cache_build_key (source, width, height);
+	g_free (source);
+	g_free (uri);
+
+	return key;
+}
+
+/* Returns a new ref */
+static GdkPixbuf *
+avatar_cache_lookup (const gchar *key)
+{
+	AvatarCache *cache;
+	GList *link;
+
+	if (key == NULL) {
+		return NULL;
+	}
+
+	cache = avatar_cache_get ();
+	link = g_hash_table_lookup (cache->entries, key);
+	if (link == NULL) {
+		return NULL;
+	}
+
+	/* Move it to the front */
+	g_queue_unlink (&cache->lru, link);
+	g_queue_push_head_link (&cache->lru, link);
+
+	return g_object_ref (((AvatarCacheEntry *) link->data)->pixbuf);
+}
+
+static void
+avatar_cache_insert (const gchar *key,
+		     GdkPixbuf   *pixbuf)
+{
+	AvatarCache *cache;
+	AvatarCacheEntry *entry;
+	GList *link;
+	gsize size;
+
+	if (key == NULL || pixbuf == NULL) {
+		return;
+	}
+
+	cache = avatar_cache_get ();
+	size = (gsize) gdk_pixbuf_get_rowstride (pixbuf) *
+		gdk_pixbuf_get_height (pixbuf);
+	if (size > cache->max_size) {
+		return;
+	}
+
+	link = g_hash_table_lookup (cache->entries, key);
+	if (link != NULL) {
+		/* Loaded twice concurrently, keep the latest */
+		entry = link->data;
+		cache->size -= entry->size;
+		g_object_unref (entry->pixbuf);
+		g_queue_unlink (&cache->lru, link);
+		g_queue_push_head_link (&cache->lru, link);
+	} else {
+		entry = g_slice_new (AvatarCacheEntry);
+		entry->key = g_strdup (key);
+		g_queue_push_head (&cache->lru, entry);
+		g_hash_table_insert (cache->entries, entry->key,
+			cache->lru.head);
+	}
+
+	entry->pixbuf = g_object_ref (pixbuf);
+	entry->size = size;
+	cache->size += size;
+
+	avatar_cache_trim (cache);
+}
+
 GdkPixbuf *
 empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 				  gint          width,
@@ -476,11 +656,36 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 	GdkPixbufLoader	 *loader;
 	struct SizeData   data;
 	GError           *error = NULL;
+	gchar            *key = NULL;
 
 	if (!avatar) {
 		return NULL;
 	}
 
+	if (!EMP_STR_EMPTY (avatar->filename)) {
+		GFile *file = g_file_new_for_path (avatar->filename);
+		GFileInfo *info;
+
+		info = g_file_query_info (file, AVATAR_CACHE_FILE_ATTRIBUTES,
+			G_FILE_QUERY_INFO_NONE, NULL, NULL);
+		if (info != NULL) {
+			key = avatar_cache_build_file_key (file, info,
+				width, height);
+			g_object_unref (info);
+		}
+		g_object_unref (file);
+	}
+
+	if (key == NULL) {
+		/* Not stored anywhere, and so never loaded asynchronously */
+		key = avatar_cache_build_key (avatar->token, width, height);
+	}
+	pixbuf = avatar_cache_lookup (key);
+	if (pixbuf != NULL) {
+		g_free (key);
+		return pixbuf;
+	}
+
 	data.width = width;
 	data.height = height;
 	data.preserve_aspect_ratio = TRUE;
@@ -493,12 +698,14 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 
 	if (avatar->len == 0) {
 		g_warning ("Avatar has 0 length");
+		g_free (key);
 		return NULL;
 	} else if (!gdk_pixbuf_loader_write (loader, avatar->data, avatar->len, &error)) {
 		g_warning ("Couldn't write avatar image:%p with "
 			   "length:%" G_GSIZE_FORMAT " to pixbuf loader: %s",
 			   avatar->data, avatar->len, error->message);
 		g_error_free (error);
+		g_free (key);
 		return NULL;
 	}
 
@@ -507,6 +714,9 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 
 	g_object_unref (loader);
 
+	avatar_cache_insert (key, pixbuf);
+	g_free (key);
+
 	return pixbuf;
 }
 
@@ -525,18 +735,43 @@ empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
 }
 
 typedef struct {
-	FolksIndividual *individual;
 	GSimpleAsyncResult *result;
+	GCancellable *cancellable;
+} PixbufAvatarFromIndividualWaiter;
+
+typedef struct {
+	GLoadableIcon *icon;
+	/* owned PixbufAvatarFromIndividualWaiter for each request sharing the
+	 * load */
+	GList *waiters;
 	guint width;
 	guint height;
 	struct SizeData size_data;
 	GdkPixbufLoader *loader;
+	/* Only set when the load isn't shared, see avatar_icon_load_start () */
 	GCancellable *cancellable;
+	gchar *cache_key;
 	guint8 data[512];
 } PixbufAvatarFromIndividualClosure;
 
+static void
+pixbuf_avatar_from_individual_closure_add_waiter (
+		PixbufAvatarFromIndividualClosure *closure,
+		GSimpleAsyncResult                *result,
+		GCancellable                      *cancellable)
+{
+	PixbufAvatarFromIndividualWaiter *waiter;
+
+	waiter = g_slice_new0 (PixbufAvatarFromIndividualWaiter);
+	waiter->result = g_object_ref (result);
+	if (cancellable != NULL)
+		waiter->cancellable = g_object_ref (cancellable);
+
+	closure->waiters = g_list_append (closure->waiters, waiter);
+}
+
 static PixbufAvatarFromIndividualClosure *
-pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
+pixbuf_avatar_from_individual_closure_new (GLoadableIcon      *icon,
 					   GSimpleAsyncResult *result,
 					   gint                width,
 					   gint                height,
@@ -544,16 +779,15 @@ pixbuf_avatar_from_individual_closure_new (FolksIndividual    *individual,
 {
 	PixbufAvatarFromIndividualClosure *closure;
 
-	g_return_val_if_fail (FOLKS_IS_INDIVIDUAL (individual), NULL);
+	g_return_val_if_fail (G_IS_LOADABLE_ICON (icon), NULL);
 	g_return_val_if_fail (G_IS_ASYNC_RESULT (result), NULL);
 
 	closure = g_new0 (PixbufAvatarFromIndividualClosure, 1);
-	closure->individual = g_object_ref (individual);
-	closure->result = g_object_ref (result);
+	closure->icon = g_object_ref (icon);
 	closure->width = width;
 	closure->height = height;
-	if (cancellable != NULL)
-		closure->cancellable = g_object_ref (cancellable);
+	pixbuf_avatar_from_individual_closure_add_waiter (closure, result,
+							  cancellable);
 
 	return closure;
 }
@@ -562,13 +796,69 @@ static void
 pixbuf_avatar_from_individual_closure_free (
 		PixbufAvatarFromIndividualClosure *closure)
 {
+	GList *l;
+
+	for (l = closure->waiters; l != NULL; l = l->next) {
+		PixbufAvatarFromIndividualWaiter *waiter = l->data;
+
+		g_object_unref (waiter->result);
+		g_clear_object (&waiter->cancellable);
+		g_slice_free (PixbufAvatarFromIndividualWaiter, waiter);
+	}
+	g_list_free (closure->waiters);
+
 	g_clear_object (&closure->cancellable);
 	tp_clear_object (&closure->loader);
-	g_object_unref (closure->individual);
-	g_object_unref (closure->result);
+	g_free (closure->cache_key);
+	g_object_unref (closure->icon);
 	g_free (closure);
 }
 
+/* Gives @pixbuf, or @error, to every request waiting for the load and frees
+ * @closure */
+static void
+pixbuf_avatar_from_individual_closure_complete (
+		PixbufAvatarFromIndividualClosure *closure,
+		GdkPixbuf                         *pixbuf,
+		const GError                      *error)
+{
+	GList *l;
+
+	if (closure->cache_key != NULL) {
+		AvatarCache *cache = avatar_cache_get ();
+
+		if (g_hash_table_lookup (cache->pending, closure->cache_key) ==
+		    closure) {
+			g_hash_table_remove (cache->pending,
+					     closure->cache_key);
+		}
+
+		avatar_cache_insert (closure->cache_key, pixbuf);
+	}
+
+	for (l = closure->waiters; l != NULL; l = l->next) {
+		PixbufAvatarFromIndividualWaiter *waiter = l->data;
+		GError *cancelled = NULL;
+
+		if (g_cancellable_set_error_if_cancelled (waiter->cancellable,
+							  &cancelled)) {
+			g_simple_async_result_take_error (waiter->result,
+							  cancelled);
+		} else if (error != NULL) {
+			g_simple_async_result_set_from_error (waiter->result,
+							      error);
+		} else if (pixbuf != NULL) {
+			g_simple_async_result_set_op_res_gpointer (
+				waiter->result, g_object_ref (pixbuf),
+				g_object_unref);
+		}
+
+		g_simple_async_result_complete (waiter->result);
+	}
+
+	pixbuf_avatar_from_individual_closure_free (closure);
+}
+
 static void
 avatar_icon_load_close_cb (GObject      *object,
                            GAsyncResult *result,
@@ -592,6 +882,7 @@ avatar_icon_load_read_cb (GObject      *object,
 	GInputStream *stream = G_INPUT_STREAM (object);
 	PixbufAvatarFromIndividualClosure *closure = user_data;
 	gssize n_read;
+	GdkPixbuf *pixbuf = NULL;
 	GError *error = NULL;
 
 	/* Finish reading this chunk from the stream */
@@ -599,7 +890,6 @@ avatar_icon_load_read_cb (GObject      *object,
 	if (error != NULL) {
 		DEBUG ("Failed to finish read from pixbuf stream: %s",
 			error->message);
-		g_simple_async_result_set_from_error (closure->result, error);
 		goto out_close;
 	}
 
@@ -608,7 +898,6 @@ avatar_icon_load_read_cb (GObject      *object,
 			n_read, &error)) {
 		DEBUG ("Failed to write to pixbuf loader: %s",
 			error ? error->message : "No error given");
-		g_simple_async_result_set_from_error (closure->result, error);
 		goto out_close;
 	}
 
@@ -617,14 +906,11 @@ avatar_icon_load_read_cb (GObject      *object,
 		if (!gdk_pixbuf_loader_close (closure->loader, &error)) {
 			DEBUG ("Failed to close pixbuf loader: %s",
 				error ? error->message : "No error given");
-			g_simple_async_result_set_from_error (closure->result, error);
 			goto out;
 		}
 
 		/* We're done. */
-		g_simple_async_result_set_op_res_gpointer (closure->result,
-			avatar_pixbuf_from_loader (closure->loader),
-			g_object_unref);
+		pixbuf = avatar_pixbuf_from_loader (closure->loader);
 
 		goto out;
 	} else {
@@ -647,10 +933,10 @@ out:
 	g_input_stream_close_async (stream, G_PRIORITY_DEFAULT, NULL,
 		(GAsyncReadyCallback) avatar_icon_load_close_cb, NULL);
 
-	g_simple_async_result_complete (closure->result);
+	pixbuf_avatar_from_individual_closure_complete (closure, pixbuf, error);
 
 	g_clear_error (&error);
-	pixbuf_avatar_from_individual_closure_free (closure);
+	tp_clear_object (&pixbuf);
 }
 
 static void
@@ -666,7 +952,6 @@ avatar_icon_load_cb (GObject      *object,
 	stream = g_loadable_icon_load_finish (icon, result, NULL, &error);
 	if (error != NULL) {
 		DEBUG ("Failed to open avatar stream: %s", error->message);
-		g_simple_async_result_set_from_error (closure->result, error);
 		goto out;
 	}
 
@@ -692,11 +977,84 @@ avatar_icon_load_cb (GObject      *object,
 	return;
 
 out:
-	g_simple_async_result_complete (closure->result);
+	pixbuf_avatar_from_individual_closure_complete (closure, NULL, error);
 
 	g_clear_error (&error);
 	tp_clear_object (&stream);
-	pixbuf_avatar_from_individual_closure_free (closure);
+}
+
+/* Answers @closure's request from the cache, joins it to a load of the same
+ * avatar already running, or starts loading it */
+static void
+avatar_icon_load_start (PixbufAvatarFromIndividualClosure *closure)
+{
+	AvatarCache *cache;
+	PixbufAvatarFromIndividualClosure *pending;
+	PixbufAvatarFromIndividualWaiter *waiter = closure->waiters->data;
+	GdkPixbuf *pixbuf;
+
+	if (closure->cache_key == NULL) {
+		/* Nobody can share the load, it can be cancelled */
+		if (waiter->cancellable != NULL)
+			closure->cancellable = g_object_ref (waiter->cancellable);
+
+		g_loadable_icon_load_async (closure->icon, closure->width,
+			closure->cancellable, avatar_icon_load_cb, closure);
+		return;
+	}
+
+	pixbuf = avatar_cache_lookup (closure->cache_key);
+	if (pixbuf != NULL) {
+		pixbuf_avatar_from_individual_closure_complete (closure,
+								pixbuf, NULL);
+		g_object_unref (pixbuf);
+		return;
+	}
+
+	cache = avatar_cache_get ();
+	pending = g_hash_table_lookup (cache->pending, closure->cache_key);
+	if (pending != NULL) {
+		pending->waiters = g_list_concat (pending->waiters,
+						  closure->waiters);
+		closure->waiters = NULL;
+		pixbuf_avatar_from_individual_closure_free (closure);
+		return;
+	}
+
+	/* Other requests may join, so cancelling this one doesn't stop the
+	 * load, it is only reported as cancelled */
+	g_hash_table_insert (cache->pending, closure->cache_key, closure);
+	g_loadable_icon_load_async (closure->icon, closure->width, NULL,
+		avatar_icon_load_cb, closure);
+}
+
+static void
+avatar_icon_query_info_cb (GObject      *object,
+			   GAsyncResult *result,
+			   gpointer      user_data)
+{
+	GFile *file = G_FILE (object);
+	PixbufAvatarFromIndividualClosure *closure = user_data;
+	GFileInfo *info;
+	GError *error = NULL;
+
+	info = g_file_query_info_finish (file, result, &error);
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		pixbuf_avatar_from_individual_closure_complete (closure, NULL,
+								error);
+		g_error_free (error);
+		return;
+	} else if (info == NULL) {
+		/* Load it anyway, without caching it */
+		DEBUG ("Failed to query avatar file info: %s", error->message);
+		g_error_free (error);
+	} else {
+		closure->cache_key = avatar_cache_build_file_key (file, info,
+			closure->width, closure->height);
+		g_object_unref (info);
+	}
+
+	avatar_icon_load_start (closure);
 }
 
 void
@@ -721,14 +1079,22 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
 	if (avatar_icon == NULL)
 		goto out;
 
-	closure = pixbuf_avatar_from_individual_closure_new (individual, result,
+	closure = pixbuf_avatar_from_individual_closure_new (avatar_icon,
+							     result,
 							     width, height,
 							     cancellable);
 	if (closure == NULL)
 		goto out;
 
-	g_loadable_icon_load_async (avatar_icon, width, cancellable,
-			avatar_icon_load_cb, closure);
+	if (G_IS_FILE_ICON (avatar_icon)) {
+		g_file_query_info_async (
+			g_file_icon_get_file (G_FILE_ICON (avatar_icon)),
+			AVATAR_CACHE_FILE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE,
+			G_PRIORITY_DEFAULT, cancellable,
+			avatar_icon_query_info_cb, closure);
+	} else {
+		avatar_icon_load_start (closure);
+	}
 
 	g_object_unref (result);
 
@@ -2064,67 +2430,157 @@ empathy_get_current_action_time (void)
   return (tp_user_action_time_from_x11 (gtk_get_current_event_time ()));
 }
 
-/* @words = empathy_live_search_strip_utf8_string (@text);
- *
- * User has to pass both so we don't have to compute @words ourself each time
- * this function is called. */
-gboolean
-empathy_individual_match_string (FolksIndividual *individual,
-    const char *text,
-    GPtrArray *words)
+/* Search keys of an individual, kept as qdata and dropped when its alias or
+ * personas change */
+typedef struct
+{
+  FolksIndividual *individual;
+  gulong alias_changed_id;
+  gulong personas_changed_id;
+  /* Stripped words of the alias */
+  GPtrArray *alias_tokens;
+  /* Display ids of the interesting personas, and the stripped words of
+   * the part before the '@' of each, in the same order */
+  GPtrArray *ids;
+  GPtrArray *id_tokens;
+} IndividualSearchKeys;
+
+static GQuark
+individual_search_keys_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("empathy-individual-search-keys");
+
+  return quark;
+}
+
+static void
+individual_search_keys_free (IndividualSearchKeys *keys)
+{
+  /* When the individual is finalized, its handlers are already gone */
+  if (g_signal_handler_is_connected (keys->individual,
+          keys->alias_changed_id))
+    g_signal_handler_disconnect (keys->individual, keys->alias_changed_id);
+  if (g_signal_handler_is_connected (keys->individual,
+          keys->personas_changed_id))
+    g_signal_handler_disconnect (keys->individual, keys->personas_changed_id);
+
+  if (keys->alias_tokens != NULL)
+    g_ptr_array_unref (keys->alias_tokens);
+  g_ptr_array_unref (keys->ids);
+  g_ptr_array_unref (keys->id_tokens);
+
+  g_slice_free (IndividualSearchKeys, keys);
+}
+
+static void
+individual_search_keys_invalidate_cb (FolksIndividual *individual)
+{
+  g_object_set_qdata (G_OBJECT (individual), individual_search_keys_quark (),
+      NULL);
+}
+
+static IndividualSearchKeys *
+individual_get_search_keys (FolksIndividual *individual)
 {
-  const gchar *str;
+  IndividualSearchKeys *keys;
   GeeSet *personas;
   GeeIterator *iter;
-  gboolean retval = FALSE;
 
-  /* check alias name */
-  str = folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual));
+  keys = g_object_get_qdata (G_OBJECT (individual),
+      individual_search_keys_quark ());
+  if (keys != NULL)
+    return keys;
 
-  if (empathy_live_search_match_words (str, words))
-    return TRUE;
+  keys = g_slice_new0 (IndividualSearchKeys);
+  keys->individual = individual;
+  keys->alias_tokens = empathy_live_search_strip_utf8_string (
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
+  keys->ids = g_ptr_array_new_with_free_func (g_free);
+  keys->id_tokens = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_ptr_array_unref);
 
   personas = folks_individual_get_personas (individual);
-
-  /* check contact id, remove the @server.com part */
   iter = gee_iterable_iterator (GEE_ITERABLE (personas));
-  while (retval == FALSE && gee_iterator_next (iter))
+  while (gee_iterator_next (iter))
     {
       FolksPersona *persona = gee_iterator_get (iter);
-      const gchar *p;
 
       if (empathy_folks_persona_is_interesting (persona))
         {
-          str = folks_persona_get_display_id (persona);
-
-          /* Accept the persona if @text is a full prefix of his ID; that allows
-           * user to find, say, a jabber contact by typing his JID. */
-          if (g_str_has_prefix (str, text))
-            {
-              retval = TRUE;
-            }
-          else
-            {
-              gchar *dup_str = NULL;
-              gboolean visible;
-
-              p = strstr (str, "@");
-              if (p != NULL)
-                str = dup_str = g_strndup (str, p - str);
-
-              visible = empathy_live_search_match_words (str, words);
-              g_free (dup_str);
-              if (visible)
-                retval = TRUE;
-            }
+          const gchar *str = folks_persona_get_display_id (persona);
+          GPtrArray *tokens;
+          gchar *dup_str = NULL;
+          const gchar *p;
+
+          /* remove the @server.com part */
+          p = strstr (str, "@");
+          if (p != NULL)
+            dup_str = g_strndup (str, p - str);
+
+          tokens = empathy_live_search_strip_utf8_string (
+              dup_str != NULL ? dup_str : str);
+          g_free (dup_str);
+
+          g_ptr_array_add (keys->ids, g_strdup (str));
+          g_ptr_array_add (keys->id_tokens, tokens != NULL ? tokens :
+              g_ptr_array_new ());
         }
       g_clear_object (&persona);
     }
   g_clear_object (&iter);
 
+  keys->alias_changed_id = g_signal_connect (individual, "notify::alias",
+      G_CALLBACK (individual_search_keys_invalidate_cb), NULL);
+  keys->personas_changed_id = g_signal_connect (individual,
+      "personas-changed",
+      G_CALLBACK (individual_search_keys_invalidate_cb), NULL);
+
+  g_object_set_qdata_full (G_OBJECT (individual),
+      individual_search_keys_quark (), keys,
+      (GDestroyNotify) individual_search_keys_free);
+
+  return keys;
+}
+
+/* @words = empathy_live_search_strip_utf8_string (@text);
+ *
+ * User has to pass both so we don't have to compute @words ourself each time
+ * this function is called. The words of the individual are computed once and
+ * cached until its alias or personas change. */
+gboolean
+empathy_individual_match_string (FolksIndividual *individual,
+    const char *text,
+    GPtrArray *words)
+{
+  IndividualSearchKeys *keys;
+  guint i;
+
+  keys = individual_get_search_keys (individual);
+
+  /* check alias name */
+  if (words == NULL ||
+      empathy_live_search_match_stripped_words (keys->alias_tokens, words))
+    return TRUE;
+
+  /* check contact id, without the @server.com part */
+  for (i = 0; i < keys->ids->len; i++)
+    {
+      /* Accept the persona if @text is a full prefix of his ID; that allows
+       * user to find, say, a jabber contact by typing his JID. */
+      if (g_str_has_prefix (g_ptr_array_index (keys->ids, i), text))
+        return TRUE;
+
+      if (empathy_live_search_match_stripped_words (
+              g_ptr_array_index (keys->id_tokens, i), words))
+        return TRUE;
+    }
+
   /* FIXME: Add more rules here, we could check phone numbers in
    * contact's vCard for example. */
-  return retval;
+  return FALSE;
 }
 
 void
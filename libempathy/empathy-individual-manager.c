@@ -168,7 +168,8 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
   GeeIterator *iter;
   GeeSet *removed;
   GeeCollection *added;
-  GList *added_set = NULL, *added_filtered = NULL, *removed_list = NULL;
+  GHashTable *added_set;
+  GList *added_filtered = NULL, *removed_list = NULL;
 
   /* We're not interested in the relationships between the added and removed
    * individuals, so just extract collections of them. Note that the added
@@ -201,15 +202,22 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
   g_clear_object (&iter);
 
   /* Filter the individuals for ones which contain EmpathyContacts */
+  added_set = g_hash_table_new (NULL, NULL);
   iter = gee_iterable_iterator (GEE_ITERABLE (added));
   while (gee_iterator_next (iter))
     {
       FolksIndividual *ind = gee_iterator_get (iter);
 
-      /* Make sure we handle each added individual only once. */
-      if (ind == NULL || g_list_find (added_set, ind) != NULL)
+      if (ind == NULL)
         continue;
-      added_set = g_list_prepend (added_set, ind);
+
+      /* Make sure we handle each added individual only once. */
+      if (g_hash_table_lookup (added_set, ind) != NULL)
+        {
+          g_object_unref (ind);
+          continue;
+        }
+      g_hash_table_insert (added_set, ind, ind);
 
       g_signal_connect (ind, "notify::personas",
           G_CALLBACK (individual_notify_personas_cb), self);
@@ -224,13 +232,13 @@ aggregator_individuals_changed_cb (FolksIndividualAggregator *aggregator,
     }
   g_clear_object (&iter);
 
-  g_list_free (added_set);
+  g_hash_table_unref (added_set);
 
   g_object_unref (added);
   g_object_unref (removed);
 
   /* Bail if we have no individuals left */
-  if (added_filtered == NULL && removed == NULL)
+  if (added_filtered == NULL && removed_list == NULL)
     return;
 
   added_filtered = g_list_reverse (added_filtered);
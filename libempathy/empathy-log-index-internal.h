@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* In-memory side of EmpathyLogIndex and its journal format, kept apart from
+ * the logger and the file handling so it can be tested on its own. */
+
+#ifndef __EMPATHY_LOG_INDEX_INTERNAL_H__
+#define __EMPATHY_LOG_INDEX_INTERNAL_H__
+
+#include <glib.h>
+
+#include <telepathy-logger/entity.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_LOG_INDEX_HEADER "empathy-log-index 2"
+
+typedef struct
+{
+  guint id;
+  gchar *account_path;
+  gchar *target_id;
+  TplEntityType type;
+  guint32 julian;
+  /* Number of logged text events indexed in this document */
+  guint n_events;
+  /* Also holds text which wasn't counted in n_events, from an open
+   * conversation or an interrupted write */
+  gboolean dirty;
+  /* FALSE once the day has been indexed again under a newer document */
+  gboolean live;
+} EmpathyLogIndexDocument;
+
+typedef struct
+{
+  /* owned EmpathyLogIndexDocument, indexed by id */
+  GPtrArray *documents;
+  guint n_live;
+  guint n_dead;
+  /* owned "account\ntarget\ntype\njulian" -> borrowed live document */
+  GHashTable *live_documents;
+  /* owned "account\ntarget\ntype" -> GUINT_TO_POINTER (latest julian day) */
+  GHashTable *latest_days;
+  /* owned term -> owned GArray of postings */
+  GHashTable *terms;
+
+  /* Every log known to the logger has been indexed at some point */
+  gboolean complete;
+  /* The journal loaded was incomplete or unknown, and must be rewritten */
+  gboolean damaged;
+} EmpathyLogIndexData;
+
+typedef struct
+{
+  EmpathyLogIndexDocument *document;
+  gdouble score;
+} EmpathyLogIndexMatch;
+
+GPtrArray * _empathy_log_index_split (const gchar *text);
+
+EmpathyLogIndexData * _empathy_log_index_data_new (void);
+void _empathy_log_index_data_free (EmpathyLogIndexData *data);
+
+EmpathyLogIndexDocument * _empathy_log_index_data_lookup (
+    EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian);
+
+guint32 _empathy_log_index_data_get_latest_day (EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type);
+
+EmpathyLogIndexDocument * _empathy_log_index_data_add_document (
+    EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian,
+    GString *journal);
+
+void _empathy_log_index_data_add_texts (EmpathyLogIndexData *data,
+    EmpathyLogIndexDocument *doc,
+    GPtrArray *texts,
+    gboolean logged,
+    GString *journal);
+
+void _empathy_log_index_data_load (EmpathyLogIndexData *data,
+    gchar *contents);
+
+void _empathy_log_index_data_dump (EmpathyLogIndexData *data,
+    GString *journal);
+
+GList * _empathy_log_index_data_search (EmpathyLogIndexData *data,
+    const gchar *text);
+
+void _empathy_log_index_matches_free (GList *matches);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_INDEX_INTERNAL_H__ */
@@ -0,0 +1,1678 @@
+/*
+ * Copyright (C) 2012 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Inverted index of the text logged by telepathy-logger, so the log window
+ * does not have to scan every log file for each search.
+ *
+ * The unit of indexing is a document: one day of conversation with one
+ * contact or room, which is what the log window shows for a search hit.
+ * Each document keeps, for every word said that day, how many times it was
+ * said, and how many logged events it was built from.
+ *
+ * Text seen in open conversations is indexed right away to be searchable
+ * before the logs are read again, but without being counted as logged:
+ * the document is marked dirty instead, and indexed again from the logs at
+ * the next update.
+ *
+ * The index lives in a journal in the user data dir:
+ *
+ *   D <id> <entity type> <julian day> <account path> <target id>
+ *   P <document id> <count> <term>
+ *   N <document id> <number of logged events>
+ *   U <document id>
+ *   R
+ *
+ * Document ids are consecutive, starting from 0. A D line declaring a day
+ * which is already indexed supersedes the older document; this only happens
+ * when a day shrank or is dirty, normally new events are added to the
+ * existing document. The P lines of a document are followed by an N line,
+ * or by an U line if they came from an open conversation; P lines without
+ * either, left by an interrupted write, make the document dirty too. R
+ * records that every log known to the logger has been indexed. The journal
+ * is loaded back into memory in a
+ * thread on first use and rewritten from scratch when it is damaged or
+ * superseded documents pile up. It is only ever readable by the user, as it
+ * holds the vocabulary of every logged conversation.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+#include "action-chain-internal.h"
+#include "empathy-log-index.h"
+#include "empathy-log-index-internal.h"
+#include "empathy-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+#define LOG_INDEX_FILENAME "log-index"
+
+/* Seconds to wait before appending queued lines to the journal */
+#define FLUSH_TIMEOUT 5
+
+/* Words shorter or longer than this (in characters) are not indexed */
+#define MIN_TERM_LENGTH 2
+#define MAX_TERM_LENGTH 32
+
+/* Term frequency saturation, as in BM25 */
+#define TF_SATURATION 1.2
+
+typedef struct
+{
+  guint document;
+  guint count;
+} LogIndexPosting;
+
+static void
+log_index_document_free (EmpathyLogIndexDocument *doc)
+{
+  if (doc == NULL)
+    return;
+
+  g_free (doc->account_path);
+  g_free (doc->target_id);
+
+  g_slice_free (EmpathyLogIndexDocument, doc);
+}
+
+static void
+log_index_postings_free (GArray *postings)
+{
+  g_array_free (postings, TRUE);
+}
+
+static gchar *
+log_index_entity_key (const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type)
+{
+  return g_strdup_printf ("%s\n%s\n%u", account_path, target_id, type);
+}
+
+static gchar *
+log_index_document_key (const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian)
+{
+  return g_strdup_printf ("%s\n%s\n%u\n%u", account_path, target_id, type,
+      julian);
+}
+
+/* Splits @text into normalized words, skipping those which are too short or
+ * too long to be worth indexing. */
+GPtrArray *
+_empathy_log_index_split (const gchar *text)
+{
+  GPtrArray *words;
+  GString *word;
+  gchar *normalized, *folded;
+  const gchar *p;
+  guint len = 0;
+
+  words = g_ptr_array_new_with_free_func (g_free);
+
+  if (text == NULL)
+    return words;
+
+  normalized = g_utf8_normalize (text, -1, G_NORMALIZE_ALL);
+  if (normalized == NULL)
+    return words;
+
+  folded = g_utf8_casefold (normalized, -1);
+  word = g_string_new (NULL);
+
+  for (p = folded; ; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (c != 0 && g_unichar_isalnum (c))
+        {
+          g_string_append_unichar (word, c);
+          len++;
+          continue;
+        }
+
+      if (len >= MIN_TERM_LENGTH && len <= MAX_TERM_LENGTH)
+        g_ptr_array_add (words, g_strdup (word->str));
+
+      g_string_truncate (word, 0);
+      len = 0;
+
+      if (c == 0)
+        break;
+    }
+
+  g_string_free (word, TRUE);
+  g_free (folded);
+  g_free (normalized);
+
+  return words;
+}
+
+EmpathyLogIndexData *
+_empathy_log_index_data_new (void)
+{
+  EmpathyLogIndexData *data = g_slice_new0 (EmpathyLogIndexData);
+
+  data->documents = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) log_index_document_free);
+  data->live_documents = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  data->latest_days = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  data->terms = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) log_index_postings_free);
+
+  return data;
+}
+
+void
+_empathy_log_index_data_free (EmpathyLogIndexData *data)
+{
+  g_ptr_array_unref (data->documents);
+  g_hash_table_unref (data->live_documents);
+  g_hash_table_unref (data->latest_days);
+  g_hash_table_unref (data->terms);
+
+  g_slice_free (EmpathyLogIndexData, data);
+}
+
+EmpathyLogIndexDocument *
+_empathy_log_index_data_lookup (EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian)
+{
+  EmpathyLogIndexDocument *doc;
+  gchar *key;
+
+  key = log_index_document_key (account_path, target_id, type, julian);
+  doc = g_hash_table_lookup (data->live_documents, key);
+  g_free (key);
+
+  return doc;
+}
+
+guint32
+_empathy_log_index_data_get_latest_day (EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type)
+{
+  gpointer latest;
+  gchar *key;
+
+  key = log_index_entity_key (account_path, target_id, type);
+  latest = g_hash_table_lookup (data->latest_days, key);
+  g_free (key);
+
+  return GPOINTER_TO_UINT (latest);
+}
+
+static EmpathyLogIndexDocument *
+log_index_data_insert_document (EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian)
+{
+  EmpathyLogIndexDocument *doc, *old;
+  gchar *key;
+  gpointer latest;
+
+  doc = g_slice_new0 (EmpathyLogIndexDocument);
+  doc->id = data->documents->len;
+  doc->account_path = g_strdup (account_path);
+  doc->target_id = g_strdup (target_id);
+  doc->type = type;
+  doc->julian = julian;
+  doc->live = TRUE;
+
+  g_ptr_array_add (data->documents, doc);
+  data->n_live++;
+
+  key = log_index_document_key (account_path, target_id, type, julian);
+  old = g_hash_table_lookup (data->live_documents, key);
+  if (old != NULL)
+    {
+      old->live = FALSE;
+      data->n_live--;
+      data->n_dead++;
+    }
+  g_hash_table_insert (data->live_documents, key, doc);
+
+  key = log_index_entity_key (account_path, target_id, type);
+  latest = g_hash_table_lookup (data->latest_days, key);
+  if (GPOINTER_TO_UINT (latest) < julian)
+    g_hash_table_insert (data->latest_days, key, GUINT_TO_POINTER (julian));
+  else
+    g_free (key);
+
+  return doc;
+}
+
+static void
+log_index_append_document (GString *journal,
+    EmpathyLogIndexDocument *doc)
+{
+  gchar *path, *target;
+
+  path = g_strescape (doc->account_path, NULL);
+  target = g_strescape (doc->target_id, NULL);
+
+  g_string_append_printf (journal, "D\t%u\t%u\t%u\t%s\t%s\n", doc->id,
+      doc->type, doc->julian, path, target);
+
+  g_free (path);
+  g_free (target);
+}
+
+/* Adds a new document for a day, superseding the one indexed before if
+ * any. Its D line is appended to @journal unless it is %NULL. */
+EmpathyLogIndexDocument *
+_empathy_log_index_data_add_document (EmpathyLogIndexData *data,
+    const gchar *account_path,
+    const gchar *target_id,
+    TplEntityType type,
+    guint32 julian,
+    GString *journal)
+{
+  EmpathyLogIndexDocument *doc;
+
+  doc = log_index_data_insert_document (data, account_path, target_id, type,
+      julian);
+
+  if (journal != NULL)
+    log_index_append_document (journal, doc);
+
+  return doc;
+}
+
+/* Appends the line confirming the P lines of @doc */
+static void
+log_index_append_state (GString *journal,
+    EmpathyLogIndexDocument *doc)
+{
+  if (doc->dirty)
+    g_string_append_printf (journal, "U\t%u\n", doc->id);
+  else
+    g_string_append_printf (journal, "N\t%u\t%u\n", doc->id, doc->n_events);
+}
+
+static void
+log_index_data_add_posting (EmpathyLogIndexData *data,
+    const gchar *term,
+    guint document,
+    guint count)
+{
+  GArray *postings;
+  LogIndexPosting *last;
+  LogIndexPosting posting = { document, count };
+
+  postings = g_hash_table_lookup (data->terms, term);
+  if (postings == NULL)
+    {
+      postings = g_array_new (FALSE, FALSE, sizeof (LogIndexPosting));
+      g_hash_table_insert (data->terms, g_strdup (term), postings);
+    }
+
+  /* Text for a document usually arrives in one go, so merging with the last
+   * posting keeps one posting per document in the common case. Duplicates
+   * left otherwise are summed when searching. */
+  if (postings->len > 0)
+    {
+      last = &g_array_index (postings, LogIndexPosting, postings->len - 1);
+      if (last->document == document)
+        {
+          last->count += count;
+          return;
+        }
+    }
+
+  g_array_append_val (postings, posting);
+}
+
+/* Indexes @texts in @doc. If @logged, they are the next events logged for
+ * that day, otherwise they come from an open conversation and @doc becomes
+ * dirty. The lines recording them are appended to @journal unless it is
+ * %NULL. */
+void
+_empathy_log_index_data_add_texts (EmpathyLogIndexData *data,
+    EmpathyLogIndexDocument *doc,
+    GPtrArray *texts,
+    gboolean logged,
+    GString *journal)
+{
+  GHashTable *counts;
+  GHashTableIter iter;
+  gpointer term, count;
+  guint i, j;
+
+  counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < texts->len; i++)
+    {
+      GPtrArray *words = _empathy_log_index_split (
+          g_ptr_array_index (texts, i));
+
+      for (j = 0; j < words->len; j++)
+        {
+          term = g_ptr_array_index (words, j);
+          count = g_hash_table_lookup (counts, term);
+          g_hash_table_insert (counts, g_strdup (term),
+              GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+        }
+
+      g_ptr_array_unref (words);
+    }
+
+  g_hash_table_iter_init (&iter, counts);
+  while (g_hash_table_iter_next (&iter, &term, &count))
+    {
+      log_index_data_add_posting (data, term, doc->id,
+          GPOINTER_TO_UINT (count));
+
+      if (journal != NULL)
+        g_string_append_printf (journal, "P\t%u\t%u\t%s\n", doc->id,
+            GPOINTER_TO_UINT (count), (const gchar *) term);
+    }
+
+  if (logged)
+    doc->n_events += texts->len;
+  else
+    doc->dirty = TRUE;
+
+  if (journal != NULL)
+    log_index_append_state (journal, doc);
+
+  g_hash_table_unref (counts);
+}
+
+static EmpathyLogIndexDocument *
+log_index_data_get_document (EmpathyLogIndexData *data,
+    guint id)
+{
+  if (id >= data->documents->len)
+    return NULL;
+
+  return g_ptr_array_index (data->documents, id);
+}
+
+/* Returns FALSE if the rest of the journal can't be trusted */
+static gboolean
+log_index_data_parse_line (EmpathyLogIndexData *data,
+    gchar *line)
+{
+  EmpathyLogIndexDocument *doc;
+  gchar **fields;
+  gchar *end;
+  guint document, count;
+  gboolean valid = TRUE;
+
+  switch (line[0])
+    {
+      case 'P':
+        /* By far the most common line, so parse it in place */
+        document = strtoul (line + 2, &end, 10);
+        if (*end != '\t')
+          break;
+        count = strtoul (end + 1, &end, 10);
+        if (*end != '\t' || end[1] == '\0')
+          break;
+
+        doc = log_index_data_get_document (data, document);
+        if (doc != NULL)
+          {
+            log_index_data_add_posting (data, end + 1, document, count);
+            /* Until the N line says which events these postings are from */
+            doc->dirty = TRUE;
+          }
+        break;
+
+      case 'N':
+        document = strtoul (line + 2, &end, 10);
+        if (*end != '\t')
+          break;
+
+        doc = log_index_data_get_document (data, document);
+        if (doc != NULL)
+          {
+            doc->n_events = strtoul (end + 1, NULL, 10);
+            doc->dirty = FALSE;
+          }
+        break;
+
+      case 'U':
+        doc = log_index_data_get_document (data,
+            strtoul (line + 2, NULL, 10));
+        if (doc != NULL)
+          doc->dirty = TRUE;
+        break;
+
+      case 'D':
+        fields = g_strsplit (line, "\t", 6);
+
+        /* Ids are given in order, anything else is corruption */
+        if (g_strv_length (fields) != 6 ||
+            strtoul (fields[1], &end, 10) != data->documents->len ||
+            *end != '\0')
+          {
+            DEBUG ("Invalid document declaration, the log index will be "
+                "repaired");
+            valid = FALSE;
+          }
+        else
+          {
+            gchar *path = g_strcompress (fields[4]);
+            gchar *target = g_strcompress (fields[5]);
+
+            log_index_data_insert_document (data, path, target,
+                strtoul (fields[2], NULL, 10),
+                strtoul (fields[3], NULL, 10));
+
+            g_free (path);
+            g_free (target);
+          }
+        g_strfreev (fields);
+        break;
+
+      case 'R':
+        data->complete = TRUE;
+        break;
+
+      default:
+        break;
+    }
+
+  return valid;
+}
+
+/* Loads a journal into @data, which should be empty. @contents is modified
+ * while parsing. */
+void
+_empathy_log_index_data_load (EmpathyLogIndexData *data,
+    gchar *contents)
+{
+  gchar *line, *next;
+
+  next = strchr (contents, '\n');
+  if (next == NULL || strncmp (contents, EMPATHY_LOG_INDEX_HEADER "\n",
+          strlen (EMPATHY_LOG_INDEX_HEADER "\n")) != 0)
+    {
+      DEBUG ("Unknown log index format, it will be rebuilt");
+      data->damaged = TRUE;
+      return;
+    }
+
+  for (line = next + 1; *line != '\0'; line = next + 1)
+    {
+      next = strchr (line, '\n');
+
+      /* A partial line left by an interrupted write */
+      if (next == NULL)
+        {
+          data->damaged = TRUE;
+          break;
+        }
+
+      *next = '\0';
+      if (!log_index_data_parse_line (data, line))
+        {
+          data->damaged = TRUE;
+          break;
+        }
+    }
+}
+
+/* Drops superseded documents, numbers the others again from 0 and writes
+ * the whole of @data to @journal */
+void
+_empathy_log_index_data_dump (EmpathyLogIndexData *data,
+    GString *journal)
+{
+  GHashTableIter iter;
+  gpointer term, value;
+  guint *ids;
+  guint i, n = 0;
+
+  g_string_append (journal, EMPATHY_LOG_INDEX_HEADER "\n");
+
+  /* Old id -> new id, G_MAXUINT for superseded documents */
+  ids = g_new (guint, data->documents->len);
+
+  for (i = 0; i < data->documents->len; i++)
+    {
+      EmpathyLogIndexDocument *doc = g_ptr_array_index (data->documents, i);
+
+      if (doc->live)
+        {
+          ids[i] = n;
+          doc->id = n;
+          g_ptr_array_index (data->documents, n++) = doc;
+          log_index_append_document (journal, doc);
+        }
+      else
+        {
+          ids[i] = G_MAXUINT;
+          log_index_document_free (doc);
+        }
+    }
+
+  /* Don't free the moved documents when shrinking */
+  for (i = n; i < data->documents->len; i++)
+    g_ptr_array_index (data->documents, i) = NULL;
+  g_ptr_array_set_size (data->documents, n);
+
+  data->n_dead = 0;
+
+  g_hash_table_iter_init (&iter, data->terms);
+  while (g_hash_table_iter_next (&iter, &term, &value))
+    {
+      GArray *postings = value;
+      guint j = 0;
+
+      for (i = 0; i < postings->len; i++)
+        {
+          LogIndexPosting *p = &g_array_index (postings, LogIndexPosting, i);
+
+          if (ids[p->document] == G_MAXUINT)
+            continue;
+
+          p->document = ids[p->document];
+          g_string_append_printf (journal, "P\t%u\t%u\t%s\n",
+              p->document, p->count, (const gchar *) term);
+          g_array_index (postings, LogIndexPosting, j++) = *p;
+        }
+
+      if (j == 0)
+        g_hash_table_iter_remove (&iter);
+      else
+        g_array_set_size (postings, j);
+    }
+
+  g_free (ids);
+
+  /* After the P lines, which they confirm */
+  for (i = 0; i < data->documents->len; i++)
+    log_index_append_state (journal, g_ptr_array_index (data->documents, i));
+
+  if (data->complete)
+    g_string_append (journal, "R\n");
+
+  data->damaged = FALSE;
+}
+
+static gint
+log_index_match_compare (gconstpointer a,
+    gconstpointer b)
+{
+  const EmpathyLogIndexMatch *match_a = a;
+  const EmpathyLogIndexMatch *match_b = b;
+
+  if (match_a->score != match_b->score)
+    return match_a->score > match_b->score ? -1 : 1;
+
+  /* Most recent first */
+  if (match_a->document->julian != match_b->document->julian)
+    return match_a->document->julian > match_b->document->julian ? -1 : 1;
+
+  return 0;
+}
+
+/* Returns a new table of live document -> GUINT_TO_POINTER (term frequency)
+ * for @word, or for every term starting with @word if @prefix is %TRUE. */
+static GHashTable *
+log_index_data_lookup_word (EmpathyLogIndexData *data,
+    const gchar *word,
+    gboolean prefix)
+{
+  GHashTable *frequencies;
+  GHashTableIter iter;
+  gpointer term, postings;
+
+  frequencies = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  if (prefix)
+    g_hash_table_iter_init (&iter, data->terms);
+
+  while (TRUE)
+    {
+      GArray *array;
+      guint i;
+
+      if (prefix)
+        {
+          if (!g_hash_table_iter_next (&iter, &term, &postings))
+            break;
+          if (!g_str_has_prefix (term, word))
+            continue;
+        }
+      else
+        {
+          postings = g_hash_table_lookup (data->terms, word);
+          if (postings == NULL)
+            break;
+        }
+
+      array = postings;
+      for (i = 0; i < array->len; i++)
+        {
+          LogIndexPosting *p = &g_array_index (array, LogIndexPosting, i);
+          EmpathyLogIndexDocument *doc;
+          gpointer tf;
+
+          doc = log_index_data_get_document (data, p->document);
+          if (doc == NULL || !doc->live)
+            continue;
+
+          tf = g_hash_table_lookup (frequencies, doc);
+          g_hash_table_insert (frequencies, doc,
+              GUINT_TO_POINTER (GPOINTER_TO_UINT (tf) + p->count));
+        }
+
+      if (!prefix)
+        break;
+    }
+
+  return frequencies;
+}
+
+/* Returns the live documents containing every word of @text, the last one
+ * possibly as a prefix, as a list of EmpathyLogIndexMatch sorted by
+ * relevance then date. */
+GList *
+_empathy_log_index_data_search (EmpathyLogIndexData *data,
+    const gchar *text)
+{
+  GPtrArray *words;
+  GHashTable *scores = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *matches = NULL;
+  guint i;
+
+  words = _empathy_log_index_split (text);
+
+  for (i = 0; i < words->len; i++)
+    {
+      GHashTable *frequencies;
+      gdouble idf;
+
+      frequencies = log_index_data_lookup_word (data,
+          g_ptr_array_index (words, i), i == words->len - 1);
+
+      idf = log (1.0 + (gdouble) data->n_live /
+          MAX (g_hash_table_size (frequencies), 1));
+
+      if (scores == NULL)
+        {
+          scores = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+              NULL, g_free);
+
+          g_hash_table_iter_init (&iter, frequencies);
+          while (g_hash_table_iter_next (&iter, &key, NULL))
+            g_hash_table_insert (scores, key, g_new0 (gdouble, 1));
+        }
+
+      /* Keep only the documents containing every word */
+      g_hash_table_iter_init (&iter, scores);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          gdouble tf;
+
+          tf = GPOINTER_TO_UINT (g_hash_table_lookup (frequencies, key));
+          if (tf == 0)
+            {
+              g_hash_table_iter_remove (&iter);
+              continue;
+            }
+
+          *(gdouble *) value += idf * tf * (TF_SATURATION + 1) /
+              (tf + TF_SATURATION);
+        }
+
+      g_hash_table_unref (frequencies);
+    }
+
+  g_ptr_array_unref (words);
+
+  if (scores == NULL)
+    return NULL;
+
+  g_hash_table_iter_init (&iter, scores);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      EmpathyLogIndexMatch *match = g_slice_new0 (EmpathyLogIndexMatch);
+
+      match->document = key;
+      match->score = *(gdouble *) value;
+      matches = g_list_prepend (matches, match);
+    }
+
+  g_hash_table_unref (scores);
+
+  return g_list_sort (matches, log_index_match_compare);
+}
+
+static void
+log_index_match_free (EmpathyLogIndexMatch *match)
+{
+  g_slice_free (EmpathyLogIndexMatch, match);
+}
+
+void
+_empathy_log_index_matches_free (GList *matches)
+{
+  g_list_free_full (matches, (GDestroyNotify) log_index_match_free);
+}
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *singleton = NULL;
+
+struct _EmpathyLogIndexPriv
+{
+  gchar *filename;
+  /* NULL until the journal has been loaded */
+  EmpathyLogIndexData *data;
+  gboolean loading;
+  /* Owned LoggedText indexed while loading, oldest first */
+  GQueue early_texts;
+
+  /* Journal lines which have not been written to disk yet */
+  GString *pending;
+  guint flush_id;
+  /* The journal on disk can't be appended to and must be rewritten */
+  gboolean rewrite;
+
+  TplLogManager *log_manager;
+  TpAccountManager *account_manager;
+  /* Non-NULL while the index is catching up with the logs */
+  TplActionChain *chain;
+  gboolean update_failed;
+  /* Requested while loading or updating, done once that's finished */
+  gboolean update_queued;
+  gboolean rebuild_queued;
+};
+
+typedef struct
+{
+  gchar *account_path;
+  gchar *target_id;
+  TplEntityType type;
+  guint32 julian;
+  gchar *text;
+} LoggedText;
+
+typedef struct
+{
+  EmpathyLogIndex *self;
+  TpAccount *account;
+  TplEntity *entity;
+  GDate *date;
+} UpdateCtx;
+
+static void log_index_start_update (EmpathyLogIndex *self);
+
+static void
+logged_text_free (LoggedText *logged)
+{
+  g_free (logged->account_path);
+  g_free (logged->target_id);
+  g_free (logged->text);
+
+  g_slice_free (LoggedText, logged);
+}
+
+static UpdateCtx *
+update_ctx_new (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *entity,
+    GDate *date)
+{
+  UpdateCtx *ctx = g_slice_new0 (UpdateCtx);
+
+  ctx->self = self;
+  ctx->account = g_object_ref (account);
+  if (entity != NULL)
+    ctx->entity = g_object_ref (entity);
+  if (date != NULL)
+    ctx->date = g_date_new_julian (g_date_get_julian (date));
+
+  return ctx;
+}
+
+static void
+update_ctx_free (UpdateCtx *ctx)
+{
+  g_object_unref (ctx->account);
+  tp_clear_object (&ctx->entity);
+  tp_clear_pointer (&ctx->date, g_date_free);
+
+  g_slice_free (UpdateCtx, ctx);
+}
+
+static void
+log_index_write_all (EmpathyLogIndex *self)
+{
+  GFile *file;
+  gchar *dir;
+  GError *error = NULL;
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      self->priv->flush_id = 0;
+    }
+
+  /* Everything pending is in memory, and so in the dump */
+  g_string_truncate (self->priv->pending, 0);
+  _empathy_log_index_data_dump (self->priv->data, self->priv->pending);
+
+  dir = g_path_get_dirname (self->priv->filename);
+  g_mkdir_with_parents (dir, S_IRUSR | S_IWUSR | S_IXUSR);
+  g_free (dir);
+
+  /* Whatever the directory's permissions, the new file must not be
+   * readable by others, even if the old one was */
+  file = g_file_new_for_path (self->priv->filename);
+
+  if (g_file_replace_contents (file, self->priv->pending->str,
+          self->priv->pending->len, NULL, FALSE,
+          G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
+          NULL, NULL, &error))
+    {
+      self->priv->rewrite = FALSE;
+    }
+  else
+    {
+      DEBUG ("Failed to write log index: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_string_truncate (self->priv->pending, 0);
+  g_object_unref (file);
+}
+
+static gboolean
+log_index_flush (gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GFile *file;
+  GFileOutputStream *stream;
+  GError *error = NULL;
+
+  self->priv->flush_id = 0;
+
+  if (self->priv->pending->len == 0)
+    return FALSE;
+
+  if (self->priv->rewrite)
+    {
+      log_index_write_all (self);
+      return FALSE;
+    }
+
+  /* The journal exists and is private, it was checked when loading */
+  file = g_file_new_for_path (self->priv->filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+
+  if (stream == NULL ||
+      !g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+          self->priv->pending->str, self->priv->pending->len, NULL, NULL,
+          &error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error))
+    {
+      DEBUG ("Failed to write log index: %s", error->message);
+      g_error_free (error);
+
+      /* The journal may end with a partial line; start over next time */
+      self->priv->rewrite = TRUE;
+    }
+
+  g_string_truncate (self->priv->pending, 0);
+
+  tp_clear_object (&stream);
+  g_object_unref (file);
+
+  return FALSE;
+}
+
+static void
+log_index_schedule_flush (EmpathyLogIndex *self)
+{
+  if (self->priv->flush_id == 0 && self->priv->pending->len > 0)
+    self->priv->flush_id = g_timeout_add_seconds (FLUSH_TIMEOUT,
+        log_index_flush, self);
+}
+
+static void
+log_index_add_logged_text (EmpathyLogIndex *self,
+    LoggedText *logged)
+{
+  EmpathyLogIndexDocument *doc;
+  GPtrArray *texts;
+
+  doc = _empathy_log_index_data_lookup (self->priv->data,
+      logged->account_path, logged->target_id, logged->type, logged->julian);
+
+  if (doc == NULL)
+    doc = _empathy_log_index_data_add_document (self->priv->data,
+        logged->account_path, logged->target_id, logged->type,
+        logged->julian, self->priv->pending);
+
+  texts = g_ptr_array_new ();
+  g_ptr_array_add (texts, logged->text);
+  /* Not logged yet as far as the index knows: the next update indexes the
+   * day again from the logs */
+  _empathy_log_index_data_add_texts (self->priv->data, doc, texts, FALSE,
+      self->priv->pending);
+  g_ptr_array_unref (texts);
+
+  log_index_schedule_flush (self);
+}
+
+static void
+log_index_load_thread (GSimpleAsyncResult *simple,
+    GObject *object,
+    GCancellable *cancellable)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+  EmpathyLogIndexData *data;
+  GStatBuf st;
+  gchar *contents;
+  GError *error = NULL;
+  gint64 start;
+
+  /* Only written by this thread until the load completes */
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+
+  if (!g_file_get_contents (self->priv->filename, &contents, NULL, &error))
+    {
+      DEBUG ("No log index loaded: %s", error->message);
+      g_error_free (error);
+
+      data->damaged = TRUE;
+      return;
+    }
+
+  start = g_get_monotonic_time ();
+  _empathy_log_index_data_load (data, contents);
+  g_free (contents);
+
+  /* Written by an older version or by hand: rewrite it privately */
+  if (g_stat (self->priv->filename, &st) != 0 ||
+      (st.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+    data->damaged = TRUE;
+
+  DEBUG ("Loaded %u documents and %u terms in %" G_GINT64_FORMAT " ms",
+      data->n_live, g_hash_table_size (data->terms),
+      (g_get_monotonic_time () - start) / 1000);
+}
+
+static void
+log_index_loaded_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (source);
+  LoggedText *logged;
+
+  self->priv->loading = FALSE;
+  self->priv->data = g_simple_async_result_get_op_res_gpointer (
+      G_SIMPLE_ASYNC_RESULT (result));
+
+  if (self->priv->data->damaged)
+    self->priv->rewrite = TRUE;
+
+  while ((logged = g_queue_pop_head (&self->priv->early_texts)) != NULL)
+    {
+      log_index_add_logged_text (self, logged);
+      logged_text_free (logged);
+    }
+
+  if (self->priv->rebuild_queued)
+    empathy_log_index_rebuild (self);
+  else if (self->priv->update_queued)
+    log_index_start_update (self);
+}
+
+/* Loads the journal in a thread, returns TRUE if it is loaded already */
+static gboolean
+log_index_ensure_loaded (EmpathyLogIndex *self)
+{
+  GSimpleAsyncResult *simple;
+
+  if (self->priv->data != NULL)
+    return TRUE;
+
+  if (self->priv->loading)
+    return FALSE;
+
+  self->priv->loading = TRUE;
+
+  simple = g_simple_async_result_new (G_OBJECT (self), log_index_loaded_cb,
+      NULL, log_index_ensure_loaded);
+  g_simple_async_result_set_op_res_gpointer (simple,
+      _empathy_log_index_data_new (), NULL);
+  g_simple_async_result_run_in_thread (simple, log_index_load_thread,
+      G_PRIORITY_LOW, NULL);
+  g_object_unref (simple);
+
+  return FALSE;
+}
+
+static void
+log_index_update_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (source);
+  EmpathyLogIndexData *data = self->priv->data;
+
+  _tpl_action_chain_new_finish (source, result, NULL);
+  self->priv->chain = NULL;
+
+  if (self->priv->update_failed)
+    {
+      DEBUG ("Log index update failed");
+    }
+  else
+    {
+      DEBUG ("Log index up to date: %u documents", data->n_live);
+
+      if (!data->complete)
+        {
+          data->complete = TRUE;
+          g_string_append (self->priv->pending, "R\n");
+        }
+    }
+
+  /* Superseded documents only waste space, compact once they pile up */
+  if (self->priv->rewrite || data->n_dead > data->n_live / 4)
+    log_index_write_all (self);
+  else
+    log_index_flush (self);
+
+  if (self->priv->rebuild_queued)
+    empathy_log_index_rebuild (self);
+  else if (self->priv->update_queued)
+    log_index_start_update (self);
+}
+
+static void
+log_index_got_events_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+  EmpathyLogIndex *self = ctx->self;
+  EmpathyLogIndexDocument *doc;
+  const gchar *account_path, *target_id;
+  TplEntityType type;
+  guint32 julian;
+  GPtrArray *texts;
+  GList *events, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_events_for_date_finish (TPL_LOG_MANAGER (manager),
+      result, &events, &error))
+    {
+      DEBUG ("Could not get events to index: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  texts = g_ptr_array_new ();
+  for (l = events; l != NULL; l = l->next)
+    {
+      if (TPL_IS_TEXT_EVENT (l->data))
+        g_ptr_array_add (texts,
+            (gchar *) tpl_text_event_get_message (l->data));
+    }
+
+  account_path = tp_proxy_get_object_path (ctx->account);
+  target_id = tpl_entity_get_identifier (ctx->entity);
+  type = tpl_entity_get_entity_type (ctx->entity);
+  julian = g_date_get_julian (ctx->date);
+
+  doc = _empathy_log_index_data_lookup (self->priv->data, account_path,
+      target_id, type, julian);
+
+  if (doc != NULL && !doc->dirty && doc->n_events < texts->len)
+    {
+      /* Events are in logging order, only index the ones added since */
+      g_ptr_array_remove_range (texts, 0, doc->n_events);
+    }
+  else if (doc == NULL || doc->dirty || doc->n_events > texts->len)
+    {
+      /* New day, one with text from open conversations mixed in, or one
+       * which doesn't match what was indexed anymore */
+      doc = _empathy_log_index_data_add_document (self->priv->data,
+          account_path, target_id, type, julian, self->priv->pending);
+    }
+  else
+    {
+      /* Nothing new */
+      g_ptr_array_set_size (texts, 0);
+    }
+
+  if (texts->len > 0)
+    {
+      _empathy_log_index_data_add_texts (self->priv->data, doc, texts, TRUE,
+          self->priv->pending);
+      log_index_schedule_flush (self);
+    }
+
+  g_ptr_array_unref (texts);
+  g_list_free_full (events, g_object_unref);
+
+ out:
+  _tpl_action_chain_continue (self->priv->chain);
+  update_ctx_free (ctx);
+}
+
+static void
+log_index_get_events (TplActionChain *chain,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+
+  tpl_log_manager_get_events_for_date_async (ctx->self->priv->log_manager,
+      ctx->account, ctx->entity, TPL_EVENT_MASK_TEXT, ctx->date,
+      log_index_got_events_cb, ctx);
+}
+
+static void
+log_index_got_dates_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+  EmpathyLogIndex *self = ctx->self;
+  const gchar *account_path, *target_id;
+  TplEntityType type;
+  GList *dates, *l;
+  guint32 latest;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_dates_finish (TPL_LOG_MANAGER (manager),
+      result, &dates, &error))
+    {
+      DEBUG ("Could not get dates to index: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  account_path = tp_proxy_get_object_path (ctx->account);
+  target_id = tpl_entity_get_identifier (ctx->entity);
+  type = tpl_entity_get_entity_type (ctx->entity);
+
+  latest = _empathy_log_index_data_get_latest_day (self->priv->data,
+      account_path, target_id, type);
+
+  for (l = dates; l != NULL; l = l->next)
+    {
+      GDate *date = l->data;
+      guint32 julian = g_date_get_julian (date);
+
+      EmpathyLogIndexDocument *doc;
+
+      /* Only the latest indexed day may have grown since it was indexed,
+       * and dirty ones must be indexed again; got_events_cb does what is
+       * needed, if anything */
+      doc = _empathy_log_index_data_lookup (self->priv->data, account_path,
+          target_id, type, julian);
+      if (julian < latest && doc != NULL && !doc->dirty)
+        continue;
+
+      _tpl_action_chain_append (self->priv->chain, log_index_get_events,
+          update_ctx_new (self, ctx->account, ctx->entity, date));
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+
+ out:
+  _tpl_action_chain_continue (self->priv->chain);
+  update_ctx_free (ctx);
+}
+
+static void
+log_index_get_dates (TplActionChain *chain,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+
+  tpl_log_manager_get_dates_async (ctx->self->priv->log_manager,
+      ctx->account, ctx->entity, TPL_EVENT_MASK_TEXT,
+      log_index_got_dates_cb, ctx);
+}
+
+static void
+log_index_got_entities_cb (GObject *manager,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+  EmpathyLogIndex *self = ctx->self;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (TPL_LOG_MANAGER (manager),
+      result, &entities, &error))
+    {
+      DEBUG ("Could not get entities to index: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = entities; l != NULL; l = l->next)
+    _tpl_action_chain_append (self->priv->chain, log_index_get_dates,
+        update_ctx_new (self, ctx->account, l->data, NULL));
+
+  g_list_free_full (entities, g_object_unref);
+
+ out:
+  _tpl_action_chain_continue (self->priv->chain);
+  update_ctx_free (ctx);
+}
+
+static void
+log_index_get_entities (TplActionChain *chain,
+    gpointer user_data)
+{
+  UpdateCtx *ctx = user_data;
+
+  tpl_log_manager_get_entities_async (ctx->self->priv->log_manager,
+      ctx->account, log_index_got_entities_cb, ctx);
+}
+
+static void
+log_index_account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      DEBUG ("Failed to prepare account manager: %s", error->message);
+      g_error_free (error);
+
+      self->priv->update_failed = TRUE;
+      goto out;
+    }
+
+  accounts = tp_account_manager_get_valid_accounts (self->priv->account_manager);
+
+  for (l = accounts; l != NULL; l = l->next)
+    _tpl_action_chain_append (self->priv->chain, log_index_get_entities,
+        update_ctx_new (self, l->data, NULL, NULL));
+
+  g_list_free (accounts);
+
+ out:
+  _tpl_action_chain_continue (self->priv->chain);
+}
+
+static void
+log_index_prepare_account_manager (TplActionChain *chain,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      log_index_account_manager_prepared_cb, self);
+}
+
+static void
+log_index_start_update (EmpathyLogIndex *self)
+{
+  self->priv->update_queued = FALSE;
+  self->priv->update_failed = FALSE;
+
+  self->priv->chain = _tpl_action_chain_new_async (G_OBJECT (self),
+      log_index_update_cb, NULL);
+
+  _tpl_action_chain_append (self->priv->chain,
+      log_index_prepare_account_manager, self);
+  _tpl_action_chain_start (self->priv->chain);
+}
+
+static GObject *
+log_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (singleton != NULL)
+    {
+      retval = g_object_ref (singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_log_index_parent_class)->constructor
+        (type, n_props, props);
+
+      singleton = EMPATHY_LOG_INDEX (retval);
+      g_object_add_weak_pointer (retval, (gpointer) &singleton);
+    }
+
+  return retval;
+}
+
+static void
+log_index_dispose (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  if (self->priv->flush_id != 0)
+    {
+      g_source_remove (self->priv->flush_id);
+      log_index_flush (self);
+    }
+
+  tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->account_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->dispose (object);
+}
+
+static void
+log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  g_free (self->priv->filename);
+  tp_clear_pointer (&self->priv->data, _empathy_log_index_data_free);
+  g_queue_foreach (&self->priv->early_texts, (GFunc) logged_text_free, NULL);
+  g_queue_clear (&self->priv->early_texts);
+  g_string_free (self->priv->pending, TRUE);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructor = log_index_constructor;
+  object_class->dispose = log_index_dispose;
+  object_class->finalize = log_index_finalize;
+
+  g_type_class_add_private (object_class, sizeof (EmpathyLogIndexPriv));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  self->priv->filename = g_build_filename (g_get_user_data_dir (),
+      PACKAGE_NAME, LOG_INDEX_FILENAME, NULL);
+
+  g_queue_init (&self->priv->early_texts);
+  self->priv->pending = g_string_new (NULL);
+
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->account_manager = tp_account_manager_dup ();
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+}
+
+/**
+ * empathy_log_index_is_ready:
+ * @self: an #EmpathyLogIndex
+ *
+ * Starts loading the index if that wasn't done yet.
+ *
+ * Returns: %TRUE if the index is loaded and all the logs have been indexed
+ * at least once, so that empathy_log_index_search() can be used instead of
+ * searching the logs.
+ */
+gboolean
+empathy_log_index_is_ready (EmpathyLogIndex *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  if (!log_index_ensure_loaded (self))
+    return FALSE;
+
+  return self->priv->data->complete;
+}
+
+/**
+ * empathy_log_index_update:
+ * @self: an #EmpathyLogIndex
+ *
+ * Loads the index if needed, then indexes in the background the days of logs
+ * which are not indexed yet, and what was added to the most recent indexed
+ * day of each conversation since it was indexed. Without an index on disk,
+ * this builds it from all the existing logs.
+ */
+void
+empathy_log_index_update (EmpathyLogIndex *self)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (!log_index_ensure_loaded (self) || self->priv->chain != NULL)
+    {
+      self->priv->update_queued = TRUE;
+      return;
+    }
+
+  log_index_start_update (self);
+}
+
+/**
+ * empathy_log_index_rebuild:
+ * @self: an #EmpathyLogIndex
+ *
+ * Forgets everything indexed and indexes all the existing logs again, in the
+ * background. Searches fall back to the logger until that is done.
+ */
+void
+empathy_log_index_rebuild (EmpathyLogIndex *self)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (!log_index_ensure_loaded (self) || self->priv->chain != NULL)
+    {
+      self->priv->rebuild_queued = TRUE;
+      return;
+    }
+
+  DEBUG ("Rebuilding log index");
+
+  self->priv->rebuild_queued = FALSE;
+
+  _empathy_log_index_data_free (self->priv->data);
+  self->priv->data = _empathy_log_index_data_new ();
+
+  /* The next flush replaces the journal, whatever was queued for it */
+  g_string_truncate (self->priv->pending, 0);
+  self->priv->rewrite = TRUE;
+
+  log_index_start_update (self);
+}
+
+/**
+ * empathy_log_index_add_text:
+ * @self: an #EmpathyLogIndex
+ * @account: the account the text was sent or received on
+ * @target: the contact or room the conversation is with
+ * @timestamp: when the text was sent, in seconds since the Epoch
+ * @text: the text
+ *
+ * Indexes text as it is logged, so it can be found without waiting for the
+ * next empathy_log_index_update().
+ */
+void
+empathy_log_index_add_text (EmpathyLogIndex *self,
+    TpAccount *account,
+    TplEntity *target,
+    gint64 timestamp,
+    const gchar *text)
+{
+  LoggedText *logged;
+  GDateTime *dt;
+  GDate date;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (TPL_IS_ENTITY (target));
+
+  /* The logger files events under their UTC date */
+  dt = g_date_time_new_from_unix_utc (timestamp);
+  g_date_clear (&date, 1);
+  g_date_set_dmy (&date, g_date_time_get_day_of_month (dt),
+      g_date_time_get_month (dt), g_date_time_get_year (dt));
+  g_date_time_unref (dt);
+
+  logged = g_slice_new0 (LoggedText);
+  logged->account_path = g_strdup (tp_proxy_get_object_path (account));
+  logged->target_id = g_strdup (tpl_entity_get_identifier (target));
+  logged->type = tpl_entity_get_entity_type (target);
+  logged->julian = g_date_get_julian (&date);
+  logged->text = g_strdup (text);
+
+  if (!log_index_ensure_loaded (self))
+    {
+      g_queue_push_tail (&self->priv->early_texts, logged);
+      return;
+    }
+
+  log_index_add_logged_text (self, logged);
+  logged_text_free (logged);
+}
+
+/**
+ * empathy_log_index_search:
+ * @self: an #EmpathyLogIndex
+ * @text: the words to search for
+ *
+ * Finds the days of conversation containing all the words of @text. The last
+ * word also matches longer words it is the beginning of, so results can be
+ * shown while the user is still typing.
+ *
+ * Returns: a list of #EmpathyLogIndexHit, most relevant first, or %NULL if
+ * the index isn't loaded yet. Free with empathy_log_index_hits_free().
+ */
+GList *
+empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text)
+{
+  GList *matches, *l;
+  GList *hits = NULL;
+  gint64 start;
+
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), NULL);
+
+  if (!log_index_ensure_loaded (self))
+    return NULL;
+
+  start = g_get_monotonic_time ();
+  matches = _empathy_log_index_data_search (self->priv->data, text);
+
+  for (l = matches; l != NULL; l = l->next)
+    {
+      EmpathyLogIndexMatch *match = l->data;
+      EmpathyLogIndexDocument *doc = match->document;
+      TpAccount *account;
+      TplEntity *target;
+      GDate *date;
+
+      account = tp_account_manager_ensure_account (
+          self->priv->account_manager, doc->account_path);
+      if (account == NULL)
+        continue;
+
+      if (doc->type == TPL_ENTITY_ROOM)
+        target = tpl_entity_new_from_room_id (doc->target_id);
+      else
+        target = tpl_entity_new (doc->target_id, doc->type, NULL, NULL);
+
+      date = g_date_new_julian (doc->julian);
+
+      hits = g_list_prepend (hits, empathy_log_index_hit_new (account,
+          target, date, match->score));
+
+      g_object_unref (target);
+      g_date_free (date);
+    }
+
+  DEBUG ("Found %u hits for '%s' in %" G_GINT64_FORMAT " us",
+      g_list_length (hits), text, g_get_monotonic_time () - start);
+
+  _empathy_log_index_matches_free (matches);
+
+  return g_list_reverse (hits);
+}
+
+EmpathyLogIndexHit *
+empathy_log_index_hit_new (TpAccount *account,
+    TplEntity *target,
+    const GDate *date,
+    gdouble score)
+{
+  EmpathyLogIndexHit *hit = g_slice_new0 (EmpathyLogIndexHit);
+
+  hit->account = g_object_ref (account);
+  hit->target = g_object_ref (target);
+  hit->date = g_date_new_julian (g_date_get_julian (date));
+  hit->score = score;
+
+  return hit;
+}
+
+void
+empathy_log_index_hit_free (EmpathyLogIndexHit *hit)
+{
+  g_object_unref (hit->account);
+  g_object_unref (hit->target);
+  g_date_free (hit->date);
+
+  g_slice_free (EmpathyLogIndexHit, hit);
+}
+
+void
+empathy_log_index_hits_free (GList *hits)
+{
+  g_list_free_full (hits, (GDestroyNotify) empathy_log_index_hit_free);
+}
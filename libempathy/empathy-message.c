@@ -40,6 +40,7 @@
 #endif
 
 #include "empathy-client-factory.h"
+#include "empathy-gsettings.h"
 #include "empathy-message.h"
 #include "empathy-utils.h"
 #include "empathy-enum-types.h"
@@ -634,20 +635,192 @@ empathy_message_is_backlog (EmpathyMessage *message)
 }
 
 #define IS_SEPARATOR(ch) (ch == ' ' || ch == ',' || ch == '.' || ch == ':')
+
+/* Each pattern is the nick or a keyword as a 0-terminated array of
+ * lowercase characters */
+struct _EmpathyHighlightMatcher {
+	GPtrArray *patterns;
+};
+
+static void
+highlight_matcher_add_pattern (EmpathyHighlightMatcher *matcher,
+			       const gchar             *str)
+{
+	gunichar *pattern;
+	glong     i, len;
+
+	if (EMP_STR_EMPTY (str)) {
+		return;
+	}
+
+	pattern = g_utf8_to_ucs4_fast (str, -1, &len);
+	for (i = 0; i < len; i++) {
+		pattern[i] = g_unichar_tolower (pattern[i]);
+	}
+
+	g_ptr_array_add (matcher->patterns, pattern);
+}
+
+EmpathyHighlightMatcher *
+empathy_highlight_matcher_new (const gchar         *nick,
+			       const gchar * const *keywords)
+{
+	EmpathyHighlightMatcher *matcher;
+
+	matcher = g_slice_new (EmpathyHighlightMatcher);
+	matcher->patterns = g_ptr_array_new_with_free_func (g_free);
+
+	highlight_matcher_add_pattern (matcher, nick);
+	for (; keywords != NULL && *keywords != NULL; keywords++) {
+		highlight_matcher_add_pattern (matcher, *keywords);
+	}
+
+	return matcher;
+}
+
+void
+empathy_highlight_matcher_free (EmpathyHighlightMatcher *matcher)
+{
+	if (matcher == NULL) {
+		return;
+	}
+
+	g_ptr_array_unref (matcher->patterns);
+	g_slice_free (EmpathyHighlightMatcher, matcher);
+}
+
+/* Whether pattern is found at text, followed by a separator or the end */
+static gboolean
+highlight_pattern_match (const gunichar *pattern,
+			 const gchar    *text)
+{
+	for (; *pattern != 0; pattern++) {
+		if (*text == '\0' ||
+		    g_unichar_tolower (g_utf8_get_char (text)) != *pattern) {
+			return FALSE;
+		}
+		text = g_utf8_next_char (text);
+	}
+
+	return *text == '\0' || IS_SEPARATOR (*text);
+}
+
+/* Whether the nick or one of the keywords is in text, as a word delimited
+ * by separators. Case is ignored by comparing characters one at a time, so
+ * no lowercase copy of text is made. */
+gboolean
+empathy_highlight_matcher_match (EmpathyHighlightMatcher *matcher,
+				 const gchar             *text)
+{
+	const gchar *p;
+	gboolean     word_start = TRUE;
+
+	g_return_val_if_fail (matcher != NULL, FALSE);
+	g_return_val_if_fail (text != NULL, FALSE);
+
+	for (p = text; *p != '\0'; p = g_utf8_next_char (p)) {
+		if (word_start) {
+			guint i;
+
+			for (i = 0; i < matcher->patterns->len; i++) {
+				if (highlight_pattern_match (
+					g_ptr_array_index (matcher->patterns, i), p)) {
+					return TRUE;
+				}
+			}
+		}
+
+		word_start = IS_SEPARATOR (*p);
+	}
+
+	return FALSE;
+}
+
+static gchar **highlight_keywords = NULL;
+static guint   highlight_keywords_serial = 0;
+
+static void
+highlight_keywords_changed_cb (GSettings   *gsettings,
+			       const gchar *key,
+			       gpointer     user_data)
+{
+	g_strfreev (highlight_keywords);
+	highlight_keywords = g_settings_get_strv (gsettings, key);
+	highlight_keywords_serial++;
+}
+
+static const gchar * const *
+highlight_get_keywords (guint *serial)
+{
+	static GSettings *gsettings = NULL;
+
+	/* We intentionally leak the settings to keep the keywords up to date */
+	if (gsettings == NULL) {
+		gsettings = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
+		g_signal_connect (gsettings,
+			"changed::" EMPATHY_PREFS_CHAT_HIGHLIGHT_KEYWORDS,
+			G_CALLBACK (highlight_keywords_changed_cb), NULL);
+		highlight_keywords_changed_cb (gsettings,
+			EMPATHY_PREFS_CHAT_HIGHLIGHT_KEYWORDS, NULL);
+	}
+
+	*serial = highlight_keywords_serial;
+	return (const gchar * const *) highlight_keywords;
+}
+
+/* The matcher of a connection is kept on its self contact, and compiled
+ * again when the nick or the keywords change */
+typedef struct {
+	EmpathyHighlightMatcher *matcher;
+	gchar                   *nick;
+	guint                    keywords_serial;
+} HighlightMatcherCache;
+
+static void
+highlight_matcher_cache_free (HighlightMatcherCache *cache)
+{
+	empathy_highlight_matcher_free (cache->matcher);
+	g_free (cache->nick);
+	g_slice_free (HighlightMatcherCache, cache);
+}
+
+static EmpathyHighlightMatcher *
+message_get_highlight_matcher (EmpathyContact *self_contact,
+			       const gchar    *nick)
+{
+	HighlightMatcherCache *cache;
+	const gchar * const   *keywords;
+	guint                  serial;
+
+	keywords = highlight_get_keywords (&serial);
+
+	cache = g_object_get_data (G_OBJECT (self_contact),
+				   "empathy-highlight-matcher");
+	if (cache != NULL && cache->keywords_serial == serial &&
+	    !tp_strdiff (cache->nick, nick)) {
+		return cache->matcher;
+	}
+
+	cache = g_slice_new (HighlightMatcherCache);
+	cache->matcher = empathy_highlight_matcher_new (nick, keywords);
+	cache->nick = g_strdup (nick);
+	cache->keywords_serial = serial;
+	g_object_set_data_full (G_OBJECT (self_contact),
+				"empathy-highlight-matcher", cache,
+				(GDestroyNotify) highlight_matcher_cache_free);
+
+	return cache->matcher;
+}
+
 gboolean
 empathy_message_should_highlight (EmpathyMessage *message)
 {
 	EmpathyContact *contact;
 	const gchar   *msg, *to;
-	gchar         *cf_msg, *cf_to;
-	gchar         *ch;
-	gboolean       ret_val;
 	TpChannelTextMessageFlags flags;
 
 	g_return_val_if_fail (EMPATHY_IS_MESSAGE (message), FALSE);
 
-	ret_val = FALSE;
-
 	msg = empathy_message_get_body (message);
 	if (!msg) {
 		return FALSE;
@@ -670,36 +843,8 @@ empathy_message_should_highlight (EmpathyMessage *message)
 		return FALSE;
 	}
 
-	cf_msg = g_utf8_casefold (msg, -1);
-	cf_to = g_utf8_casefold (to, -1);
-
-	ch = strstr (cf_msg, cf_to);
-	if (ch == NULL) {
-		goto finished;
-	}
-	if (ch != cf_msg) {
-		/* Not first in the message */
-		if (!IS_SEPARATOR (*(ch - 1))) {
-			goto finished;
-		}
-	}
-
-	ch = ch + strlen (cf_to);
-	if (ch >= cf_msg + strlen (cf_msg)) {
-		ret_val = TRUE;
-		goto finished;
-	}
-
-	if (IS_SEPARATOR (*ch)) {
-		ret_val = TRUE;
-		goto finished;
-	}
-
-finished:
-	g_free (cf_msg);
-	g_free (cf_to);
-
-	return ret_val;
+	return empathy_highlight_matcher_match (
+		message_get_highlight_matcher (contact, to), msg);
 }
 
 TpChannelTextMessageType
@@ -769,6 +914,25 @@ empathy_message_equal (EmpathyMessage *message1, EmpathyMessage *message2)
 	return FALSE;
 }
 
+/* Hash function consistent with empathy_message_equal(), so messages can be
+ * looked up in a GHashTable using both */
+guint
+empathy_message_hash (EmpathyMessage *message)
+{
+	EmpathyMessagePriv *priv;
+	guint hash;
+
+	g_return_val_if_fail (EMPATHY_IS_MESSAGE (message), 0);
+
+	priv = GET_PRIV (message);
+
+	hash = g_int64_hash (&priv->timestamp);
+	if (priv->body != NULL)
+		hash ^= g_str_hash (priv->body);
+
+	return hash;
+}
+
 TpChannelTextMessageFlags
 empathy_message_get_flags (EmpathyMessage *self)
 {
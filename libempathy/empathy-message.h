@@ -82,9 +82,18 @@ TpChannelTextMessageType empathy_message_type_from_str     (const gchar
 const gchar *            empathy_message_type_to_str       (TpChannelTextMessageType  type);
 
 gboolean                 empathy_message_equal (EmpathyMessage *message1, EmpathyMessage *message2);
+guint                    empathy_message_hash  (EmpathyMessage *message);
 
 TpChannelTextMessageFlags empathy_message_get_flags        (EmpathyMessage           *message);
 
+typedef struct _EmpathyHighlightMatcher EmpathyHighlightMatcher;
+
+EmpathyHighlightMatcher * empathy_highlight_matcher_new    (const gchar              *nick,
+							    const gchar * const      *keywords);
+void                     empathy_highlight_matcher_free    (EmpathyHighlightMatcher  *matcher);
+gboolean                 empathy_highlight_matcher_match   (EmpathyHighlightMatcher  *matcher,
+							    const gchar              *text);
+
 G_END_DECLS
 
 #endif /* __EMPATHY_MESSAGE_H__ */
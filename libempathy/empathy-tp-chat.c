@@ -42,10 +42,14 @@ struct _EmpathyTpChatPrivate {
 	EmpathyContact        *user;
 	EmpathyContact        *remote_contact;
 	GList                 *members;
+	/* TpHandle -> owned GList link in members */
+	GHashTable            *members_by_handle;
 	/* Queue of messages not signalled yet */
 	GQueue                *messages_queue;
 	/* Queue of messages signalled but not acked yet */
 	GQueue                *pending_messages_queue;
+	/* borrowed TpMessage -> owned GList link in pending_messages_queue */
+	GHashTable            *pending_messages;
 
 	/* Subject */
 	gboolean               supports_subject;
@@ -80,6 +84,7 @@ enum {
 	SEND_ERROR,
 	CHAT_STATE_CHANGED,
 	MESSAGE_ACKNOWLEDGED,
+	MEMBERS_CHANGED_BATCH,
 	LAST_SIGNAL
 };
 
@@ -276,6 +281,9 @@ tp_chat_emit_queued_messages (EmpathyTpChat *self)
 		DEBUG ("Queued message ready");
 		g_queue_pop_head (self->priv->messages_queue);
 		g_queue_push_tail (self->priv->pending_messages_queue, message);
+		g_hash_table_insert (self->priv->pending_messages,
+			empathy_message_get_tp_message (message),
+			self->priv->pending_messages_queue->tail);
 		g_signal_emit (self, signals[MESSAGE_RECEIVED], 0, message);
 	}
 
@@ -437,19 +445,6 @@ message_received_cb (TpTextChannel   *channel,
 	handle_incoming_message (self, message, FALSE);
 }
 
-static gboolean
-find_pending_message_func (gconstpointer a,
-			   gconstpointer b)
-{
-	EmpathyMessage *msg = (EmpathyMessage *) a;
-	TpMessage *message = (TpMessage *) b;
-
-	if (empathy_message_get_tp_message (msg) == message)
-		return 0;
-
-	return -1;
-}
-
 static void
 pending_message_removed_cb (TpTextChannel   *channel,
 		            TpMessage *message,
@@ -457,12 +452,13 @@ pending_message_removed_cb (TpTextChannel   *channel,
 {
 	GList *m;
 
-	m = g_queue_find_custom (self->priv->pending_messages_queue, message,
-				 find_pending_message_func);
+	m = g_hash_table_lookup (self->priv->pending_messages, message);
 
 	if (m == NULL)
 		return;
 
+	g_hash_table_remove (self->priv->pending_messages, message);
+
 	g_signal_emit (self, signals[MESSAGE_ACKNOWLEDGED], 0, m->data);
 
 	g_object_unref (m->data);
@@ -744,10 +740,15 @@ tp_chat_dispose (GObject *object)
 	g_queue_foreach (self->priv->messages_queue, (GFunc) g_object_unref, NULL);
 	g_queue_clear (self->priv->messages_queue);
 
+	g_hash_table_remove_all (self->priv->pending_messages);
 	g_queue_foreach (self->priv->pending_messages_queue,
 		(GFunc) g_object_unref, NULL);
 	g_queue_clear (self->priv->pending_messages_queue);
 
+	g_hash_table_remove_all (self->priv->members_by_handle);
+	g_list_free_full (self->priv->members, g_object_unref);
+	self->priv->members = NULL;
+
 	tp_clear_object (&self->priv->ready_result);
 
 	if (G_OBJECT_CLASS (empathy_tp_chat_parent_class)->dispose)
@@ -763,6 +764,8 @@ tp_chat_finalize (GObject *object)
 
 	g_queue_free (self->priv->messages_queue);
 	g_queue_free (self->priv->pending_messages_queue);
+	g_hash_table_unref (self->priv->pending_messages);
+	g_hash_table_unref (self->priv->members_by_handle);
 	g_hash_table_unref (self->priv->messages_being_sent);
 
 	g_free (self->priv->title);
@@ -808,6 +811,75 @@ check_almost_ready (EmpathyTpChat *self)
 	check_ready (self);
 }
 
+static gboolean
+tp_chat_add_member (EmpathyTpChat  *self,
+		    EmpathyContact *contact)
+{
+	gpointer handle;
+
+	handle = GUINT_TO_POINTER (empathy_contact_get_handle (contact));
+	if (g_hash_table_lookup (self->priv->members_by_handle, handle) != NULL) {
+		return FALSE;
+	}
+
+	self->priv->members = g_list_prepend (self->priv->members,
+		g_object_ref (contact));
+	g_hash_table_insert (self->priv->members_by_handle, handle,
+		self->priv->members);
+
+	return TRUE;
+}
+
+static EmpathyContact *
+chat_lookup_contact (EmpathyTpChat *self,
+		     TpHandle       handle,
+		     gboolean       remove_)
+{
+	GList *l;
+	EmpathyContact *c;
+
+	l = g_hash_table_lookup (self->priv->members_by_handle,
+		GUINT_TO_POINTER (handle));
+	if (l == NULL) {
+		return NULL;
+	}
+
+	c = l->data;
+	if (remove_) {
+		/* Caller takes the reference. */
+		g_hash_table_remove (self->priv->members_by_handle,
+			GUINT_TO_POINTER (handle));
+		self->priv->members = g_list_delete_link (self->priv->members, l);
+	} else {
+		g_object_ref (c);
+	}
+
+	return c;
+}
+
+static void
+tp_chat_emit_members_changed (EmpathyTpChat  *self,
+			      GPtrArray      *contacts,
+			      EmpathyContact *actor,
+			      guint           reason,
+			      const gchar    *message,
+			      gboolean        is_member)
+{
+	guint i;
+
+	if (contacts->len == 0)
+		return;
+
+	g_signal_emit (self, signals[MEMBERS_CHANGED_BATCH], 0, contacts,
+		       actor, reason, message, is_member);
+
+	for (i = 0; i < contacts->len; i++) {
+		g_signal_emit_by_name (self, "members-changed",
+				       g_ptr_array_index (contacts, i), actor,
+				       reason, message, is_member);
+	}
+}
+
 static void
 tp_chat_got_added_contacts_cb (TpConnection            *connection,
 			       guint                    n_contacts,
@@ -821,56 +893,31 @@ tp_chat_got_added_contacts_cb (TpConnection            *connection,
 	EmpathyTpChat *self = (EmpathyTpChat *) chat;
 	guint i;
 	const TpIntSet *members;
-	TpHandle handle;
 	EmpathyContact *contact;
+	GPtrArray *added;
 
 	if (error) {
 		DEBUG ("Error: %s", error->message);
 		return;
 	}
 
+	added = g_ptr_array_sized_new (n_contacts);
 	members = tp_channel_group_get_members ((TpChannel *) self);
 	for (i = 0; i < n_contacts; i++) {
 		contact = contacts[i];
-		handle = empathy_contact_get_handle (contact);
 
 		/* Make sure the contact is still member */
-		if (tp_intset_is_member (members, handle)) {
-			self->priv->members = g_list_prepend (self->priv->members,
-				g_object_ref (contact));
-			g_signal_emit_by_name (chat, "members-changed",
-					       contact, NULL, 0, NULL, TRUE);
+		if (tp_intset_is_member (members,
+					 empathy_contact_get_handle (contact)) &&
+		    tp_chat_add_member (self, contact)) {
+			g_ptr_array_add (added, contact);
 		}
 	}
 
-	check_almost_ready (EMPATHY_TP_CHAT (chat));
-}
-
-static EmpathyContact *
-chat_lookup_contact (EmpathyTpChat *self,
-		     TpHandle       handle,
-		     gboolean       remove_)
-{
-	GList *l;
-
-	for (l = self->priv->members; l; l = l->next) {
-		EmpathyContact *c = l->data;
+	tp_chat_emit_members_changed (self, added, NULL, 0, NULL, TRUE);
+	g_ptr_array_unref (added);
 
-		if (empathy_contact_get_handle (c) != handle) {
-			continue;
-		}
-
-		if (remove_) {
-			/* Caller takes the reference. */
-			self->priv->members = g_list_delete_link (self->priv->members, l);
-		} else {
-			g_object_ref (c);
-		}
-
-		return c;
-	}
-
-	return NULL;
+	check_almost_ready (EMPATHY_TP_CHAT (chat));
 }
 
 typedef struct
@@ -933,8 +980,7 @@ tp_chat_got_renamed_contacts_cb (TpConnection            *connection,
 
 	/* Make sure the contact is still member */
 	if (tp_intset_is_member (members, handle)) {
-		self->priv->members = g_list_prepend (self->priv->members,
-			g_object_ref (new));
+		tp_chat_add_member (self, new);
 
 		if (old != NULL) {
 			g_signal_emit_by_name (self, "member-renamed",
@@ -967,6 +1013,7 @@ tp_chat_group_members_changed_cb (TpChannel     *channel,
 {
 	EmpathyContact *contact;
 	EmpathyContact *actor_contact = NULL;
+	GPtrArray *removed_contacts;
 	guint i;
 	ContactRenameData *rename_data;
 	TpHandle old_handle;
@@ -1005,18 +1052,20 @@ tp_chat_group_members_changed_cb (TpChannel     *channel,
 	}
 
 	/* Remove contacts that are not members anymore */
+	removed_contacts = g_ptr_array_new_with_free_func (g_object_unref);
 	for (i = 0; i < removed->len; i++) {
 		contact = chat_lookup_contact (self,
 			g_array_index (removed, TpHandle, i), TRUE);
 
 		if (contact != NULL) {
-			g_signal_emit_by_name (self, "members-changed", contact,
-					       actor_contact, reason, message,
-					       FALSE);
-			g_object_unref (contact);
+			g_ptr_array_add (removed_contacts, contact);
 		}
 	}
 
+	tp_chat_emit_members_changed (self, removed_contacts, actor_contact,
+				      reason, message, FALSE);
+	g_ptr_array_unref (removed_contacts);
+
 	/* Request added contacts */
 	if (added->len > 0) {
 		empathy_tp_contact_factory_get_from_handles (connection,
@@ -1246,6 +1295,31 @@ empathy_tp_chat_class_init (EmpathyTpChatClass *klass)
 			      G_TYPE_NONE,
 			      1, EMPATHY_TYPE_MESSAGE);
 
+	/**
+	 * EmpathyTpChat::members-changed-batch:
+	 * @self: the #EmpathyTpChat
+	 * @contacts: (element-type EmpathyContact): the members which joined
+	 *   or left
+	 * @actor: the contact responsible for the change, or %NULL
+	 * @reason: a #TpChannelGroupChangeReason
+	 * @message: the message associated with the change, or %NULL
+	 * @is_member: %TRUE if @contacts joined the chat
+	 *
+	 * Emitted once for all the members changed by a single group change,
+	 * a netsplit for example, right before
+	 * #EmpathyContactList::members-changed is emitted for each of them.
+	 */
+	signals[MEMBERS_CHANGED_BATCH] =
+		g_signal_new ("members-changed-batch",
+			      G_TYPE_FROM_CLASS (klass),
+			      G_SIGNAL_RUN_LAST,
+			      0,
+			      NULL, NULL,
+			      g_cclosure_marshal_generic,
+			      G_TYPE_NONE,
+			      5, G_TYPE_PTR_ARRAY, EMPATHY_TYPE_CONTACT,
+			      G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN);
+
 	g_type_class_add_private (object_class, sizeof (EmpathyTpChatPrivate));
 }
 
@@ -1257,6 +1331,8 @@ empathy_tp_chat_init (EmpathyTpChat *self)
 
 	self->priv->messages_queue = g_queue_new ();
 	self->priv->pending_messages_queue = g_queue_new ();
+	self->priv->pending_messages = g_hash_table_new (NULL, NULL);
+	self->priv->members_by_handle = g_hash_table_new (NULL, NULL);
 	self->priv->messages_being_sent = g_hash_table_new_full (
 		g_str_hash, g_str_equal, g_free, NULL);
 }
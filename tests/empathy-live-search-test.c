@@ -67,6 +67,48 @@ test_live_search (void)
     }
 }
 
+static void
+test_live_search_stripped (void)
+{
+  LiveSearchTest tests[] =
+    {
+      { "Hello World", "he", TRUE },
+      { "Hello World", "lo", FALSE },
+      { "Hello-World", "wo", TRUE },
+      { "HelloWorld", "wo", FALSE },
+      { "Gaëtan", "gaetan", TRUE },
+      { "Jorgen", "Jör", TRUE },
+      { "Xavier Claessens", "Cla Xav", TRUE },
+      { "Foo Bar Baz", "bar bazz", FALSE },
+      { "", "foo", FALSE },
+      { "Foo", "", TRUE },
+
+      { NULL, NULL, FALSE }
+    };
+  guint i;
+
+  for (i = 0; tests[i].string != NULL; i ++)
+    {
+      GPtrArray *tokens, *words;
+      gboolean match;
+
+      tokens = empathy_live_search_strip_utf8_string (tests[i].string);
+      words = empathy_live_search_strip_utf8_string (tests[i].prefix);
+
+      /* Matching the pre-stripped string must agree with matching the
+       * string itself */
+      match = empathy_live_search_match_stripped_words (tokens, words);
+      g_assert (match == tests[i].should_match);
+      g_assert (match == empathy_live_search_match_string (tests[i].string,
+            tests[i].prefix));
+
+      if (tokens != NULL)
+        g_ptr_array_unref (tokens);
+      if (words != NULL)
+        g_ptr_array_unref (words);
+    }
+}
+
 int
 main (int argc,
     char **argv)
@@ -76,6 +118,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/live-search", test_live_search);
+  g_test_add_func ("/live-search/stripped", test_live_search_stripped);
 
   result = g_test_run ();
   test_deinit ();
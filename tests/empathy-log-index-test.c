@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+#include <libempathy/empathy-log-index-internal.h>
+
+#define ACCOUNT_PATH "/org/freedesktop/Telepathy/Account/gabble/jabber/alice"
+
+static EmpathyLogIndexDocument *
+add_document (EmpathyLogIndexData *data,
+    const gchar *target_id,
+    guint32 julian,
+    GString *journal,
+    ...)
+{
+  EmpathyLogIndexDocument *doc;
+  GPtrArray *texts;
+  const gchar *text;
+  va_list args;
+
+  doc = _empathy_log_index_data_add_document (data, ACCOUNT_PATH, target_id,
+      TPL_ENTITY_CONTACT, julian, journal);
+
+  texts = g_ptr_array_new ();
+  va_start (args, journal);
+  while ((text = va_arg (args, const gchar *)) != NULL)
+    g_ptr_array_add (texts, (gchar *) text);
+  va_end (args);
+
+  _empathy_log_index_data_add_texts (data, doc, texts, TRUE, journal);
+  g_ptr_array_unref (texts);
+
+  return doc;
+}
+
+static EmpathyLogIndexData *
+load (const gchar *journal)
+{
+  EmpathyLogIndexData *data = _empathy_log_index_data_new ();
+  gchar *contents = g_strdup (journal);
+
+  _empathy_log_index_data_load (data, contents);
+  g_free (contents);
+
+  return data;
+}
+
+static void
+check_search (EmpathyLogIndexData *data,
+    const gchar *text,
+    ...)
+{
+  GList *matches, *l;
+  guint32 julian;
+  va_list args;
+
+  DEBUG ("Searching '%s'", text);
+
+  matches = _empathy_log_index_data_search (data, text);
+
+  va_start (args, text);
+  for (l = matches; l != NULL; l = l->next)
+    {
+      EmpathyLogIndexMatch *match = l->data;
+
+      julian = va_arg (args, guint32);
+      g_assert_cmpuint (match->document->julian, ==, julian);
+    }
+  g_assert_cmpuint (va_arg (args, guint32), ==, 0);
+  va_end (args);
+
+  _empathy_log_index_matches_free (matches);
+}
+
+static void
+test_split (void)
+{
+  struct {
+    const gchar *text;
+    const gchar *words;
+  } tests[] = {
+    { "Hello, WORLD!", "hello world" },
+    { "it's  a\tnew-day", "it new day" },
+    /* Compatibility characters and decomposed accents are normalized */
+    { "\xef\xac\x81le", "file" },
+    { "e\xcc\x81te\xcc\x81", "\xc3\xa9t\xc3\xa9" },
+    { "\xc3\x89T\xc3\x89", "\xc3\xa9t\xc3\xa9" },
+    /* Casefolding, not just lowering */
+    { "Stra\xc3\x9f" "e", "strasse" },
+    /* Single characters are not worth indexing */
+    { "a b cd", "cd" },
+    /* 32 characters is the longest word indexed */
+    { "abcdefghijklmnopqrstuvwxyz012345 abcdefghijklmnopqrstuvwxyz0123456",
+      "abcdefghijklmnopqrstuvwxyz012345" },
+    { "", "" },
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      GPtrArray *words;
+      gchar *joined;
+
+      words = _empathy_log_index_split (tests[i].text);
+      g_ptr_array_add (words, NULL);
+      joined = g_strjoinv (" ", (gchar **) words->pdata);
+
+      DEBUG ("'%s' -> '%s'", tests[i].text, joined);
+      g_assert_cmpstr (joined, ==, tests[i].words);
+
+      g_free (joined);
+      g_ptr_array_unref (words);
+    }
+}
+
+static void
+test_journal (void)
+{
+  EmpathyLogIndexData *data, *loaded;
+  EmpathyLogIndexDocument *doc;
+  GPtrArray *texts;
+  GString *journal;
+
+  journal = g_string_new (EMPATHY_LOG_INDEX_HEADER "\n");
+  data = _empathy_log_index_data_new ();
+
+  add_document (data, "bob@example.com", 2455000, journal,
+      "Hello world", "hello again", NULL);
+  doc = add_document (data, "carol@example.com", 2455001, journal,
+      "goodbye", NULL);
+  add_document (data, "bob@example.com", 2455002, journal, "tea", NULL);
+
+  /* A day which grew gets the new events added to its document */
+  texts = g_ptr_array_new ();
+  g_ptr_array_add (texts, "see you");
+  _empathy_log_index_data_add_texts (data, doc, texts, TRUE, journal);
+  g_ptr_array_unref (texts);
+  g_assert_cmpuint (doc->n_events, ==, 2);
+
+  loaded = load (journal->str);
+  g_assert (!loaded->damaged);
+  g_assert (!loaded->complete);
+  g_assert_cmpuint (loaded->n_live, ==, 3);
+
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455000);
+  g_assert (doc != NULL);
+  g_assert_cmpuint (doc->n_events, ==, 2);
+
+  g_assert (_empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_ROOM, 2455000) == NULL);
+  g_assert_cmpuint (_empathy_log_index_data_get_latest_day (loaded,
+      ACCOUNT_PATH, "bob@example.com", TPL_ENTITY_CONTACT), ==, 2455002);
+
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "carol@example.com", TPL_ENTITY_CONTACT, 2455001);
+  g_assert (doc != NULL);
+  g_assert_cmpuint (doc->n_events, ==, 2);
+
+  check_search (loaded, "hello", 2455000, 0);
+  check_search (loaded, "goodbye see", 2455001, 0);
+  _empathy_log_index_data_free (loaded);
+
+  /* An interrupted write leaves a partial line, which is dropped, and
+   * postings whose events are unknown, which make their document dirty */
+  g_string_append (journal, "R\nP\t2\t1\tcake\nP\t1\t1\tpartial");
+  loaded = load (journal->str);
+  g_assert (loaded->damaged);
+  g_assert (loaded->complete);
+  g_assert_cmpuint (loaded->n_live, ==, 3);
+  check_search (loaded, "partial", 0);
+  check_search (loaded, "tea", 2455002, 0);
+
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455002);
+  g_assert (doc->dirty);
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "carol@example.com", TPL_ENTITY_CONTACT, 2455001);
+  g_assert (!doc->dirty);
+  _empathy_log_index_data_free (loaded);
+
+  /* Document ids out of sequence can't be trusted, nor what follows */
+  loaded = load (EMPATHY_LOG_INDEX_HEADER "\n"
+      "D\t0\t1\t2455000\ta\tb\n"
+      "D\t4294967295\t1\t2455001\ta\tc\n"
+      "D\t1\t1\t2455002\ta\td\n");
+  g_assert (loaded->damaged);
+  g_assert_cmpuint (loaded->n_live, ==, 1);
+  g_assert_cmpuint (loaded->documents->len, ==, 1);
+  _empathy_log_index_data_free (loaded);
+
+  loaded = load (EMPATHY_LOG_INDEX_HEADER "\nD\t1\t1\t2455000\ta\tb\n");
+  g_assert (loaded->damaged);
+  g_assert_cmpuint (loaded->n_live, ==, 0);
+  _empathy_log_index_data_free (loaded);
+
+  /* A journal in an unknown format is ignored altogether */
+  loaded = load ("empathy-log-index 1\nD\t0\t1\t2455000\ta\tb\n");
+  g_assert (loaded->damaged);
+  g_assert_cmpuint (loaded->n_live, ==, 0);
+  _empathy_log_index_data_free (loaded);
+
+  loaded = load ("");
+  g_assert (loaded->damaged);
+  _empathy_log_index_data_free (loaded);
+
+  g_string_free (journal, TRUE);
+  _empathy_log_index_data_free (data);
+}
+
+static void
+test_supersede (void)
+{
+  EmpathyLogIndexData *data, *loaded;
+  EmpathyLogIndexDocument *old, *doc;
+  GString *journal;
+
+  journal = g_string_new (EMPATHY_LOG_INDEX_HEADER "\n");
+  data = _empathy_log_index_data_new ();
+
+  old = add_document (data, "bob@example.com", 2455000, journal,
+      "apple", "cherry", NULL);
+  doc = add_document (data, "bob@example.com", 2455000, journal,
+      "banana", NULL);
+
+  g_assert (!old->live);
+  g_assert (doc->live);
+  g_assert_cmpuint (data->n_live, ==, 1);
+  g_assert_cmpuint (data->n_dead, ==, 1);
+  g_assert (_empathy_log_index_data_lookup (data, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455000) == doc);
+
+  check_search (data, "apple", 0);
+  check_search (data, "banana", 2455000, 0);
+
+  /* Replaying the journal supersedes the same way */
+  loaded = load (journal->str);
+  g_assert_cmpuint (loaded->n_live, ==, 1);
+  g_assert_cmpuint (loaded->n_dead, ==, 1);
+  check_search (loaded, "apple", 0);
+  _empathy_log_index_data_free (loaded);
+
+  /* Compacting only keeps the live document */
+  data->complete = TRUE;
+  g_string_truncate (journal, 0);
+  _empathy_log_index_data_dump (data, journal);
+  g_assert_cmpuint (data->n_dead, ==, 0);
+  g_assert (strstr (journal->str, "apple") == NULL);
+  check_search (data, "banana", 2455000, 0);
+
+  loaded = load (journal->str);
+  g_assert (!loaded->damaged);
+  g_assert (loaded->complete);
+  g_assert_cmpuint (loaded->n_live, ==, 1);
+  g_assert_cmpuint (loaded->n_dead, ==, 0);
+
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455000);
+  g_assert (doc != NULL);
+  g_assert_cmpuint (doc->n_events, ==, 1);
+
+  /* Ids are given again from 0 when compacting */
+  g_assert_cmpuint (doc->id, ==, 0);
+  doc = add_document (loaded, "bob@example.com", 2455001, NULL,
+      "apple", NULL);
+  g_assert_cmpuint (doc->id, ==, 1);
+  check_search (loaded, "apple", 2455001, 0);
+  check_search (loaded, "banana", 2455000, 0);
+  _empathy_log_index_data_free (loaded);
+
+  g_string_free (journal, TRUE);
+  _empathy_log_index_data_free (data);
+}
+
+static void
+test_unlogged (void)
+{
+  EmpathyLogIndexData *data, *loaded;
+  EmpathyLogIndexDocument *doc;
+  GPtrArray *texts;
+  GString *journal;
+
+  journal = g_string_new (EMPATHY_LOG_INDEX_HEADER "\n");
+  data = _empathy_log_index_data_new ();
+
+  doc = add_document (data, "bob@example.com", 2455000, journal,
+      "apple", NULL);
+
+  /* Text from an open conversation is searchable, but not counted as
+   * logged */
+  texts = g_ptr_array_new ();
+  g_ptr_array_add (texts, "banana");
+  _empathy_log_index_data_add_texts (data, doc, texts, FALSE, journal);
+  g_ptr_array_unref (texts);
+
+  g_assert (doc->dirty);
+  g_assert_cmpuint (doc->n_events, ==, 1);
+  check_search (data, "banana", 2455000, 0);
+
+  loaded = load (journal->str);
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455000);
+  g_assert (doc->dirty);
+  g_assert_cmpuint (doc->n_events, ==, 1);
+  _empathy_log_index_data_free (loaded);
+
+  /* Compacting keeps it dirty */
+  g_string_truncate (journal, 0);
+  _empathy_log_index_data_dump (data, journal);
+  loaded = load (journal->str);
+  g_assert (!loaded->damaged);
+  doc = _empathy_log_index_data_lookup (loaded, ACCOUNT_PATH,
+      "bob@example.com", TPL_ENTITY_CONTACT, 2455000);
+  g_assert (doc->dirty);
+  g_assert_cmpuint (doc->n_events, ==, 1);
+
+  /* Indexing the day again from the logs cleans it */
+  doc = add_document (loaded, "bob@example.com", 2455000, NULL,
+      "apple", "banana", NULL);
+  g_assert (!doc->dirty);
+  g_assert_cmpuint (doc->n_events, ==, 2);
+  g_assert_cmpuint (loaded->n_live, ==, 1);
+  check_search (loaded, "banana", 2455000, 0);
+  _empathy_log_index_data_free (loaded);
+
+  g_string_free (journal, TRUE);
+  _empathy_log_index_data_free (data);
+}
+
+static void
+test_search (void)
+{
+  EmpathyLogIndexData *data;
+
+  data = _empathy_log_index_data_new ();
+
+  add_document (data, "bob@example.com", 2455001, NULL,
+      "red apple", NULL);
+  add_document (data, "bob@example.com", 2455002, NULL,
+      "red red", "red apple", NULL);
+  add_document (data, "carol@example.com", 2455003, NULL,
+      "red banana", NULL);
+  add_document (data, "carol@example.com", 2455005, NULL,
+      "Red Apple!", NULL);
+
+  /* Every word must match; more occurrences rank first, then the most
+   * recent day */
+  check_search (data, "red apple", 2455002, 2455005, 2455001, 0);
+  check_search (data, "apple red", 2455002, 2455005, 2455001, 0);
+  check_search (data, "banana", 2455003, 0);
+  check_search (data, "red cherry", 0);
+
+  /* Only the last word may be the start of a longer one */
+  check_search (data, "red app", 2455002, 2455005, 2455001, 0);
+  check_search (data, "app red", 0);
+  check_search (data, "re", 2455002, 2455005, 2455003, 2455001, 0);
+
+  check_search (data, "", 0);
+  check_search (data, "!", 0);
+
+  _empathy_log_index_data_free (data);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/log-index/split", test_split);
+  g_test_add_func ("/log-index/journal", test_journal);
+  g_test_add_func ("/log-index/supersede", test_supersede);
+  g_test_add_func ("/log-index/unlogged", test_unlogged);
+  g_test_add_func ("/log-index/search", test_search);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
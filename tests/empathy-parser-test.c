@@ -10,6 +10,7 @@
 #include <libempathy/empathy-debug.h>
 
 #include <libempathy-gtk/empathy-string-parser.h>
+#include <libempathy-gtk/empathy-webkit-utils.h>
 
 static void
 test_replace_match (const gchar *text,
@@ -77,6 +78,7 @@ test_parsers (void)
       "a:)b", "a[:)]b",
       ">:)", "[>:)]",
       ">:(", "&gt;[:(]",
+      ":(|b", "[:(]|b",
 
       /* Smileys and links mixed */
       ":)http://foo.com", "[:)][http://foo.com]",
@@ -121,6 +123,99 @@ test_parsers (void)
     }
 }
 
+static void
+test_html (void)
+{
+  gchar *tests[] =
+    {
+      /* Plain text is escaped */
+      "foo", "foo",
+      "<b>&'\"</b>", "&lt;b&gt;&amp;&apos;&quot;&lt;/b&gt;",
+      "caf\xc3\xa9", "caf\xc3\xa9",
+      "a\x01b", "a&#x1;b",
+
+      /* Links */
+      "http://foo.com", "<a href=\"http://foo.com\">http://foo.com</a>",
+      "www.foo.com", "<a href=\"http://www.foo.com\">www.foo.com</a>",
+      "user@server.com",
+        "<a href=\"mailto:user@server.com\">user@server.com</a>",
+      "Foo <www.foo.com>",
+        "Foo &lt;<a href=\"http://www.foo.com\">www.foo.com</a>&gt;",
+      "http://foo.com/?a=b&c=d",
+        "<a href=\"http://foo.com/?a=b&amp;c=d\">"
+        "http://foo.com/?a=b&amp;c=d</a>",
+
+      /* New lines and '\r' */
+      "badger\nmushroom", "badger<br/>mushroom",
+      "badger\r\nmushroom", "badger<br/>mushroom",
+      "http://foo.com\nhttp://bar.com",
+        "<a href=\"http://foo.com\">http://foo.com</a><br/>"
+        "<a href=\"http://bar.com\">http://bar.com</a>",
+
+      NULL, NULL
+    };
+  /* Inputs for which the single pass parser must produce the same output
+   * as the parser chain */
+  gchar *same[] =
+    {
+      "", "foo", "a:)b", ">:)", ">:(", ":)http://foo.com",
+      "a :) b http://foo.com c :( d www.test.com e",
+      "Foo <a href=\"http://foo.com\">:)</a>",
+      "<a href='http://apos'foo.com'>bar</a>",
+      "badger\n\rmushroom :-)\n:P",
+      "x\t y\x7f z \xc2\x85 \xc2\x86",
+      NULL
+    };
+  guint i;
+
+  DEBUG ("Started");
+  for (i = 0; tests[i] != NULL; i += 2)
+    {
+      GString *string;
+      gboolean ok;
+
+      string = g_string_new (NULL);
+      empathy_string_append_html (string, tests[i], -1,
+          EMPATHY_STRING_HTML_NEWLINES);
+
+      ok = !tp_strdiff (tests[i + 1], string->str);
+      DEBUG ("'%s' => '%s': %s", tests[i], string->str, ok ? "OK" : "FAILED");
+      g_assert (ok);
+
+      g_string_free (string, TRUE);
+    }
+
+  for (i = 0; same[i] != NULL; i++)
+    {
+      GString *chain, *html;
+
+      chain = g_string_new (NULL);
+      html = g_string_new (NULL);
+
+      /* Without smileys */
+      empathy_string_parser_substr (same[i], -1,
+          empathy_webkit_get_string_parser (FALSE), chain);
+      empathy_string_append_html (html, same[i], -1,
+          EMPATHY_STRING_HTML_NEWLINES);
+      DEBUG ("'%s' => '%s'", same[i], html->str);
+      g_assert_cmpstr (chain->str, ==, html->str);
+
+      g_string_truncate (chain, 0);
+      g_string_truncate (html, 0);
+
+      /* With smileys */
+      empathy_string_parser_substr (same[i], -1,
+          empathy_webkit_get_string_parser (TRUE), chain);
+      empathy_string_append_html (html, same[i], -1,
+          EMPATHY_STRING_HTML_NEWLINES | EMPATHY_STRING_HTML_SMILEYS);
+      DEBUG ("'%s' => '%s'", same[i], html->str);
+      g_assert_cmpstr (chain->str, ==, html->str);
+
+      g_string_free (chain, TRUE);
+      g_string_free (html, TRUE);
+    }
+}
+
 int
 main (int argc,
     char **argv)
@@ -130,6 +225,7 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/html", test_html);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include <libempathy/empathy-debug.h>
+#include <libempathy/empathy-message.h>
+
+static void
+test_highlight (void)
+{
+  const gchar * const keywords[] = { "cake", "", NULL };
+  EmpathyHighlightMatcher *matcher;
+  guint i;
+  struct {
+    const gchar *text;
+    gboolean highlight;
+  } tests[] =
+    {
+      { "bob", TRUE },
+      { "hi bob", TRUE },
+      { "bob: hi", TRUE },
+      { "BOB.", TRUE },
+      { "Hi Bob, how are you?", TRUE },
+      { "bobby", FALSE },
+      { "abob", FALSE },
+      { "bobby, bob", TRUE },
+      { "I like cake", TRUE },
+      { "cakes", FALSE },
+      { "", FALSE },
+    };
+
+  matcher = empathy_highlight_matcher_new ("Bob", keywords);
+  for (i = 0; i < G_N_ELEMENTS (tests); i++)
+    {
+      DEBUG ("Testing '%s'", tests[i].text);
+      g_assert (empathy_highlight_matcher_match (matcher, tests[i].text) ==
+          tests[i].highlight);
+    }
+  empathy_highlight_matcher_free (matcher);
+
+  /* Non-ASCII nick, without keywords */
+  matcher = empathy_highlight_matcher_new ("Éric", NULL);
+  g_assert (empathy_highlight_matcher_match (matcher, "salut éric"));
+  g_assert (!empathy_highlight_matcher_match (matcher, "cake"));
+  empathy_highlight_matcher_free (matcher);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/utils/highlight", test_highlight);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}